@@ -119,6 +119,7 @@ HEADERS += \
     $$PWD/various/channels.h \
     $$PWD/various/wavfile.h \
     $$PWD/various/Socket.h \
+    $$PWD/various/metrics.h \
     $$PWD/various/MathHelper.h \
     $$PWD/various/fft.h \
     $$PWD/various/ringbuffer.h \
@@ -126,6 +127,7 @@ HEADERS += \
     $$PWD/various/channels.h \
     $$PWD/various/wavfile.h \
     $$PWD/various/Socket.h \
+    $$PWD/various/metrics.h \
     $$PWD/various/MathHelper.h \
     $$PWD/libs/fec/char.h \
     $$PWD/libs/fec/decode_rs.h \
@@ -134,9 +136,13 @@ HEADERS += \
     $$PWD/libs/fec/init_rs.h \
     $$PWD/libs/fec/rs-common.h \
     $$PWD/backend/decoder_adapter.h \
+    $$PWD/input/channelizer.h \
+    $$PWD/input/halfband_decimator.h \
     $$PWD/input/input_factory.h \
+    $$PWD/input/iq_correction.h \
     $$PWD/input/null_device.h \
     $$PWD/input/raw_file.h \
+    $$PWD/input/sample_conversion.h \
     $$PWD/input/virtual_input.h \
     $$PWD/input/rtl_tcp.h
 	
@@ -172,9 +178,13 @@ SOURCES += \
     $$PWD/libs/fec/decode_rs_char.c \
     $$PWD/libs/fec/init_rs_char.c \
     $$PWD/backend/decoder_adapter.cpp \
+    $$PWD/input/channelizer.cpp \
+    $$PWD/input/halfband_decimator.cpp \
     $$PWD/input/input_factory.cpp \
+    $$PWD/input/iq_correction.cpp \
     $$PWD/input/null_device.cpp \
     $$PWD/input/raw_file.cpp \
+    $$PWD/input/sample_conversion.cpp \
     $$PWD/input/rtl_tcp.cpp
 
 
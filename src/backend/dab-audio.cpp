@@ -48,19 +48,23 @@ DabAudio::DabAudio(
         int16_t bitRate,
         ProtectionSettings protection,
         ProgrammeHandlerInterface& phi,
-        const std::string& dumpFileName) :
+        const std::string& dumpFileName,
+        bool batchedDeconvolution) :
     myProgrammeHandler(phi),
     mscBuffer(64 * 32768),
+    decodedBuffer(16 * 16384),
     dumpFileName(dumpFileName)
 {
     this->dabModus         = dabModus;
     this->fragmentSize     = fragmentSize;
     this->bitRate          = bitRate;
+    this->batchedDeconvolution = batchedDeconvolution;
 
     outV.resize(bitRate * 24);
     for (int i = 0; i < 16; i ++) {
         interleaveData[i].resize(fragmentSize);
     }
+    deinterleaved.resize(fragmentSize);
 
     using std::make_unique;
 
@@ -109,56 +113,123 @@ int32_t DabAudio::process(const softbit_t *v, int16_t cnt)
     return fr;
 }
 
+const softbit_t *DabAudio::timeDeinterleave(const softbit_t *v, int16_t cnt)
+{
+    if (cnt != fragmentSize) {
+        throw std::logic_error("Invalid fragment size");
+    }
+
+    if (not deinterleave(v)) {
+        return nullptr;
+    }
+
+    return deinterleaved.data();
+}
+
+const PuncturingScheme& DabAudio::puncturing() const
+{
+    return protectionHandler->puncturing();
+}
+
+void DabAudio::processDecoded(const uint8_t *bits)
+{
+    const int16_t cnt = decodedBits();
+
+    while (decodedBuffer.GetRingBufferWriteAvailable() < cnt) {
+        if (!running)
+            return;
+        std::this_thread::sleep_for(std::chrono::microseconds(1));
+    }
+
+    decodedBuffer.putDataIntoBuffer(bits, cnt);
+    mscDataAvailable.notify_all();
+}
+
 const int16_t interleaveMap[] = {0,8,4,12,2,10,6,14,1,9,5,13,3,11,7,15};
 
+// Returns true once the time deinterleaver is filled and
+// deinterleaved contains valid data
+bool DabAudio::deinterleave(const softbit_t *data)
+{
+    for (int16_t i = 0; i < fragmentSize; i ++) {
+        deinterleaved[i] = interleaveData[(interleaverIndex +
+                interleaveMap[i & 017]) & 017][i];
+        interleaveData[interleaverIndex][i] = data[i];
+    }
+    interleaverIndex = (interleaverIndex + 1) & 0x0F;
+
+    //  only continue when de-interleaver is filled
+    if (countforInterleaver <= 15) {
+        countforInterleaver ++;
+        return false;
+    }
+    return true;
+}
+
+void DabAudio::decodeFrame()
+{
+    PROFILE(DADispersal);
+    // and the inline energy dispersal
+    energyDispersal.dedisperse(outV);
+
+    if (our_dabProcessor) {
+        PROFILE(DADecode);
+        our_dabProcessor->addtoFrame(outV.data());
+    }
+    PROFILE(DADone);
+}
+
+bool DabAudio::hasData()
+{
+    if (batchedDeconvolution)
+        return decodedBuffer.GetRingBufferReadAvailable() >= decodedBits();
+    else
+        return mscBuffer.GetRingBufferReadAvailable() > fragmentSize;
+}
+
+bool DabAudio::waitUntilIdle(std::chrono::steady_clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(ourMutex);
+    return idleCondition.wait_until(lock, deadline, [&]() {
+            return !running || (idle && !hasData()); });
+}
+
 void DabAudio::run()
 {
-    int16_t i;
-    int16_t countforInterleaver = 0;
-    int16_t interleaverIndex    = 0;
     softbit_t Data[fragmentSize];
-    softbit_t tempX[fragmentSize];
 
     while (running) {
         std::unique_lock<std::mutex> lock(ourMutex);
-        while (running && mscBuffer.GetRingBufferReadAvailable() <= fragmentSize) {
+        while (running && !hasData()) {
+            idle = true;
+            idleCondition.notify_all();
             mscDataAvailable.wait(lock);
         }
+        idle = false;
         if (!running)
             break;
 
         // mscBuffer is threadsafe to access, no need to keep the lock
         lock.unlock();
 
+        if (batchedDeconvolution) {
+            PROFILE(DAGetMSCData);
+            decodedBuffer.getDataFromBuffer(outV.data(), decodedBits());
+            decodeFrame();
+            continue;
+        }
+
         PROFILE(DAGetMSCData);
         mscBuffer.getDataFromBuffer(Data, fragmentSize);
 
         PROFILE(DADeinterleave);
-        for (i = 0; i < fragmentSize; i ++) {
-            tempX[i] = interleaveData[(interleaverIndex +
-                    interleaveMap[i & 017]) & 017][i];
-            interleaveData[interleaverIndex][i] = Data[i];
-        }
-        interleaverIndex = (interleaverIndex + 1) & 0x0F;
-
-        //  only continue when de-interleaver is filled
-        if (countforInterleaver <= 15) {
-            countforInterleaver ++;
+        if (not deinterleave(Data)) {
             continue;
         }
 
         PROFILE(DADeconvolve);
-        protectionHandler->deconvolve(tempX, fragmentSize, outV.data());
-
-        PROFILE(DADispersal);
-        // and the inline energy dispersal
-        energyDispersal.dedisperse(outV);
+        protectionHandler->deconvolve(deinterleaved.data(), fragmentSize, outV.data());
 
-        if (our_dabProcessor) {
-            PROFILE(DADecode);
-            our_dabProcessor->addtoFrame(outV.data());
-        }
-        PROFILE(DADone);
+        decodeFrame();
     }
 }
-
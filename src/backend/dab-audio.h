@@ -48,33 +48,52 @@ class DabAudio : public DabVirtual
                   int16_t bitRate,
                   ProtectionSettings protection,
                   ProgrammeHandlerInterface& phi,
-                  const std::string& dumpFileName);
+                  const std::string& dumpFileName,
+                  bool batchedDeconvolution = false);
         ~DabAudio(void);
         DabAudio(const DabAudio&) = delete;
         DabAudio& operator=(const DabAudio&) = delete;
 
         int32_t process(const softbit_t *v, int16_t cnt);
 
+        const softbit_t *timeDeinterleave(const softbit_t *v, int16_t cnt);
+        const PuncturingScheme& puncturing(void) const;
+        int16_t decodedBits(void) const { return bitRate * 24; }
+        void processDecoded(const uint8_t *bits);
+        bool waitUntilIdle(std::chrono::steady_clock::time_point deadline);
+
     protected:
         ProgrammeHandlerInterface& myProgrammeHandler;
 
     private:
         void    run(void);
+        bool    deinterleave(const softbit_t *data);
+        void    decodeFrame(void);
+        bool    hasData(void);
+
         std::atomic<bool> running;
         AudioServiceComponentType dabModus;
         int16_t fragmentSize;
         int16_t bitRate;
+        bool    batchedDeconvolution;
         std::vector<uint8_t> outV;
         std::vector<softbit_t> interleaveData[16];
+        std::vector<softbit_t> deinterleaved;
+        int16_t countforInterleaver = 0;
+        int16_t interleaverIndex = 0;
         EnergyDispersal energyDispersal;
 
         std::condition_variable  mscDataAvailable;
+        // Set by the thread while it waits for data, under ourMutex
+        bool                     idle = false;
+        std::condition_variable  idleCondition;
         std::mutex               ourMutex;
         std::thread              ourThread;
 
         std::unique_ptr<Protection> protectionHandler;
         std::unique_ptr<DabProcessor> our_dabProcessor;
         RingBuffer<softbit_t> mscBuffer;
+        RingBuffer<uint8_t> decodedBuffer;
 
         const std::string dumpFileName;
 };
@@ -22,8 +22,10 @@
 #ifndef _DAB_VIRTUAL
 #define _DAB_VIRTUAL
 
+#include <chrono>
 #include <cstdint>
 #include "dab-constants.h"
+#include "viterbi.h"
 
 #define CUSize  (4 * 16)
 
@@ -31,6 +33,22 @@ class DabVirtual {
     public:
         virtual ~DabVirtual() {}
         virtual int32_t process(const softbit_t *v, int16_t cnt) = 0;
+
+        /* Batched decoding: the caller time-deinterleaves the fragment
+         * with timeDeinterleave(), runs the Viterbi decoder itself on the
+         * punctured logical frame using puncturing() and passes the
+         * decoded bits to processDecoded(). timeDeinterleave() returns
+         * nullptr while no logical frame is available yet.
+         */
+        virtual const softbit_t *timeDeinterleave(const softbit_t *v, int16_t cnt) = 0;
+        virtual const PuncturingScheme& puncturing(void) const = 0;
+        virtual int16_t decodedBits(void) const = 0;
+        virtual void processDecoded(const uint8_t *bits) = 0;
+
+        /* Wait until everything passed in that can be decoded has been,
+         * or until the deadline. Returns true if that is the case.
+         */
+        virtual bool waitUntilIdle(std::chrono::steady_clock::time_point deadline) = 0;
 };
 #endif
 
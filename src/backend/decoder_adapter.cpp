@@ -38,6 +38,9 @@ DecoderAdapter::DecoderAdapter(ProgrammeHandlerInterface &mr, int16_t bitRate, A
     else
         throw std::runtime_error("DecoderAdapter: Unkonwn service component");
 
+    untouchedStreamFormat = decoder->GetUntouchedStreamFileExtension();
+    decoder->AddUntouchedStreamConsumer(this);
+
     // Open a dump file (XPADxpert) if the user defined it
     if (!dumpFileName.empty()) {
         FILE *fd = fopen(dumpFileName.c_str(), "wb");
@@ -123,6 +126,12 @@ void DecoderAdapter::ProcessPAD(const uint8_t *xpad_data, size_t xpad_len, bool
     padDecoder.Process(xpad_data, xpad_len, exact_xpad_len, fpad_data);
 }
 
+void DecoderAdapter::ProcessUntouchedStream(const uint8_t *data, size_t len, size_t duration_ms)
+{
+    (void)duration_ms;
+    myInterface.onNewEncodedAudio(data, len, untouchedStreamFormat);
+}
+
 void DecoderAdapter::AudioError(const std::string &hint)
 {
     (void)hint;
@@ -38,9 +38,9 @@ FIBProcessor::FIBProcessor(RadioControllerInterface& mr) :
     clearEnsemble();
 }
 
-//  FIB's are segments of 256 bits. When here, we already
-//  passed the crc and we start unpacking into FIGs
-//  This is merely a dispatcher
+//  FIB's are segments of 256 bits, packed into 32 bytes.
+//  When here, we already passed the crc and we start
+//  unpacking into FIGs. This is merely a dispatcher
 void FIBProcessor::processFIB(uint8_t *p, uint16_t fib)
 {
     int8_t  processedBytes  = 0;
@@ -51,6 +51,17 @@ void FIBProcessor::processFIB(uint8_t *p, uint16_t fib)
     (void)fib;
     while (processedBytes  < 30) {
         const uint8_t FIGtype = getBits_3 (d, 0);
+        const int16_t FIGlength = getBits_5 (d, 3) + 1;
+        if (FIGtype == 7) {
+            break;
+        }
+
+        if (refreshRepeatedFIG(d, FIGlength)) {
+            processedBytes += FIGlength;
+            d = p + processedBytes;
+            continue;
+        }
+
         switch (FIGtype) {
             case 0:
                 process_FIG0(d);
@@ -64,19 +75,88 @@ void FIBProcessor::processFIB(uint8_t *p, uint16_t fib)
                 process_FIG2(d);
                 break;
 
-            case 7:
-                return;
-
             default:
                 //std::clog << "FIG%d present" << FIGtype << std::endl;
                 break;
         }
         //  Thanks to Ronny Kunze, who discovered that I used
         //  a p rather than a d
-        processedBytes += getBits_5 (d, 3) + 1;
-        d = p + processedBytes * 8;
+        processedBytes += FIGlength;
+        d = p + processedBytes;
+    }
+
+    if (ensembleChanged or snapshotFIGCacheGeneration != figCacheGeneration) {
+        publishSnapshot();
     }
 }
+
+static const size_t maxFIGCacheSize = 1024;
+
+bool FIBProcessor::refreshRepeatedFIG(const uint8_t *d, int16_t length)
+{
+    const uint8_t FIGtype = d[0] >> 5;
+    const uint8_t extension = d[1] & 0x1F;
+
+    // FIG 0/0 carries the CIF counter and FIG 0/10 the time, they
+    // are different every time.
+    if (FIGtype == 0 and (extension == 0 or extension == 10)) {
+        return false;
+    }
+
+    // Hash eight bytes at a time, the tail is padded with zeros
+    uint64_t hash = length;
+    for (int16_t i = 0; i < length; i += 8) {
+        uint64_t word = 0;
+        memcpy(&word, d + i, std::min<int16_t>(8, length - i));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 32;
+    }
+
+    auto it = figCache.find(hash);
+    if (it != figCache.end() and it->second.length == length and
+            memcmp(it->second.data.data(), d, length) == 0) {
+        auto& entry = it->second;
+        if (entry.generation != figCacheGeneration) {
+            entry.generation = figCacheGeneration;
+            ensembleChanged = true;
+            return false;
+        }
+
+        if (FIGtype == 0 and extension == 2) {
+            return refreshFIG0Extension2(d);
+        }
+        return true;
+    }
+
+    if (figCache.size() >= maxFIGCacheSize) {
+        figCache.clear();
+    }
+
+    figCacheGeneration++;
+    auto& entry = figCache[hash];
+    entry.length = length;
+    memcpy(entry.data.data(), d, length);
+    entry.generation = figCacheGeneration;
+    ensembleChanged = true;
+    return false;
+}
+
+void FIBProcessor::publishSnapshot()
+{
+    auto s = std::make_shared<EnsembleSnapshot>();
+    s->generation = ++snapshotGeneration;
+    s->ensembleId = ensembleId;
+    s->ensembleEcc = ensembleEcc;
+    s->ensembleLabel = ensembleLabel;
+    s->services = services;
+    s->components = components;
+    s->subChannels = subChannels;
+    std::atomic_store(&snapshot, std::shared_ptr<const EnsembleSnapshot>(std::move(s)));
+
+    snapshotFIGCacheGeneration = figCacheGeneration;
+    ensembleChanged = false;
+}
+
 //
 //  Handle ensemble is all through FIG0
 //
@@ -123,6 +203,7 @@ void FIBProcessor::FIG0Extension0 (uint8_t *d)
 
     if (ensembleId != eId) {
         ensembleId = eId;
+        figCacheGeneration++;
         myRadioInterface.onNewEnsemble(ensembleId);
     }
 
@@ -275,6 +356,41 @@ int16_t FIBProcessor::HandleFIG0Extension2(
         lOffset += 16;
     }
 
+    countServiceRepeat(SId);
+
+    numberofComponents = getBits_4(d, lOffset + 4);
+    lOffset += 8;
+
+    for (i = 0; i < numberofComponents; i ++) {
+        uint8_t TMid    = getBits_2 (d, lOffset);
+        if (TMid == 00)  {  // Audio
+            uint8_t ASCTy   = getBits_6 (d, lOffset + 2);
+            uint8_t SubChId = getBits_6 (d, lOffset + 8);
+            uint8_t PS_flag = getBits_1 (d, lOffset + 14);
+            bindAudioService(TMid, SId, i, SubChId, PS_flag, ASCTy);
+        }
+        else if (TMid == 1) { // MSC stream data
+            uint8_t DSCTy   = getBits_6 (d, lOffset + 2);
+            uint8_t SubChId = getBits_6 (d, lOffset + 8);
+            uint8_t PS_flag = getBits_1 (d, lOffset + 14);
+            bindDataStreamService(TMid, SId, i, SubChId, PS_flag, DSCTy);
+        }
+        else if (TMid == 3) { // MSC packet data
+            int16_t SCId    = getBits (d, lOffset + 2, 12);
+            uint8_t PS_flag = getBits_1 (d, lOffset + 14);
+            uint8_t CA_flag = getBits_1 (d, lOffset + 15);
+            bindPacketService(TMid, SId, i, SCId, PS_flag, CA_flag);
+        }
+        else {
+            // reserved
+        }
+        lOffset += 16;
+    }
+    return lOffset / 8;     // in Bytes
+}
+
+void FIBProcessor::countServiceRepeat(uint32_t SId)
+{
     // Keep track how often we see a service using a saturating counter.
     // Every time a service is signalled, we increment the counter.
     // If the counter is >= 2, we consider the service. Every second, we
@@ -311,44 +427,53 @@ int16_t FIBProcessor::HandleFIG0Extension2(
 #endif
     }
 
-    if (serviceRepeatCount[SId] < 4) {
-        serviceRepeatCount[SId]++;
+    auto& count = serviceRepeatCount[SId];
+    if (count < 4) {
+        count++;
     }
 
-    if (findServiceId(SId) == nullptr and serviceRepeatCount[SId] >= 2) {
+    if (count >= 2 and findServiceId(SId) == nullptr) {
         services.emplace_back(SId);
+        serviceIndex[SId] = services.size() - 1;
+        figCacheGeneration++;
         myRadioInterface.onServiceDetected(SId);
     }
+}
 
-    numberofComponents = getBits_4(d, lOffset + 4);
-    lOffset += 8;
-
-    for (i = 0; i < numberofComponents; i ++) {
-        uint8_t TMid    = getBits_2 (d, lOffset);
-        if (TMid == 00)  {  // Audio
-            uint8_t ASCTy   = getBits_6 (d, lOffset + 2);
-            uint8_t SubChId = getBits_6 (d, lOffset + 8);
-            uint8_t PS_flag = getBits_1 (d, lOffset + 14);
-            bindAudioService(TMid, SId, i, SubChId, PS_flag, ASCTy);
-        }
-        else if (TMid == 1) { // MSC stream data
-            uint8_t DSCTy   = getBits_6 (d, lOffset + 2);
-            uint8_t SubChId = getBits_6 (d, lOffset + 8);
-            uint8_t PS_flag = getBits_1 (d, lOffset + 14);
-            bindDataStreamService(TMid, SId, i, SubChId, PS_flag, DSCTy);
-        }
-        else if (TMid == 3) { // MSC packet data
-            int16_t SCId    = getBits (d, lOffset + 2, 12);
-            uint8_t PS_flag = getBits_1 (d, lOffset + 14);
-            uint8_t CA_flag = getBits_1 (d, lOffset + 15);
-            bindPacketService(TMid, SId, i, SCId, PS_flag, CA_flag);
+//  A repeated FIG 0/2 has to be counted again for all services it
+//  contains. It is only processed entirely if one of them is missing.
+bool FIBProcessor::refreshFIG0Extension2(const uint8_t *d)
+{
+    const int16_t length = d[0] & 0x1F;
+    const uint8_t pd = (d[1] & 0x20) >> 5;
+    std::array<uint32_t, 16> SIds;
+    size_t numSIds = 0;
+
+    int16_t used = 2;
+    while (used < length and numSIds < SIds.size()) {
+        if (pd == 1) {
+            SIds[numSIds] = ((uint32_t)d[used] << 24) | ((uint32_t)d[used + 1] << 16) |
+                ((uint32_t)d[used + 2] << 8) | d[used + 3];
+            used += 4;
         }
         else {
-            // reserved
+            SIds[numSIds] = ((uint32_t)d[used] << 8) | d[used + 1];
+            used += 2;
         }
-        lOffset += 16;
+
+        if (findServiceId(SIds[numSIds]) == nullptr) {
+            return false;
+        }
+
+        const int16_t numberofComponents = d[used] & 0x0F;
+        used += 1 + 2 * numberofComponents;
+        numSIds++;
     }
-    return lOffset / 8;     // in Bytes
+
+    for (size_t i = 0; i < numSIds; i++) {
+        countServiceRepeat(SIds[i]);
+    }
+    return true;
 }
 
 //      The Extension 3 of FIG type 0 (FIG 0/3) gives
@@ -519,7 +644,7 @@ void FIBProcessor::FIG0Extension10(uint8_t *fig)
         dateTime.seconds =  0;  // handle overflow
 
     dateTime.minutes = getBits_6(fig, offset + 26);
-    if (fig [offset + 20] == 1) {
+    if (getBits_1(fig, offset + 20) == 1) {
         dateTime.seconds = getBits_6(fig, offset + 32);
     }
 
@@ -597,10 +722,8 @@ void FIBProcessor::FIG0Extension14 (uint8_t *d)
         uint8_t fecScheme = getBits_2 (d, used * 8 + 6);
         used = used + 1;
 
-        for (int i = 0; i < 64; i++) {
-            if (subChannels[i].subChId == subChId) {
-                subChannels[i].fecScheme = fecScheme;
-            }
+        if (subChannels[subChId].subChId == subChId) {
+            subChannels[subChId].fecScheme = fecScheme;
         }
 
     }
@@ -943,14 +1066,8 @@ static void handle_ext_label_data_field(const uint8_t *f, uint8_t len_bytes,
 // UTF-8 or UCS2 Labels
 void FIBProcessor::process_FIG2(uint8_t *d)
 {
-    // In order to reuse code with etisnoop, convert
-    // the bit-vector into a byte-vector
-    std::vector<uint8_t> fig_bytes;
-    for (size_t i = 0; i < 30; i++) {
-        fig_bytes.push_back(getBits_8(d, 8*i));
-    }
-
-    uint8_t *f = fig_bytes.data();
+    // The FIG is byte-aligned, which allows to reuse code with etisnoop
+    const uint8_t *f = d;
 
     const uint8_t figlen = f[0] & 0x1F;
     f++;
@@ -1072,41 +1189,63 @@ void FIBProcessor::process_FIG2(uint8_t *d)
 // locate a reference to the entry for the Service serviceId
 Service *FIBProcessor::findServiceId(uint32_t serviceId)
 {
-    for (size_t i = 0; i < services.size(); i++) {
-        if (services[i].serviceId == serviceId) {
-            return &services[i];
-        }
+    auto it = serviceIndex.find(serviceId);
+    if (it == serviceIndex.end()) {
+        return nullptr;
     }
+    return &services[it->second];
+}
 
-    return nullptr;
+static uint64_t componentKey(uint32_t serviceId, int16_t SCIdS)
+{
+    return ((uint64_t)serviceId << 16) | (uint16_t)SCIdS;
 }
 
 ServiceComponent *FIBProcessor::findComponent(uint32_t serviceId, int16_t SCIdS)
 {
-    auto comp = std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == serviceId && sc.componentNr == SCIdS;
-                });
+    auto it = componentIndex.find(componentKey(serviceId, SCIdS));
+    if (it == componentIndex.end()) {
+        return nullptr;
+    }
+    return &components[it->second];
+}
 
-    if (comp == components.end()) {
+ServiceComponent *FIBProcessor::findPacketComponent(int16_t SCId)
+{
+    auto it = packetComponentIndex.find(SCId);
+    if (it == packetComponentIndex.end()) {
         return nullptr;
     }
-    else {
-        return &(*comp);
+    return &components[it->second];
+}
+
+void FIBProcessor::addComponent(const ServiceComponent& component)
+{
+    const size_t ix = components.size();
+    components.push_back(component);
+    componentIndex.emplace(componentKey(component.SId, component.componentNr), ix);
+    if (component.TMid == 03) {
+        packetComponentIndex.emplace(component.SCId, ix);
     }
+    figCacheGeneration++;
 }
 
-ServiceComponent *FIBProcessor::findPacketComponent(int16_t SCId)
+void FIBProcessor::rebuildIndexes()
 {
-    for (auto& component : components) {
-        if (component.TMid != 03) {
-            continue;
-        }
-        if (component.SCId == SCId) {
-            return &component;
+    serviceIndex.clear();
+    for (size_t i = 0; i < services.size(); i++) {
+        serviceIndex.emplace(services[i].serviceId, i);
+    }
+
+    componentIndex.clear();
+    packetComponentIndex.clear();
+    for (size_t i = 0; i < components.size(); i++) {
+        const auto& c = components[i];
+        componentIndex.emplace(componentKey(c.SId, c.componentNr), i);
+        if (c.TMid == 03) {
+            packetComponentIndex.emplace(c.SCId, i);
         }
     }
-    return nullptr;
 }
 
 //  bindAudioService is the main processor for - what the name suggests -
@@ -1122,10 +1261,7 @@ void FIBProcessor::bindAudioService(
     Service *s = findServiceId(SId);
     if (!s) return;
 
-    if (std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == s->serviceId && sc.componentNr == compnr;
-                }) == components.end()) {
+    if (findComponent(s->serviceId, compnr) == nullptr) {
         ServiceComponent newcomp;
         newcomp.TMid         = TMid;
         newcomp.componentNr  = compnr;
@@ -1133,7 +1269,7 @@ void FIBProcessor::bindAudioService(
         newcomp.subchannelId = subChId;
         newcomp.PS_flag      = ps_flag;
         newcomp.ASCTy        = ASCTy;
-        components.push_back(newcomp);
+        addComponent(newcomp);
 
         //  std::clog << "fib-processor:" << "service %8x (comp %d) is audio\n", SId, compnr) << std::endl;
     }
@@ -1150,10 +1286,7 @@ void FIBProcessor::bindDataStreamService(
     Service *s = findServiceId(SId);
     if (!s) return;
 
-    if (std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == s->serviceId && sc.componentNr == compnr;
-                }) == components.end()) {
+    if (findComponent(s->serviceId, compnr) == nullptr) {
         ServiceComponent newcomp;
         newcomp.TMid         = TMid;
         newcomp.SId          = SId;
@@ -1161,7 +1294,7 @@ void FIBProcessor::bindDataStreamService(
         newcomp.componentNr  = compnr;
         newcomp.PS_flag      = ps_flag;
         newcomp.DSCTy        = DSCTy;
-        components.push_back(newcomp);
+        addComponent(newcomp);
 
         //  std::clog << "fib-processor:" << "service %8x (comp %d) is packet\n", SId, compnr) << std::endl;
     }
@@ -1181,10 +1314,7 @@ void FIBProcessor::bindPacketService(
     Service *s = findServiceId(SId);
     if (!s) return;
 
-    if (std::find_if(components.begin(), components.end(),
-                [&](const ServiceComponent& sc) {
-                    return sc.SId == s->serviceId && sc.componentNr == compnr;
-                }) == components.end()) {
+    if (findComponent(s->serviceId, compnr) == nullptr) {
         ServiceComponent newcomp;
         newcomp.TMid        = TMid;
         newcomp.SId         = SId;
@@ -1192,7 +1322,7 @@ void FIBProcessor::bindPacketService(
         newcomp.SCId        = SCId;
         newcomp.PS_flag     = ps_flag;
         newcomp.CAflag      = CAflag;
-        components.push_back(newcomp);
+        addComponent(newcomp);
 
         //  std::clog << "fib-processor:" << "service %8x (comp %d) is packet\n", SId, compnr) << std::endl;
     }
@@ -1237,6 +1367,9 @@ void FIBProcessor::dropService(uint32_t SId)
         }
     }
 
+    rebuildIndexes();
+    figCacheGeneration++;
+
     std::clog << ss.str() << std::endl;
 }
 
@@ -1247,19 +1380,14 @@ void FIBProcessor::clearEnsemble()
     subChannels.resize(64);
     services.clear();
     serviceRepeatCount.clear();
+    rebuildIndexes();
+    figCache.clear();
     timeLastServiceDecrement = std::chrono::steady_clock::now();
+    publishSnapshot();
 }
 
-std::vector<Service> FIBProcessor::getServiceList() const
-{
-    std::lock_guard<std::mutex> lock(mutex);
-    return services;
-}
-
-Service FIBProcessor::getService(uint32_t sId) const
+Service EnsembleSnapshot::getService(uint32_t sId) const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-
     auto srv = std::find_if(services.begin(), services.end(),
                 [&](const Service& s) {
                     return s.serviceId == sId;
@@ -1273,10 +1401,9 @@ Service FIBProcessor::getService(uint32_t sId) const
     }
 }
 
-std::list<ServiceComponent> FIBProcessor::getComponents(const Service& s) const
+std::list<ServiceComponent> EnsembleSnapshot::getComponents(const Service& s) const
 {
     std::list<ServiceComponent> c;
-    std::lock_guard<std::mutex> lock(mutex);
     for (const auto& component : components) {
         if (component.SId == s.serviceId) {
             c.push_back(component);
@@ -1286,26 +1413,47 @@ std::list<ServiceComponent> FIBProcessor::getComponents(const Service& s) const
     return c;
 }
 
-Subchannel FIBProcessor::getSubchannel(const ServiceComponent& sc) const
+Subchannel EnsembleSnapshot::getSubchannel(const ServiceComponent& sc) const
 {
-    std::lock_guard<std::mutex> lock(mutex);
     return subChannels.at(sc.subchannelId);
 }
 
+std::shared_ptr<const EnsembleSnapshot> FIBProcessor::getEnsembleSnapshot() const
+{
+    return std::atomic_load(&snapshot);
+}
+
+std::vector<Service> FIBProcessor::getServiceList() const
+{
+    return getEnsembleSnapshot()->services;
+}
+
+Service FIBProcessor::getService(uint32_t sId) const
+{
+    return getEnsembleSnapshot()->getService(sId);
+}
+
+std::list<ServiceComponent> FIBProcessor::getComponents(const Service& s) const
+{
+    return getEnsembleSnapshot()->getComponents(s);
+}
+
+Subchannel FIBProcessor::getSubchannel(const ServiceComponent& sc) const
+{
+    return getEnsembleSnapshot()->getSubchannel(sc);
+}
+
 uint16_t FIBProcessor::getEnsembleId() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleId;
+    return getEnsembleSnapshot()->ensembleId;
 }
 
 uint8_t FIBProcessor::getEnsembleEcc() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleEcc;
+    return getEnsembleSnapshot()->ensembleEcc;
 }
 
 DabLabel FIBProcessor::getEnsembleLabel() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    return ensembleLabel;
+    return getEnsembleSnapshot()->ensembleLabel;
 }
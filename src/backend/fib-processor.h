@@ -30,21 +30,43 @@
 #include <unordered_map>
 #include <chrono>
 #include <array>
+#include <memory>
 #include <mutex>
 #include <cstdint>
 #include <cstdio>
 #include "msc-handler.h"
 #include "radio-controller.h"
 
+/* Immutable copy of the ensemble information, with a generation number
+ * that increases with every change. The FIBProcessor publishes a new
+ * one after each FIB that changed the ensemble, readers hold on to the
+ * snapshot without ever blocking the FIC decoding. */
+struct EnsembleSnapshot {
+    uint32_t generation = 0;
+    uint16_t ensembleId = 0;
+    uint8_t ensembleEcc = 0;
+    DabLabel ensembleLabel;
+    std::vector<Service> services;
+    std::vector<ServiceComponent> components;
+    std::vector<Subchannel> subChannels;
+
+    // Returns a service with sid 0 in case it is missing
+    Service getService(uint32_t sId) const;
+    std::list<ServiceComponent> getComponents(const Service& s) const;
+    Subchannel getSubchannel(const ServiceComponent& sc) const;
+};
+
 class FIBProcessor {
     public:
         FIBProcessor(RadioControllerInterface& mr);
 
-        // called from the demodulator
+        // called from the demodulator, p points to the 32 bytes of the
+        // FIB, followed by at least 8 bytes of padding for getBits
         void processFIB(uint8_t *p, uint16_t fib);
         void clearEnsemble();
 
         // Called from the frontend
+        std::shared_ptr<const EnsembleSnapshot> getEnsembleSnapshot() const;
         uint16_t getEnsembleId() const;
         uint8_t getEnsembleEcc() const;
         DabLabel getEnsembleLabel() const;
@@ -58,6 +80,8 @@ class FIBProcessor {
         Service *findServiceId(uint32_t serviceId);
         ServiceComponent *findComponent(uint32_t serviceId, int16_t SCIdS);
         ServiceComponent *findPacketComponent(int16_t SCId);
+        void addComponent(const ServiceComponent& component);
+        void rebuildIndexes(void);
 
         void bindAudioService(
                 int8_t TMid,
@@ -83,7 +107,14 @@ class FIBProcessor {
                 int16_t ps_flag,
                 int16_t CAflag);
 
+        void publishSnapshot(void);
         void dropService(uint32_t SId);
+        void countServiceRepeat(uint32_t SId);
+
+        // Returns true if the FIG is a repetition of one that was already
+        // processed, and only needs to refresh the state depending on it
+        bool refreshRepeatedFIG(const uint8_t *d, int16_t length);
+        bool refreshFIG0Extension2(const uint8_t *d);
 
         void process_FIG0(uint8_t *);
         void process_FIG1(uint8_t *);
@@ -121,7 +152,7 @@ class FIBProcessor {
 
         bool timeOffsetReceived = false;
         dab_date_time_t dateTime = {};
-        mutable std::mutex mutex;
+        std::mutex mutex;
         uint16_t ensembleId = 0;
         uint8_t ensembleEcc = 0;
         DabLabel ensembleLabel;
@@ -130,6 +161,34 @@ class FIBProcessor {
         std::vector<Service> services;
         std::unordered_map<uint32_t, uint8_t> serviceRepeatCount;
         std::chrono::steady_clock::time_point timeLastServiceDecrement;
+
+        // Indexes into services and components, keyed by SId, by
+        // SId << 16 | SCIdS and by SCId for packet mode components.
+        // They have to be rebuilt when elements get removed.
+        std::unordered_map<uint32_t, size_t> serviceIndex;
+        std::unordered_map<uint64_t, size_t> componentIndex;
+        std::unordered_map<int16_t, size_t> packetComponentIndex;
+
+        /* Most FIGs are repeated unchanged many times per second. The
+         * last instance of every FIG is kept, keyed by the hash of its
+         * content. An identical FIG is only processed again if the
+         * generation changed since it was last processed. The generation
+         * is incremented whenever new FIG content arrives or services
+         * and components appear or disappear, because the outcome of
+         * processing a FIG can depend on other FIGs. */
+        struct FIGCacheEntry {
+            int16_t length = 0;
+            std::array<uint8_t, 32> data;
+            uint32_t generation = 0;
+        };
+        std::unordered_map<uint64_t, FIGCacheEntry> figCache;
+        uint32_t figCacheGeneration = 0;
+
+        // Only accessed through std::atomic_load and std::atomic_store
+        std::shared_ptr<const EnsembleSnapshot> snapshot;
+        uint32_t snapshotGeneration = 0;
+        uint32_t snapshotFIGCacheGeneration = 0;
+        bool ensembleChanged = false;
 };
 
 #endif
@@ -26,6 +26,7 @@
 #include "fic-handler.h"
 #include "msc-handler.h"
 #include "protTables.h"
+#include "tools.h"
 
 //  The 3072 bits of the serial motherword shall be split into
 //  24 blocks of 128 bits each.
@@ -54,11 +55,24 @@ FicHandler::FicHandler(RadioControllerInterface& mr) :
     fibProcessor(mr),
     myRadioInterface(mr),
     bitBuffer_out(768),
-    ofdm_input(2304),
-    viterbiBlock(3072 + 24)
+    fibBytes(768 / 8 + 32),
+    ofdm_input(2304)
 {
     PI_15 = getPCodes(15 - 1);
     PI_16 = getPCodes(16 - 1);
+
+    /**
+     * a block of 2304 bits is considered to be a codeword
+     * In the first step we have 21 blocks with puncturing according to PI_16
+     * each 128 bit block contains 4 subblocks of 32 bits
+     * on which the given puncturing is applied
+     * In the second step
+     * we have 3 blocks with puncturing according to PI_15
+     * and a final block of 24 bits with puncturing according to PI_X
+     * This block constitues the 6 * 4 bits of the register itself.
+     */
+    puncturing.addBlocks(21, PI_16);
+    puncturing.addBlocks(3, PI_15);
     std::vector<uint8_t> shiftRegister(9, 1);
 
     for (int i = 0; i < 768; i++) {
@@ -136,65 +150,17 @@ void FicHandler::processFicBlock(const softbit_t *data, int16_t blkno)
  * \brief processFicInput
  * we have a vector of 2304 (0 .. 2303) soft bits that has
  * to be de-punctured and de-conv-ed into a block of 768 bits
- * In this approach we first create the full 3072 block (i.e.
- * we first depuncture, and then we apply the deconvolution
- * In the next coding step, we will combine this function with the
- * one above
+ * The Viterbi decoder reads the punctured bits directly,
+ * the puncturing scheme was set up in the constructor.
  */
 void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
 {
-    int16_t input_counter = 0;
-    int16_t i, k;
-    int32_t local         = 0;
-
-    memset(viterbiBlock.data(), 0, viterbiBlock.size() * sizeof(*viterbiBlock.data()));
+    int16_t i;
 
     /**
-     * a block of 2304 bits is considered to be a codeword
-     * In the first step we have 21 blocks with puncturing according to PI_16
-     * each 128 bit block contains 4 subblocks of 32 bits
-     * on which the given puncturing is applied
-     */
-    for (i = 0; i < 21; i ++) {
-        for (k = 0; k < 32 * 4; k ++) {
-            if (PI_16 [k % 32] != 0) {
-                viterbiBlock[local] = ficblock[input_counter ++];
-            }
-            local ++;
-        }
-    }
-
-    /**
-     * In the second step
-     * we have 3 blocks with puncturing according to PI_15
-     * each 128 bit block contains 4 subblocks of 32 bits
-     * on which the given puncturing is applied
-     */
-    for (i = 0; i < 3; i ++) {
-        for (k = 0; k < 32 * 4; k ++) {
-            if (PI_15 [k % 32] != 0) {
-                viterbiBlock[local] = ficblock[input_counter ++];
-            }
-            local++;
-        }
-    }
-
-    /**
-     * we have a final block of 24 bits  with puncturing according to PI_X
-     * This block constitues the 6 * 4 bits of the register itself.
-     */
-    for (k = 0; k < 24; k ++) {
-        if (PI_X [k] != 0) {
-            viterbiBlock[local] = ficblock[input_counter++];
-        }
-        local ++;
-    }
-
-    /**
-     * Now we have the full word ready for deconvolution
      * deconvolution is according to DAB standard section 11.2
      */
-    deconvolve(viterbiBlock.data(), bitBuffer_out.data());
+    deconvolve(ficblock, puncturing, bitBuffer_out.data());
 
     /**
      * if everything worked as planned, we now have a
@@ -207,15 +173,28 @@ void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
         bitBuffer_out[i] ^= PRBS[i];
     }
 
+    /**
+     * the bits are packed into bytes once, the crc is calculated
+     * a byte at a time and the FIB processor reads the fields
+     * from the packed bytes
+     */
+    for (i = 0; i < 768 / 8; i ++) {
+        uint8_t byte = 0;
+        for (int j = 0; j < 8; j ++) {
+            byte = (byte << 1) | bitBuffer_out[8 * i + j];
+        }
+        fibBytes[i] = byte;
+    }
+
     /**
      * each of the fib blocks is protected by a crc
      * (we know that there are three fib blocks each time we are here
      * we keep track of the successrate
      */
     for (i = ficno * 3; i < ficno * 3 + 3; i ++) {
-        uint8_t *p = &bitBuffer_out[(i % 3) * 256];
-        const bool crcvalid = check_CRC_bits(p, 256);
-        myRadioInterface.onFIBDecodeSuccess(crcvalid, p);
+        uint8_t *p = &fibBytes[(i % 3) * 32];
+        const bool crcvalid = checkFibCRC(p);
+        myRadioInterface.onFIBDecodeSuccessPacked(crcvalid, p);
         if (crcvalid) {
             fibProcessor.processFIB(p, ficno);
 
@@ -229,6 +208,13 @@ void FicHandler::processFicInput(const softbit_t *ficblock, int16_t ficno)
     }
 }
 
+bool FicHandler::checkFibCRC(const uint8_t *fib)
+{
+    // The FIB contains 30 bytes of data and the inverted CRC16-CCITT
+    const uint16_t crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(fib, 30);
+    return crc == ((fib[30] << 8) | fib[31]);
+}
+
 void FicHandler::clearEnsemble()
 {
     fibProcessor.clearEnsemble();
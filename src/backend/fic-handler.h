@@ -44,6 +44,9 @@ class FicHandler: public Viterbi
         void    clearEnsemble();
         int     getFicDecodeRatioPercent();
 
+        // Check the CRC of a FIB of 32 bytes with the table-driven CRC16
+        static bool checkFibCRC(const uint8_t *fib);
+
         FIBProcessor fibProcessor;
 
     private:
@@ -52,8 +55,11 @@ class FicHandler: public Viterbi
         const int8_t *PI_15;
         const int8_t *PI_16;
         std::vector<uint8_t> bitBuffer_out;
+        // The three FIBs, followed by padding so that neither the bit
+        // reader nor a FIG with a wrong length reads beyond the end
+        std::vector<uint8_t> fibBytes;
         std::vector<softbit_t> ofdm_input;
-        std::vector<softbit_t> viterbiBlock;
+        PuncturingScheme puncturing;
         int16_t     index = 0;
         int16_t     bitsperBlock = 2 * 1536;
         int16_t     ficno = 0;
@@ -37,10 +37,12 @@
 //  Note CIF counts from 0 .. 3
 MscHandler::MscHandler(
         const DABParams& p,
-        bool show_crcErrors) :
+        bool show_crcErrors,
+        bool batchedDeconvolution) :
     bitsperBlock(2 * p.K),
     show_crcErrors(show_crcErrors),
-    cifVector(864 * CUSize)
+    cifVector(864 * CUSize),
+    batchedDeconvolution(batchedDeconvolution)
 {
     if (p.dabMode == 4) {  // 2 CIFS per 76 blocks
         numberofblocksperCIF = 36;
@@ -81,7 +83,9 @@ bool MscHandler::addSubchannel(
                 sub.bitrate(),
                 sub.protectionSettings,
                 handler,
-                dumpFileName);
+                dumpFileName,
+                batchedDeconvolution);
+    s.decodedBits.resize(s.dabHandler->decodedBits());
 
      /* TODO dealing with data
       s.dabHandler = std::make_shared<DabData>(radioInterface,
@@ -145,6 +149,11 @@ void MscHandler::processMscBlock(const softbit_t *fbits, int16_t blkno)
     blkCount = 0;
     cifCount = (cifCount + 1) & 03;
 
+    if (batchedDeconvolution) {
+        deconvolveBatched();
+        return;
+    }
+
     for (auto& stream : streams) {
         softbit_t *myBegin = &cifVector[stream.subCh.startAddr * CUSize];
 
@@ -157,6 +166,61 @@ void MscHandler::processMscBlock(const softbit_t *fbits, int16_t blkno)
     }
 }
 
+// Deinterleave the current CIF of all streams, decode all logical
+// frames with one call to the batched Viterbi and hand the results back.
+// The Viterbi depunctures while it loads the frames.
+void MscHandler::deconvolveBatched()
+{
+    batchJobs.clear();
+    batchStreams.clear();
+
+    for (auto& stream : streams) {
+        if (not stream.dabHandler) {
+            throw std::logic_error("No dabHandler!");
+        }
+
+        const softbit_t *frame = stream.dabHandler->timeDeinterleave(
+                &cifVector[stream.subCh.startAddr * CUSize],
+                stream.subCh.length * CUSize);
+
+        if (frame) {
+            batchJobs.emplace_back(frame,
+                    stream.decodedBits.size(), stream.decodedBits.data(),
+                    &stream.dabHandler->puncturing());
+            batchStreams.push_back(&stream);
+        }
+    }
+
+    if (batchJobs.empty()) {
+        return;
+    }
+
+    viterbiBatch.deconvolve(batchJobs);
+
+    for (auto stream : batchStreams) {
+        stream->dabHandler->processDecoded(stream->decodedBits.data());
+    }
+}
+
+bool MscHandler::waitUntilIdle(std::chrono::steady_clock::time_point deadline)
+{
+    // Do not block processMscBlock() while waiting
+    std::vector<std::shared_ptr<DabVirtual> > handlers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& stream : streams) {
+            handlers.push_back(stream.dabHandler);
+        }
+    }
+
+    for (auto& handler : handlers) {
+        if (not handler->waitUntilIdle(deadline)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void MscHandler::stopProcessing()
 {
     std::lock_guard<std::mutex> lock(mutex);
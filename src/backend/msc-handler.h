@@ -30,6 +30,7 @@
 #ifndef MSC_HANDLER
 #define MSC_HANDLER
 
+#include <chrono>
 #include <mutex>
 #include <list>
 #include <memory>
@@ -40,13 +41,15 @@
 #include "dab-constants.h"
 #include "ringbuffer.h"
 #include "radio-controller.h"
+#include "viterbi.h"
 
 class DabVirtual;
 
 class MscHandler
 {
     public:
-        MscHandler(const DABParams& p, bool show_crcErrors);
+        MscHandler(const DABParams& p, bool show_crcErrors,
+                bool batchedDeconvolution = false);
 
         // Stop processing and remove all subchannels
         void stopProcessing(void);
@@ -59,9 +62,14 @@ class MscHandler
 
         bool removeSubchannel(const Subchannel& sub);
 
+        /* Wait until the subchannels have decoded all the data they
+         * were given, or until the deadline. Returns true if they have. */
+        bool waitUntilIdle(std::chrono::steady_clock::time_point deadline);
+
     private:
         friend class OfdmDecoder;
         void processMscBlock(const softbit_t *fbits, int16_t blkno);
+        void deconvolveBatched(void);
 
         struct SelectedStream {
             SelectedStream(
@@ -81,6 +89,9 @@ class MscHandler
             const Subchannel subCh;
 
             std::shared_ptr<DabVirtual> dabHandler;
+
+            // Output of the batched Viterbi decoder
+            std::vector<uint8_t> decodedBits;
         };
 
         std::mutex mutex;
@@ -94,6 +105,11 @@ class MscHandler
         int16_t cifCount = 0; // msc blocks in CIF
         int16_t blkCount = 0;
         bool work_to_be_done = false;
+
+        bool batchedDeconvolution;
+        ViterbiBatch viterbiBatch;
+        std::vector<ViterbiBatch::Job> batchJobs;
+        std::vector<SelectedStream*> batchStreams;
 };
 
 #endif
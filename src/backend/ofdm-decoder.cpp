@@ -31,6 +31,17 @@
 #include "ofdm-decoder.h"
 #include "various/profiling.h"
 #include <iostream>
+#include <stdexcept>
+
+// The RingBuffer needs a power of two as size
+static uint32_t queueSize(size_t numFrames)
+{
+    uint32_t size = 1;
+    while (size < numFrames) {
+        size *= 2;
+    }
+    return size;
+}
 
 /**
  * \brief OfdmDecoder
@@ -43,20 +54,55 @@ OfdmDecoder::OfdmDecoder(
         const DABParams& p,
         RadioControllerInterface& mr,
         FicHandler& ficHandler,
-        MscHandler& mscHandler) :
+        MscHandler& mscHandler,
+        int frameQueueDepth,
+        int numFFTThreads,
+        bool waitWhenQueueFull) :
     params(p),
     radioInterface(mr),
     ficHandler(ficHandler),
     mscHandler(mscHandler),
-    pending_symbols(params.L),
+    waitWhenQueueFull(waitWhenQueueFull),
+    // One more frame for the producer, and one being decoded
+    frames(frameQueueDepth + 2),
+    freeFrames(queueSize(frames.size())),
+    pendingFrames(queueSize(frames.size())),
+    // A frame lasts 96ms in transmission mode I
+    frameDecodeTime({0.005, 0.01, 0.02, 0.05, 0.1, 0.2, 0.5}),
     phaseReference(params.T_u),
     fft_handler(p.T_u),
     interleaver(p),
     ibits(2 * params.K)
 {
+    if (frameQueueDepth < 1) {
+        throw std::logic_error("Invalid OFDM frame queue depth");
+    }
+
     T_g = params.T_s - params.T_u;
     fft_buffer = fft_handler.getVector();
 
+    for (auto& frame : frames) {
+        frame.resize(params.L * params.T_s);
+    }
+
+    for (int32_t i = 1; i < (int32_t)frames.size(); i++) {
+        freeFrames.putDataIntoBuffer(&i, 1);
+    }
+    producerFrame = 0;
+
+    if (numFFTThreads > 1) {
+        spectra.resize(params.L * params.T_u);
+
+        // The workerthread itself does its share of the FFTs
+        for (int i = 1; i < numFFTThreads; i++) {
+            fftWorkers.emplace_back(new FFTWorker(params.T_u));
+        }
+
+        for (auto& w : fftWorkers) {
+            w->thread = std::thread(&OfdmDecoder::fftWorkerthread, this, std::ref(*w));
+        }
+    }
+
     /**
      * When implemented in a thread, the thread controls the
      * reading in of the data and processing the data through
@@ -68,92 +114,237 @@ OfdmDecoder::OfdmDecoder(
 OfdmDecoder::~OfdmDecoder()
 {
     running = false;
-    pending_symbols_cv.notify_all();
+    pending_frames_cv.notify_all();
     if (thread.joinable()) {
         thread.join();
     }
+
+    {
+        std::lock_guard<std::mutex> lock(fft_mutex);
+        fft_quit = true;
+    }
+    fft_start_cv.notify_all();
+    for (auto& w : fftWorkers) {
+        w->thread.join();
+    }
 }
 
 void OfdmDecoder::reset()
 {
     running = false;
-    pending_symbols_cv.notify_all();
+    pending_frames_cv.notify_all();
     if (thread.joinable()) {
         thread.join();
     }
 
+    // Discard the frames that were not decoded yet
+    int32_t frame = 0;
+    while (pendingFrames.getDataFromBuffer(&frame, 1) == 1) {
+        freeFrames.putDataIntoBuffer(&frame, 1);
+    }
+    free_frames_cv.notify_all();
+
     thread = std::thread(&OfdmDecoder::workerthread, this);
 }
 
 /**
  * The code in the thread executes a simple loop,
- * waiting for the next symbols and executing the interpretation
- * operation for that symbols.
+ * waiting for the next frame and executing the interpretation
+ * operation for all its symbols.
  */
 void OfdmDecoder::workerthread()
 {
-    int currentSym = 0;
-
     running = true;
 
     while (running) {
-        std::unique_lock<std::mutex> lock(mutex);
-        pending_symbols_cv.wait_for(lock, std::chrono::milliseconds(100));
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            pending_frames_cv.wait_for(lock, std::chrono::milliseconds(100),
+                    [&]() { return not running or
+                        pendingFrames.GetRingBufferReadAvailable() > 0; });
+        }
 
-        if (currentSym == 0) {
-            constellationPoints.clear();
-            constellationPoints.reserve(
-                    (params.L-1) * params.K / constellationDecimation);
+        int32_t frame = 0;
+        if (pendingFrames.getDataFromBuffer(&frame, 1) != 1) {
+            continue;
         }
 
-        while (num_pending_symbols > 0 && running) {
+        const DSPCOMPLEX *symbols = frames[frame].data();
+        PROFILE_LATENCY_START(frameStart);
+        const auto decodeStart = std::chrono::steady_clock::now();
+
+        constellationPoints.clear();
+        constellationPoints.reserve(
+                (params.L-1) * params.K / constellationDecimation);
 
-            if (currentSym == 0)
-                processPRS();
-            else
-                decodeDataSymbol(currentSym);
+        int sym = 1;
+        if (fftWorkers.empty()) {
+            fftSymbol(fft_handler, symbols, 0);
+            processPRS(fft_buffer);
 
-            currentSym = (currentSym + 1) % (params.L);
-            num_pending_symbols -= 1;
+            for (; sym < params.L && running; sym++) {
+                fftSymbol(fft_handler, symbols, sym);
+                decodeDataSymbol(fft_buffer, sym);
+            }
+        }
+        else {
+            fftAllSymbols(symbols);
+            processPRS(spectra.data());
 
-            if (currentSym == 0) {
-                radioInterface.onConstellationPoints(
-                        std::move(constellationPoints));
-                constellationPoints.clear();
-                constellationPoints.reserve(
-                        (params.L-1) * params.K / constellationDecimation);
+            for (; sym < params.L && running; sym++) {
+                decodeDataSymbol(&spectra[sym * params.T_u], sym);
             }
         }
+
+        PROFILE_LATENCY_END(frameStart);
+        frameDecodeTime.observe(std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - decodeStart).count());
+        cpuTimeNs = thread_cputime_ns();
+
+        // pushFrame() and waitUntilIdle() wait for free frames
+        freeFrames.putDataIntoBuffer(&frame, 1);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+        free_frames_cv.notify_all();
+
+        if (sym == params.L) {
+            radioInterface.onConstellationPoints(
+                    std::move(constellationPoints));
+        }
     }
 
     std::clog << "OFDM-decoder:" <<  "closing down now" << std::endl;
 }
 
-void OfdmDecoder::pushAllSymbols(std::vector<std::vector<DSPCOMPLEX> >&& syms)
+size_t OfdmDecoder::getNumPendingFrames()
+{
+    return pendingFrames.GetRingBufferReadAvailable();
+}
+
+bool OfdmDecoder::waitUntilIdle(std::chrono::steady_clock::time_point deadline)
 {
+    // All frames but the one of the producer are free once decoded
     std::unique_lock<std::mutex> lock(mutex);
+    return free_frames_cv.wait_until(lock, deadline, [&]() {
+            return freeFrames.GetRingBufferReadAvailable() ==
+                (int32_t)frames.size() - 1; });
+}
 
-    pending_symbols = std::move(syms);
-    num_pending_symbols = pending_symbols.size();
-    pending_symbols_cv.notify_one();
+AtomicHistogram::snapshot_t OfdmDecoder::getFrameDecodeTime() const
+{
+    return frameDecodeTime.snapshot();
+}
+
+DSPCOMPLEX *OfdmDecoder::currentFrame()
+{
+    return frames[producerFrame].data();
+}
+
+void OfdmDecoder::pushFrame()
+{
+    int32_t nextFrame = 0;
+    while (freeFrames.getDataFromBuffer(&nextFrame, 1) != 1) {
+        if (not waitWhenQueueFull or not running) {
+            // The decoder is behind, keep the buffer for the next frame
+            droppedFrames++;
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        free_frames_cv.wait_for(lock, std::chrono::milliseconds(100),
+                [&]() { return not running or
+                    freeFrames.GetRingBufferReadAvailable() > 0; });
+    }
+
+    pendingFrames.putDataIntoBuffer(&producerFrame, 1);
+    producerFrame = nextFrame;
+
+    // Taking the lock avoids a lost wakeup. The worker only holds
+    // it while checking the queue, never while decoding.
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    pending_frames_cv.notify_one();
+}
+
+void OfdmDecoder::fftSymbol(fft::Forward& fft, const DSPCOMPLEX *frame, int32_t n)
+{
+    // The PRS is stored without its cyclic prefix
+    const DSPCOMPLEX *symbol = (n == 0) ? frame : frame + n * params.T_s + T_g;
+    memcpy(fft.getVector(), symbol, params.T_u * sizeof(DSPCOMPLEX));
+    fft.do_FFT();
+}
+
+/**
+ * Calculate the FFTs of all symbols of the frame into spectra,
+ * together with the fftWorkers.
+ */
+void OfdmDecoder::fftAllSymbols(const DSPCOMPLEX *frame)
+{
+    PROFILE(ParallelFFT);
+    {
+        std::lock_guard<std::mutex> lock(fft_mutex);
+        fft_frame = frame;
+        fft_symbols_done = 0;
+        fft_next_symbol = 0;
+        fft_generation++;
+    }
+    fft_start_cv.notify_all();
+
+    fftSymbolsOfFrame(fft_handler);
+
+    std::unique_lock<std::mutex> lock(fft_mutex);
+    fft_done_cv.wait(lock, [&]() { return fft_symbols_done == params.L; });
+    PROFILE(ParallelFFTDone);
+}
+
+void OfdmDecoder::fftSymbolsOfFrame(fft::Forward& fft)
+{
+    int32_t sym;
+    while ((sym = fft_next_symbol++) < params.L) {
+        fftSymbol(fft, fft_frame, sym);
+        memcpy(&spectra[sym * params.T_u], fft.getVector(),
+                params.T_u * sizeof(DSPCOMPLEX));
+
+        if (++fft_symbols_done == params.L) {
+            std::lock_guard<std::mutex> lock(fft_mutex);
+            fft_done_cv.notify_one();
+        }
+    }
+}
+
+void OfdmDecoder::fftWorkerthread(FFTWorker& worker)
+{
+    uint32_t generation = 0;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(fft_mutex);
+            fft_start_cv.wait(lock, [&]() {
+                    return fft_quit or fft_generation != generation; });
+            if (fft_quit) {
+                return;
+            }
+            generation = fft_generation;
+        }
+
+        fftSymbolsOfFrame(worker.fft);
+    }
 }
 
 /**
- * handle symbol 0 as collected from the buffer
+ * handle symbol 0, the spectrum of the PRS
  */
-void OfdmDecoder::processPRS()
+void OfdmDecoder::processPRS(const DSPCOMPLEX *spectrum)
 {
     PROFILE(ProcessPRS);
-    memcpy (fft_buffer,
-            pending_symbols[0].data(),
-            params.T_u * sizeof(DSPCOMPLEX));
-    fft_handler.do_FFT ();
     /**
      * The SNR is determined by looking at a segment of bins
      * within the signal region and bits outside.
      * It is just an indication
      */
-    snr = 0.7 * snr + 0.3 * get_snr(fft_buffer);
+    snr = 0.7 * snr + 0.3 * get_snr(spectrum);
     if (++snrCount > 10) {
         radioInterface.onSNR(snr);
         snrCount = 0;
@@ -162,27 +353,19 @@ void OfdmDecoder::processPRS()
      * we are now in the frequency domain, and we keep the carriers
      * as coming from the FFT as phase reference.
      */
-    memcpy(phaseReference.data(), fft_buffer, params.T_u * sizeof (DSPCOMPLEX));
+    memcpy(phaseReference.data(), spectrum, params.T_u * sizeof (DSPCOMPLEX));
 }
 
 /**
- * For the other symbols, the first step is to go from
- * time to frequency domain, to get the carriers.
+ * For the other symbols, we get the carriers in the frequency
+ * domain from the FFT.
  *
  * \brief decodeDataSymbol
- * do the transforms and hand over the result to the fichandler or mschandler
+ * do the demapping and hand over the result to the fichandler or mschandler
  */
-void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
+void OfdmDecoder::decodeDataSymbol(const DSPCOMPLEX *spectrum, int32_t sym_ix)
 {
     PROFILE(ProcessSymbol);
-    memcpy (fft_buffer,
-            pending_symbols[sym_ix].data() + T_g,
-            params.T_u * sizeof (DSPCOMPLEX));
-    //fftlabel:
-    /**
-     * first step: do the FFT
-     */
-    fft_handler.do_FFT();
 
     /**
      * a little optimization: we do not interchange the
@@ -205,8 +388,8 @@ void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
          * The carrier of a symbols is the reference for the carrier
          * on the same position in the next symbols
          */
-        const DSPCOMPLEX r1 = fft_buffer[index] * conj (phaseReference[index]);
-        phaseReference[index] = fft_buffer[index];
+        const DSPCOMPLEX r1 = spectrum[index] * conj (phaseReference[index]);
+        phaseReference[index] = spectrum[index];
         const DSPFLOAT ab1 = 127.0f / l1_norm(r1);
         /// split the real and the imaginary part and scale it
 
@@ -235,7 +418,7 @@ void OfdmDecoder::decodeDataSymbol(int32_t sym_ix)
  * Just get the strength from the selected carriers compared
  * to the strength of the carriers outside that region
  */
-int16_t OfdmDecoder::get_snr(DSPCOMPLEX *v)
+int16_t OfdmDecoder::get_snr(const DSPCOMPLEX *v)
 {
     int16_t i;
     DSPFLOAT    noise   = 0;
@@ -31,12 +31,15 @@
 #include <mutex>
 #include <atomic>
 #include <cstdint>
+#include <memory>
 #include "fft.h"
 #include "dab-constants.h"
 #include "freq-interleaver.h"
 #include "radio-controller.h"
 #include "fic-handler.h"
 #include "msc-handler.h"
+#include "ringbuffer.h"
+#include "various/metrics.h"
 
 class OfdmDecoder
 {
@@ -45,12 +48,44 @@ class OfdmDecoder
                 const DABParams& p,
                 RadioControllerInterface& mr,
                 FicHandler& ficHandler,
-                MscHandler& mscHandler);
+                MscHandler& mscHandler,
+                int frameQueueDepth,
+                int numFFTThreads,
+                bool waitWhenQueueFull);
         ~OfdmDecoder();
-        void    pushAllSymbols(std::vector<std::vector<DSPCOMPLEX> >&& sym);
+
+        /* The OFDMProcessor fills the frame returned by currentFrame()
+         * and hands it over with pushFrame(). The frame contains the PRS
+         * (T_u samples) at offset 0 and data symbol n (T_s samples)
+         * at offset n * T_s.
+         *
+         * The frames come from a fixed pool and are passed through
+         * lock-free queues, neither call allocates or waits for the decoder.
+         * If all frames are still queued, pushFrame() drops the frame
+         * and the buffer gets filled again, unless waitWhenQueueFull is
+         * set. In that case, pushFrame() waits until the decoder has
+         * finished a frame, which is useful for input that is not realtime. */
+        DSPCOMPLEX *currentFrame(void);
+        void    pushFrame(void);
+
+        size_t  getNumDroppedFrames(void) const { return droppedFrames; }
+
+        // Number of frames waiting to be decoded
+        size_t  getNumPendingFrames(void);
+
+        /* Wait until all pushed frames have been decoded, or until
+         * the deadline. Returns true if they have. */
+        bool    waitUntilIdle(std::chrono::steady_clock::time_point deadline);
+
+        // CPU time the decoder thread used, without the FFT threads
+        uint64_t getCpuTimeNs(void) const { return cpuTimeNs; }
+
+        // Wall-clock time taken to decode one frame, in seconds
+        AtomicHistogram::snapshot_t getFrameDecodeTime(void) const;
+
         void    reset();
     private:
-        int16_t get_snr(DSPCOMPLEX *);
+        int16_t get_snr(const DSPCOMPLEX *);
 
         const DABParams& params;
         RadioControllerInterface& radioInterface;
@@ -58,15 +93,54 @@ class OfdmDecoder
         MscHandler& mscHandler;
         std::atomic<bool> running = ATOMIC_VAR_INIT(false);
 
-        std::condition_variable pending_symbols_cv;
+        std::condition_variable pending_frames_cv;
+        std::condition_variable free_frames_cv;
         std::mutex mutex;
-        int num_pending_symbols = 0;
-        std::vector<std::vector<DSPCOMPLEX> > pending_symbols;
+        bool waitWhenQueueFull;
+
+        // Pool of frames, and the indices of the frames
+        // that are free and pending for decoding
+        std::vector<std::vector<DSPCOMPLEX> > frames;
+        RingBuffer<int32_t> freeFrames;
+        RingBuffer<int32_t> pendingFrames;
+        int32_t producerFrame = 0;
+        std::atomic<size_t> droppedFrames = ATOMIC_VAR_INIT(0);
+        std::atomic<uint64_t> cpuTimeNs = ATOMIC_VAR_INIT(0);
+        AtomicHistogram frameDecodeTime;
 
         std::thread thread;
         void workerthread(void);
-        void processPRS();
-        void decodeDataSymbol(int32_t n);
+        void processPRS(const DSPCOMPLEX *spectrum);
+        void decodeDataSymbol(const DSPCOMPLEX *spectrum, int32_t n);
+
+        // Copy the useful part of symbol n of the frame to the FFT and
+        // transform it, the result is in the vector of the FFT
+        void fftSymbol(fft::Forward& fft, const DSPCOMPLEX *frame, int32_t n);
+
+        /* When more than one FFT thread is requested, the FFTs of all
+         * symbols of a frame are calculated in parallel into spectra by
+         * the workerthread and the fftWorkers. Only the differential
+         * demodulation is then done sequentially. */
+        struct FFTWorker {
+            FFTWorker(int32_t fft_size) : fft(fft_size) {}
+            fft::Forward fft;
+            std::thread thread;
+        };
+        std::vector<std::unique_ptr<FFTWorker> > fftWorkers;
+        std::vector<DSPCOMPLEX> spectra;
+
+        std::mutex fft_mutex;
+        std::condition_variable fft_start_cv;
+        std::condition_variable fft_done_cv;
+        bool fft_quit = false;
+        uint32_t fft_generation = 0;
+        const DSPCOMPLEX *fft_frame = nullptr;
+        std::atomic<int32_t> fft_next_symbol = ATOMIC_VAR_INIT(0);
+        std::atomic<int32_t> fft_symbols_done = ATOMIC_VAR_INIT(0);
+
+        void fftAllSymbols(const DSPCOMPLEX *frame);
+        void fftSymbolsOfFrame(fft::Forward& fft);
+        void fftWorkerthread(FFTWorker& worker);
 
         int32_t T_g;
         std::vector<DSPCOMPLEX> phaseReference;
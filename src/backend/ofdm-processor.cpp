@@ -30,13 +30,25 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
 #include "ofdm-processor.h"
 #include "various/profiling.h"
 #include <iostream>
 //
 #define SEARCH_RANGE        (2 * 36)
 #define CORRELATION_LENGTH  24
+//  Samples are mixed and tracked in blocks of that size
+#define SAMPLE_BLOCK        256
+//  Small reads are served from bulk reads of up to that many samples
+#define INPUT_BLOCK         8192
+//  How long to wait for samples before checking the input and running
+#define INPUT_TIMEOUT       std::chrono::milliseconds(100)
+//  Time constant of the long term average signal level
+#define LEVEL_ALPHA         0.00001
 
 /**
   * \brief OFDMProcessor
@@ -72,7 +84,8 @@ OFDMProcessor::OFDMProcessor(
     disableCoarseCorrector(rro.disable_coarse_corrector),
     freqsyncMethod(rro.freqsyncMethod),
     phaseRef(params, rro.fftPlacementMethod),
-    ofdmDecoder(params, ri, fic, msc),
+    ofdmDecoder(params, ri, fic, msc, rro.ofdmFrameQueueDepth, rro.ofdmFFTThreads,
+            rro.waitForOfdmDecoder),
     fft_handler(params.T_u),
     fft_buffer(fft_handler.getVector())
 {
@@ -103,6 +116,19 @@ OFDMProcessor::OFDMProcessor(
     }
 
     correlationVector.resize(SEARCH_RANGE + CORRELATION_LENGTH);
+
+    prs.resize(T_u);
+
+    lookahead.resize(INPUT_BLOCK);
+    scanBuffer.resize(SAMPLE_BLOCK);
+
+    //  The impulse response of the sLevel filter, see trackLevel()
+    levelWeights.resize(SAMPLE_BLOCK);
+    levelDecay.resize(SAMPLE_BLOCK + 1);
+    for (int i = 0; i <= SAMPLE_BLOCK; i ++)
+        levelDecay[i] = pow(1 - LEVEL_ALPHA, i);
+    for (int i = 0; i < SAMPLE_BLOCK; i ++)
+        levelWeights[i] = LEVEL_ALPHA * levelDecay[SAMPLE_BLOCK - 1 - i];
 }
 
 OFDMProcessor::~OFDMProcessor()
@@ -122,7 +148,13 @@ void OFDMProcessor::start()
     syncBufferIndex    = 0;
     sLevel             = 0;
     localPhase         = 0;
+    lookaheadIndex     = 0;
+    lookaheadCount     = 0;
     input.restart();
+    {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        finished = false;
+    }
     running            = true;
     threadHandle       = std::thread(&OFDMProcessor::run, this);
 }
@@ -131,86 +163,179 @@ class InputFailure { };
 class NotRunningAnymore { };
 
 /**
- * \brief getSample
- * Profiling shows that getting a sample, together
- * with the frequency shift, is a real performance killer.
- * we therefore distinguish between getting a single sample
- * and getting a vector full of samples
+ * \brief waitForInput
+ * Wait until the input has at least n samples ready. The input wakes
+ * us up when samples arrive, the timeout only serves to notice that
+ * the input failed or that we have to stop.
  */
-
-DSPCOMPLEX OFDMProcessor::getSample(int32_t phase)
+void OFDMProcessor::waitForInput(int32_t n)
 {
-    DSPCOMPLEX temp;
     if (!running)
         throw NotRunningAnymore();
     /// bufferContent is an indicator for the value of ...->Samples ()
-    if (bufferContent == 0) {
-        bufferContent = input.getSamplesToRead ();
-        while ((bufferContent == 0) && running) {
+    if (n > bufferContent) {
+        bufferContent = input.waitForSamples(n, INPUT_TIMEOUT);
+        while ((bufferContent < n) && running) {
             if (not input.is_ok()) {
                 throw InputFailure();
             }
-            std::this_thread::sleep_for(std::chrono::microseconds(10));
-            bufferContent = input.getSamplesToRead ();
+            bufferContent = input.waitForSamples(n, INPUT_TIMEOUT);
         }
     }
-
     if (!running)
         throw NotRunningAnymore();
-    //
-    //  so here, bufferContent > 0
-    input.getSamples (&temp, 1);
-    bufferContent --;
+}
 
-    //
-    //  OK, we have a sample!!
-    //  first: adjust frequency. We need Hz accuracy
-    localPhase  -= phase;
-    localPhase  = (localPhase + INPUT_RATE) % INPUT_RATE;
-    temp        *= oscillatorTable[localPhase];
-    sLevel      = 0.00001 * l1_norm(temp) + (1 - 0.00001) * sLevel;
-#define N   5
-    sampleCnt   ++;
-    if (++ sampleCnt > INPUT_RATE / N) {
-        radioInterface.onFrequencyCorrectorChange(
-                fineCorrector, coarseCorrector);
-        sampleCnt = 0;
+/**
+ * \brief consumedInput
+ * Account for numRead samples read from the input out of the requested.
+ * When the input delivers less than it announced, e.g. at the end of
+ * a file, the next read has to wait for it again.
+ */
+void OFDMProcessor::consumedInput(int32_t requested, int32_t numRead)
+{
+    if (numRead < requested)
+        bufferContent = 0;
+    else
+        bufferContent -= numRead;
+}
+
+/**
+ * \brief readInput
+ * Read n samples, first from the lookahead buffer and then from the
+ * input. Reads larger than SAMPLE_BLOCK go to v directly, smaller ones
+ * are served from the lookahead buffer, so that the input is read in bulk.
+ * Returns the number of samples read.
+ */
+int32_t OFDMProcessor::readInput(DSPCOMPLEX *v, int32_t n)
+{
+    int32_t buffered = std::min(n, lookaheadCount - lookaheadIndex);
+    memcpy(v, &lookahead[lookaheadIndex], buffered * sizeof(DSPCOMPLEX));
+    lookaheadIndex += buffered;
+
+    if (n == buffered)
+        return n;
+
+    if (n - buffered <= SAMPLE_BLOCK) {
+        const int32_t numPeeked = peekInput(n - buffered);
+        memcpy(v + buffered, &lookahead[lookaheadIndex],
+                numPeeked * sizeof(DSPCOMPLEX));
+        lookaheadIndex += numPeeked;
+        return buffered + numPeeked;
     }
-    return temp;
+
+    waitForInput(n - buffered);
+    const int32_t numRead = input.getSamples(v + buffered, n - buffered);
+    consumedInput(n - buffered, numRead);
+    return buffered + numRead;
 }
 
-void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
+/**
+ * \brief peekInput
+ * Make up to n (at most INPUT_BLOCK) samples available in the lookahead
+ * buffer, without consuming them. The buffer gets filled with all the
+ * samples the input has ready. Returns the number of samples available.
+ */
+int32_t OFDMProcessor::peekInput(int32_t n)
 {
-    int32_t     i;
+    int32_t available = lookaheadCount - lookaheadIndex;
+    if (available < n) {
+        memmove(lookahead.data(), &lookahead[lookaheadIndex],
+                available * sizeof(DSPCOMPLEX));
+        waitForInput(n - available);
+        const int32_t wanted = std::min(INPUT_BLOCK - available,
+                std::max(n - available, bufferContent));
+        const int32_t numRead = input.getSamples(&lookahead[available], wanted);
+        consumedInput(wanted, numRead);
+        available += numRead;
+        lookaheadIndex = 0;
+        lookaheadCount = available;
+    }
+    return std::min(n, available);
+}
 
-    if (!running)
-        throw NotRunningAnymore();
-    if (n > bufferContent) {
-        bufferContent = input.getSamplesToRead ();
-        while ((bufferContent < n) && running) {
-            if (not input.is_ok()) {
-                throw InputFailure();
-            }
-            std::this_thread::sleep_for(std::chrono::microseconds(10));
-            bufferContent = input.getSamplesToRead();
+/**
+ * \brief mix
+ * Profiling shows that the frequency shift is a real performance killer.
+ * The phase of the oscillator is advanced for a block of samples first,
+ * so that the mixing itself is a loop the compiler can vectorise.
+ * in and out may be the same.
+ */
+void OFDMProcessor::mix(const DSPCOMPLEX *in, DSPCOMPLEX *out,
+        int32_t n, int32_t phase, int32_t& oscillatorPhase) const
+{
+    int32_t phases[SAMPLE_BLOCK];
+    const float *osc = reinterpret_cast<const float*>(oscillatorTable.data());
+
+    //  Within one turn, a single correction per sample keeps the phase
+    //  within the table
+    phase %= INPUT_RATE;
+
+    for (int32_t block = 0; block < n; block += SAMPLE_BLOCK) {
+        const int32_t m = std::min(n - block, SAMPLE_BLOCK);
+
+        for (int32_t i = 0; i < m; i ++) {
+            oscillatorPhase -= phase;
+            if (oscillatorPhase < 0)
+                oscillatorPhase += INPUT_RATE;
+            else if (oscillatorPhase >= INPUT_RATE)
+                oscillatorPhase -= INPUT_RATE;
+            phases[i] = 2 * oscillatorPhase;
+        }
+
+        const float *x = reinterpret_cast<const float*>(in + block);
+        float *y = reinterpret_cast<float*>(out + block);
+        for (int32_t i = 0; i < m; i ++) {
+            const float re = x[2 * i];
+            const float im = x[2 * i + 1];
+            const float oscRe = osc[phases[i]];
+            const float oscIm = osc[phases[i] + 1];
+            y[2 * i]     = re * oscRe - im * oscIm;
+            y[2 * i + 1] = re * oscIm + im * oscRe;
         }
     }
-    if (!running)
-        throw NotRunningAnymore();
-    //
-    //  so here, bufferContent >= n
-    n = input.getSamples (v, n);
-    bufferContent -= n;
+}
 
-    //  OK, we have samples!!
-    //  first: adjust frequency. We need Hz accuracy
-    for (i = 0; i < n; i ++) {
-        localPhase  -= phase;
-        localPhase   = (localPhase + INPUT_RATE) % INPUT_RATE;
-        v[i]    *= oscillatorTable[localPhase];
-        sLevel   = 0.00001 * l1_norm(v[i]) + (1 - 0.00001) * sLevel;
+/**
+ * \brief trackLevel
+ * Update the long term average sLevel with n samples. Instead of running
+ * the first-order IIR filter sample by sample, each block of samples
+ * is weighted with the impulse response of the filter, which is
+ * a dot product.
+ */
+void OFDMProcessor::trackLevel(const DSPCOMPLEX *v, int32_t n)
+{
+    const float *x = reinterpret_cast<const float*>(v);
+
+    for (int32_t block = 0; block < n; block += SAMPLE_BLOCK) {
+        const int32_t m = std::min(n - block, SAMPLE_BLOCK);
+        const float *w = &levelWeights[SAMPLE_BLOCK - m];
+        const float *xb = x + 2 * block;
+
+        //  Independent partial sums to allow vectorisation
+        float acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        int32_t i = 0;
+        for (; i + 8 <= m; i += 8) {
+            for (int j = 0; j < 8; j ++) {
+                acc[j] += w[i + j] *
+                    (std::abs(xb[2 * (i + j)]) + std::abs(xb[2 * (i + j) + 1]));
+            }
+        }
+        for (; i < m; i ++) {
+            acc[0] += w[i] * (std::abs(xb[2 * i]) + std::abs(xb[2 * i + 1]));
+        }
+
+        float sum = 0;
+        for (int j = 0; j < 8; j ++)
+            sum += acc[j];
+
+        sLevel = levelDecay[m] * sLevel + sum;
     }
+}
 
+#define N   5
+void OFDMProcessor::countSamples(int32_t n)
+{
     sampleCnt += n;
     if (sampleCnt > INPUT_RATE / N) {
         radioInterface.onFrequencyCorrectorChange(
@@ -219,6 +344,72 @@ void OFDMProcessor::getSamples(DSPCOMPLEX *v, int16_t n, int32_t phase)
     }
 }
 
+void OFDMProcessor::getSamples(DSPCOMPLEX *v, int32_t n, int32_t phase)
+{
+    //  so here, bufferContent >= n
+    n = readInput(v, n);
+
+    //  OK, we have samples!!
+    //  first: adjust frequency. We need Hz accuracy
+    mix(v, v, n, phase, localPhase);
+    trackLevel(v, n);
+    countSamples(n);
+}
+
+/**
+ * \brief scanEnvelope
+ * Feed the envelope of the samples into the moving sum over the last 50
+ * samples in envBuffer, as long as that sum is above (dip) or below
+ * (!dip) threshold * sLevel. The samples are read and mixed in blocks,
+ * only the ones that were looked at are consumed.
+ * Returns false if the level did not change within maxCount samples.
+ */
+bool OFDMProcessor::scanEnvelope(float *envBuffer, int32_t envBufferMask,
+        float& currentStrength, bool dip, double threshold,
+        int32_t maxCount, int32_t phase)
+{
+    auto searching = [&]() {
+        return dip ? (currentStrength / 50 > threshold * sLevel) :
+                     (currentStrength / 50 < threshold * sLevel);
+    };
+
+    int32_t counter = 0;
+    while (searching()) {
+        const int32_t n = peekInput(std::min(SAMPLE_BLOCK, maxCount + 1 - counter));
+        //  peekInput() waits for the input before trying again, and
+        //  throws when it fails or we have to stop
+        if (n == 0)
+            continue;
+
+        int32_t oscillatorPhase = localPhase;
+        mix(&lookahead[lookaheadIndex], scanBuffer.data(), n, phase, oscillatorPhase);
+
+        int32_t k = 0;
+        do {
+            const float env = l1_norm(scanBuffer[k]);
+            sLevel = LEVEL_ALPHA * env + (1 - LEVEL_ALPHA) * sLevel;
+            envBuffer [syncBufferIndex] = env;
+            //  update the levels
+            currentStrength += envBuffer [syncBufferIndex] -
+                envBuffer [(syncBufferIndex - 50) & envBufferMask];
+            syncBufferIndex = (syncBufferIndex + 1) & envBufferMask;
+            counter ++;
+            k ++;
+        } while (k < n && counter <= maxCount && searching());
+
+        //  Consume the samples we looked at, and put the oscillator
+        //  where it would be after them
+        lookaheadIndex += k;
+        localPhase = ((localPhase - (int64_t)k * (phase % INPUT_RATE)) %
+                INPUT_RATE + INPUT_RATE) % INPUT_RATE;
+        countSamples(k);
+
+        if (counter > maxCount) { // hopeless
+            return false;
+        }
+    }
+    return true;
+}
 
 /***
  *    \brief run
@@ -232,14 +423,12 @@ void OFDMProcessor::run()
 {
     int32_t     startIndex;
     int32_t     i;
-    int32_t     counter;
     float       currentStrength;
     int32_t     syncBufferSize  = 32768;
     int32_t     syncBufferMask  = syncBufferSize - 1;
     float       envBuffer   [syncBufferSize];
 
-    std::vector<DSPCOMPLEX> ofdmBuffer(params.L * params.T_s);
-    std::vector<std::vector<DSPCOMPLEX> > allSymbols;
+    DSPCOMPLEX  *ofdmBuffer;
 
     /*running       = true;
       fineCorrector   = 0;
@@ -249,8 +438,8 @@ void OFDMProcessor::run()
         //Initing:
         /// first, we need samples to get a reasonable sLevel
         sLevel   = 0;
-        for (i = 0; i < T_F / 2; i ++) {
-            l1_norm(getSample (0));
+        for (i = 0; i < T_F / 2; i += SAMPLE_BLOCK) {
+            getSamples(scanBuffer.data(), std::min(SAMPLE_BLOCK, T_F / 2 - i), 0);
         }
 notSynced:
         PROFILE(NotSynced);
@@ -265,9 +454,9 @@ notSynced:
         //  read in T_s samples for a next attempt;
         syncBufferIndex = 0;
         currentStrength  = 0;
+        getSamples(scanBuffer.data(), 50, 0);
         for (i = 0; i < 50; i ++) {
-            DSPCOMPLEX sample         = getSample (0);
-            envBuffer [syncBufferIndex]   = l1_norm(sample);
+            envBuffer [syncBufferIndex]   = l1_norm(scanBuffer[i]);
             currentStrength           += envBuffer [syncBufferIndex];
             syncBufferIndex ++;
         }
@@ -279,42 +468,22 @@ notSynced:
         /**
          * here we start looking for the null level, i.e. a dip
          */
-        counter  = 0;
         radioInterface.onSyncChange(false);
-        while (currentStrength / 50  > 0.50 * sLevel) {
-            DSPCOMPLEX sample =
-                getSample (coarseCorrector + fineCorrector);
-            envBuffer [syncBufferIndex] = l1_norm(sample);
-            //  update the levels
-            currentStrength += envBuffer [syncBufferIndex] -
-                envBuffer [(syncBufferIndex - 50) & syncBufferMask];
-            syncBufferIndex = (syncBufferIndex + 1) & syncBufferMask;
-            counter ++;
-            if (counter > T_F) { // hopeless
-                //           fprintf (stderr, "%f %f\n", currentStrength / 50, sLevel);
-                goto notSynced;
-            }
+        if (not scanEnvelope(envBuffer, syncBufferMask, currentStrength,
+                    true, 0.50, T_F, coarseCorrector + fineCorrector)) {
+            //           fprintf (stderr, "%f %f\n", currentStrength / 50, sLevel);
+            goto notSynced;
         }
         /**
          * It seemed we found a dip that started app 65/100 * 50 samples earlier.
          * We now start looking for the end of the null period.
          */
-        counter  = 0;
         //SyncOnEndNull:
         PROFILE(SyncOnEndNull);
-        while (currentStrength / 50 < 0.75 * sLevel) {
-            DSPCOMPLEX sample = getSample (coarseCorrector + fineCorrector);
-            envBuffer [syncBufferIndex] = l1_norm(sample);
-            //  update the levels
-            currentStrength += envBuffer [syncBufferIndex] -
-                envBuffer [(syncBufferIndex - 50) & syncBufferMask];
-            syncBufferIndex = (syncBufferIndex + 1) & syncBufferMask;
-            counter   ++;
-            //
-            if (counter > T_null + 50) { // hopeless
-                std::clog << "ofdm-processor: " << "SyncOnEndNull failed" << std::endl;
-                goto notSynced;
-            }
+        if (not scanEnvelope(envBuffer, syncBufferMask, currentStrength,
+                    false, 0.75, T_null + 50, coarseCorrector + fineCorrector)) {
+            std::clog << "ofdm-processor: " << "SyncOnEndNull failed" << std::endl;
+            goto notSynced;
         }
         /**
          * The end of the null period is identified, probably about 40
@@ -332,12 +501,16 @@ SyncOnPhase:
          * now read in Tu samples. The precise number is not really important
          * as long as we can be sure that the first sample to be identified
          * is part of the samples read.
+         *
+         * The samples go directly into the frame buffer that is handed
+         * over to the ofdmDecoder.
          */
-        getSamples(ofdmBuffer.data(), T_u, coarseCorrector + fineCorrector);
+        ofdmBuffer = ofdmDecoder.currentFrame();
+        getSamples(ofdmBuffer, T_u, coarseCorrector + fineCorrector);
         //
         /// and then, call upon the phase synchronizer to verify/compute
         /// the real "first" sample
-        startIndex = phaseRef.findIndex(ofdmBuffer.data(),
+        startIndex = phaseRef.findIndex(ofdmBuffer,
                 impulseResponseBuffer);
         PROFILE(FindIndex);
         radioInterface.onNewImpulseResponse(std::move(impulseResponseBuffer));
@@ -356,7 +529,7 @@ SyncOnPhase:
         /**
          * Once here, we are synchronized, we need to copy the data we
          * used for synchronization for the PRS */
-        memmove(ofdmBuffer.data(), &ofdmBuffer[startIndex],
+        memmove(ofdmBuffer, &ofdmBuffer[startIndex],
                 (params.T_u - startIndex) * sizeof (DSPCOMPLEX));
         ofdmBufferIndex  = params.T_u - startIndex;
 
@@ -372,10 +545,8 @@ SyncOnPhase:
                 T_u - ofdmBufferIndex,
                 coarseCorrector + fineCorrector);
 
-        std::vector<complexf> prs;
         if (decodeTII) {
-            prs.resize(T_u);
-            std::copy(ofdmBuffer.begin(), ofdmBuffer.begin() + T_u, prs.begin());
+            std::copy(ofdmBuffer, ofdmBuffer + T_u, prs.begin());
         }
 
         //  Here we look only at the PRS when we need a coarse
@@ -393,7 +564,7 @@ SyncOnPhase:
             }
 
             coarseSyncCounter++;
-            int correction = processPRS(ofdmBuffer.data());
+            int correction = processPRS(ofdmBuffer);
             if (correction != 100) {
                 coarseCorrector += correction * params.carrierDiff;
                 if (abs (coarseCorrector) > kHz(35))
@@ -410,10 +581,6 @@ SyncOnPhase:
             lastValidCoarseCorrector = coarseCorrector;
         }
 
-        allSymbols.resize(params.L);
-        allSymbols[0] = move(ofdmBuffer);
-        ofdmBuffer.resize(params.L * params.T_s);
-
         /**
          * after symbol 0, we will just read in the other (params.L - 1) symbols
          */
@@ -427,15 +594,15 @@ SyncOnPhase:
          */
         DSPCOMPLEX FreqCorr = DSPCOMPLEX(0, 0);
         for (int sym = 1; sym < params.L; sym ++) {
-            auto& buf = allSymbols[sym];
-            buf.resize(T_s);
-            getSamples(buf.data(), T_s, coarseCorrector + fineCorrector);
+            DSPCOMPLEX *buf = &ofdmBuffer[sym * T_s];
+            getSamples(buf, T_s, coarseCorrector + fineCorrector);
             for (int i = T_u; i < T_s; i ++)
                 FreqCorr += buf[i] * conj(buf[i - T_u]);
         }
 
-        PROFILE(PushAllSymbols);
-        ofdmDecoder.pushAllSymbols(move(allSymbols));
+        PROFILE(PushFrame);
+        ofdmDecoder.pushFrame();
+        cpuTimeNs = thread_cputime_ns();
 
         //NewOffset:
         /// we integrate the newly found frequency error with the
@@ -466,7 +633,6 @@ SyncOnPhase:
          * samples ahead
          * Here we just check the fineCorrector
          */
-        counter  = 0;
 
         if (fineCorrector > params.carrierDiff / 2) {
             coarseCorrector += params.carrierDiff;
@@ -490,6 +656,12 @@ SyncOnPhase:
         radioInterface.onInputFailure();
     }
     running = false;
+
+    {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        finished = true;
+    }
+    finishedCondition.notify_all();
 }
 
 void OFDMProcessor::reset()
@@ -507,6 +679,32 @@ void OFDMProcessor::stop()
     running = false;
 }
 
+size_t OFDMProcessor::getNumDroppedFrames() const
+{
+    return ofdmDecoder.getNumDroppedFrames();
+}
+
+void OFDMProcessor::getStats(ReceiverStats& stats)
+{
+    stats.numDroppedFrames = ofdmDecoder.getNumDroppedFrames();
+    stats.numPendingFrames = ofdmDecoder.getNumPendingFrames();
+    stats.ofdmProcessorCpuTimeNs = cpuTimeNs;
+    stats.ofdmDecoderCpuTimeNs = ofdmDecoder.getCpuTimeNs();
+    stats.frameDecodeTime = ofdmDecoder.getFrameDecodeTime();
+}
+
+bool OFDMProcessor::waitUntilDecoded(std::chrono::steady_clock::time_point deadline)
+{
+    {
+        std::unique_lock<std::mutex> lock(finishedMutex);
+        if (not finishedCondition.wait_until(lock, deadline,
+                    [&]() { return finished; })) {
+            return false;
+        }
+    }
+    return ofdmDecoder.waitUntilIdle(deadline);
+}
+
 void OFDMProcessor::resetCoarseCorrector()
 {
     coarseCorrector = 0;
@@ -36,6 +36,8 @@
 #include "dab-constants.h"
 #include <thread>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <vector>
 #include "phasereference.h"
 #include "ofdm-decoder.h"
@@ -47,6 +49,16 @@
 #include "fic-handler.h"
 #include "msc-handler.h"
 
+struct ReceiverStats {
+    size_t numDroppedFrames = 0;
+    // Frames waiting for the OFDM decoder
+    size_t numPendingFrames = 0;
+    // CPU time used by the threads of the OFDM processor and decoder
+    uint64_t ofdmProcessorCpuTimeNs = 0;
+    uint64_t ofdmDecoderCpuTimeNs = 0;
+    AtomicHistogram::snapshot_t frameDecodeTime;
+};
+
 class OFDMProcessor
 {
 // Identifier "interface" is already defined in the w32api header basetype.h
@@ -65,8 +77,19 @@ class OFDMProcessor
         void set_scanMode(bool);
         void start();
 
+        // Number of frames the OFDM decoder could not keep up with
+        size_t getNumDroppedFrames(void) const;
+
+        void getStats(ReceiverStats& stats);
+
+        /* Wait until the thread has stopped, e.g. at the end of the input,
+         * and the OFDM decoder has decoded all frames, or until the
+         * deadline. Returns true if both happened. */
+        bool waitUntilDecoded(std::chrono::steady_clock::time_point deadline);
+
     private:
         std::thread threadHandle;
+        std::atomic<uint64_t> cpuTimeNs = ATOMIC_VAR_INIT(0);
         int32_t syncBufferIndex = 0;
         RadioControllerInterface& radioInterface;
         InputInterface& input;
@@ -78,6 +101,11 @@ class OFDMProcessor
 
         std::atomic<bool> running = ATOMIC_VAR_INIT(false);
 
+        // Set when run() returns
+        std::mutex finishedMutex;
+        std::condition_variable finishedCondition;
+        bool finished = false;
+
         int32_t T_null;
         int32_t T_u;
         int32_t T_s;
@@ -104,6 +132,7 @@ class OFDMProcessor
         OfdmDecoder ofdmDecoder;
         std::vector<float> correlationVector;
         std::vector<float> refArg;
+        std::vector<DSPCOMPLEX> prs; // copy of the PRS for the TII decoder
 
         bool scanMode = false;
         int attempts = 0;
@@ -113,8 +142,28 @@ class OFDMProcessor
         fft::Forward fft_handler;
         DSPCOMPLEX *fft_buffer; // of size T_u
 
-        DSPCOMPLEX getSample(int32_t);
-        void getSamples(DSPCOMPLEX *, int16_t, int32_t);
+        // Samples read from the input in bulk, or ahead by scanEnvelope(),
+        // but not consumed yet
+        std::vector<DSPCOMPLEX> lookahead;
+        int32_t lookaheadIndex = 0;
+        int32_t lookaheadCount = 0;
+        std::vector<DSPCOMPLEX> scanBuffer;
+
+        std::vector<float> levelWeights;
+        std::vector<double> levelDecay;
+
+        void waitForInput(int32_t n);
+        void consumedInput(int32_t requested, int32_t numRead);
+        int32_t readInput(DSPCOMPLEX *v, int32_t n);
+        int32_t peekInput(int32_t n);
+        void mix(const DSPCOMPLEX *in, DSPCOMPLEX *out,
+                int32_t n, int32_t phase, int32_t& oscillatorPhase) const;
+        void trackLevel(const DSPCOMPLEX *v, int32_t n);
+        void countSamples(int32_t n);
+        void getSamples(DSPCOMPLEX *, int32_t, int32_t);
+        bool scanEnvelope(float *envBuffer, int32_t envBufferMask,
+                float& currentStrength, bool dip, double threshold,
+                int32_t maxCount, int32_t phase);
         void run(void);
         int16_t processPRS(DSPCOMPLEX *v);
         int16_t getMiddle(DSPCOMPLEX *);
@@ -20,6 +20,8 @@
  *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  *
  */
+#include    <array>
+#include    <stdexcept>
 #include    "protTables.h"
 
 static const
@@ -55,3 +57,30 @@ const int8_t *getPCodes(int16_t x)
     return p_codes[x];
 }
 
+static std::array<PunctureIndex, 24> buildPIndices()
+{
+    std::array<PunctureIndex, 24> indices;
+
+    for (size_t x = 0; x < indices.size(); x++) {
+        indices[x].count = 0;
+        for (uint8_t k = 0; k < 32; k++) {
+            if (p_codes[x][k] != 0) {
+                indices[x].positions[indices[x].count++] = k;
+            }
+        }
+    }
+
+    return indices;
+}
+
+const PunctureIndex *getPIndex(const int8_t *pcodes)
+{
+    static const auto indices = buildPIndices();
+
+    const ptrdiff_t offset = pcodes - &p_codes[0][0];
+    if (offset < 0 or offset >= 24 * 32 or offset % 32 != 0) {
+        throw std::logic_error("getPIndex called with unknown puncturing vector");
+    }
+
+    return &indices[offset / 32];
+}
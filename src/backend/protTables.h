@@ -27,5 +27,15 @@
 
 const int8_t *getPCodes(int16_t);
 
+// Positions of the transmitted bits within the 32 bits covered by
+// a puncturing vector
+struct PunctureIndex {
+    int16_t count;
+    uint8_t positions[32];
+};
+
+// Returns the precomputed PunctureIndex for a vector returned by getPCodes()
+const PunctureIndex *getPIndex(const int8_t *pcodes);
+
 #endif
 
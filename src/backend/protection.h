@@ -26,6 +26,7 @@
 
 #include <cstdint>
 #include "dab-constants.h"
+#include "viterbi.h"
 
 extern uint8_t PI_X[];
 
@@ -34,6 +35,10 @@ class Protection
     public:
         virtual ~Protection() = default;
         virtual bool deconvolve(const softbit_t *, int32_t, uint8_t *) = 0;
+
+        // The puncturing of the logical frame, for callers that
+        // run the Viterbi decoder themselves
+        virtual const PuncturingScheme& puncturing(void) const = 0;
 };
 #endif
 
@@ -33,7 +33,10 @@
 #ifndef RADIOCONTROLLER_H
 #define RADIOCONTROLLER_H
 
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <thread>
 #include <vector>
 #include <string>
 #include <complex>
@@ -97,8 +100,18 @@ class RadioControllerInterface {
 
         virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) = 0;
 
+        /* For every FIB, tell if the CRC check passed. fib points to the 32 bytes of FIB data.
+         * The default implementation unpacks the FIB for onFIBDecodeSuccess. */
+        virtual void onFIBDecodeSuccessPacked(bool crcCheckOk, const uint8_t* fib) {
+            uint8_t bits[256];
+            for (int i = 0; i < 256; i++) {
+                bits[i] = (fib[i / 8] >> (7 - i % 8)) & 1;
+            }
+            onFIBDecodeSuccess(crcCheckOk, bits);
+        }
+
         /* For every FIB, tell if the CRC check passed. fib points to a bit-vector with 256 bits of FIB data  */
-        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) = 0;
+        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) { (void)crcCheckOk; (void)fib; }
 
         /* When a new channel impulse response vector was calculated */
         virtual void onNewImpulseResponse(std::vector<float>&& data) = 0;
@@ -135,6 +148,12 @@ class ProgrammeHandlerInterface {
          * used.  */
         virtual void onNewAudio(std::vector<int16_t>&& audioData, int sampleRate, const std::string& mode) = 0;
 
+        /* The audio as it was transmitted, before decoding: MP2 frames
+         * for DAB, and AAC access units in LATM/LOAS framing for DAB+.
+         * format is "mp2" or "aac". */
+        virtual void onNewEncodedAudio(const uint8_t* /*data*/, size_t /*len*/,
+                const std::string& /*format*/) { };
+
         /* (DAB+ only) Reed-Solomon decoding error indicator, and
          * number of corrected errors.
          * The function will also be called in the absence of errors,
@@ -164,6 +183,7 @@ enum class DeviceParam {
     SoapySDRAntenna,
     SoapySDRDriverArgs,
     SoapySDRClockSource,
+    SampleRate, // in samples per second, for wideband inputs
 };
 
 /* Definition of the interface all input devices must implement */
@@ -179,6 +199,22 @@ public:
     virtual int32_t getSamples(DSPCOMPLEX* buffer, int32_t size) = 0;
     virtual std::vector<DSPCOMPLEX> getSpectrumSamples(int size) = 0;
     virtual int32_t getSamplesToRead(void) = 0;
+
+    /* Wait until at least n samples can be read, or until the timeout
+     * expires, and return the number of samples that can be read.
+     * Inputs that receive their samples through an IQRingBuffer wake the
+     * caller up as soon as the samples arrive, this default polls
+     * getSamplesToRead(). */
+    virtual int32_t waitForSamples(int32_t n, std::chrono::milliseconds timeout) {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        int32_t available = getSamplesToRead();
+        while (available < n and std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            available = getSamplesToRead();
+        }
+        return available;
+    }
+
     virtual float setGain(int gain) = 0;
     virtual float getGain(void) const = 0;
     virtual int getGainCount(void) = 0;
@@ -81,5 +81,30 @@ struct RadioReceiverOptions {
     // Which method to use for the freqsyncmethod used in the coarse corrector.
     // Has no effect when coarse corrector is disabled.
     FreqsyncMethod freqsyncMethod = FreqsyncMethod::PatternOfZeros;
+
+    // Run the Viterbi decoder of all selected subchannels of a CIF in one
+    // batched call from the OFDM decoder thread instead of once per
+    // subchannel in each audio decoder thread. Useful when many services
+    // are decoded simultaneously. Only taken into account when the
+    // RadioReceiver is constructed.
+    bool batchedMscDeconvolution = false;
+
+    // Number of OFDM frames that can wait for the OFDM decoder. When the
+    // decoder falls further behind, frames are dropped and counted.
+    // Each frame takes about 1.5MB in transmission mode I. Only taken into
+    // account when the RadioReceiver is constructed.
+    int ofdmFrameQueueDepth = 2;
+
+    // Number of threads that calculate the FFTs of the symbols of a frame
+    // in parallel in the OFDM decoder. With 1, the OFDM decoder thread
+    // does all the work. Only taken into account when the RadioReceiver
+    // is constructed.
+    int ofdmFFTThreads = 1;
+
+    // When the input is not realtime, e.g. when decoding a file as fast as
+    // possible, set to true to make the OFDMProcessor wait for the OFDM
+    // decoder instead of dropping frames. Only taken into account when
+    // the RadioReceiver is constructed.
+    bool waitForOfdmDecoder = false;
 };
 
@@ -69,7 +69,7 @@ RadioReceiver::RadioReceiver(
                 RadioReceiverOptions rro,
                 int transmission_mode) :
     params(transmission_mode),
-    mscHandler(params, false),
+    mscHandler(params, false, rro.batchedMscDeconvolution),
     ficHandler(rci),
     ofdmProcessor(input,
         params,
@@ -124,10 +124,11 @@ bool RadioReceiver::addServiceToDecode(ProgrammeHandlerInterface& handler,
 
 bool RadioReceiver::removeServiceToDecode(const Service& s)
 {
-    const auto comps = ficHandler.fibProcessor.getComponents(s);
+    const auto ensemble = ficHandler.fibProcessor.getEnsembleSnapshot();
+    const auto comps = ensemble->getComponents(s);
     for (const auto& sc : comps) {
         if (sc.transportMode() == TransportMode::Audio) {
-            const auto& subch = ficHandler.fibProcessor.getSubchannel(sc);
+            const auto& subch = ensemble->getSubchannel(sc);
             if (subch.valid()) {
                 return mscHandler.removeSubchannel(subch);
             }
@@ -139,10 +140,11 @@ bool RadioReceiver::removeServiceToDecode(const Service& s)
 bool RadioReceiver::playProgramme(ProgrammeHandlerInterface& handler,
         const Service& s, const std::string& dumpFileName, bool unique)
 {
-    const auto comps = ficHandler.fibProcessor.getComponents(s);
+    const auto ensemble = ficHandler.fibProcessor.getEnsembleSnapshot();
+    const auto comps = ensemble->getComponents(s);
     for (const auto& sc : comps) {
         if (sc.transportMode() == TransportMode::Audio) {
-            const auto& subch = ficHandler.fibProcessor.getSubchannel(sc);
+            const auto& subch = ensemble->getSubchannel(sc);
 
             if (subch.valid()) {
                 if (unique) {
@@ -162,6 +164,11 @@ bool RadioReceiver::playProgramme(ProgrammeHandlerInterface& handler,
     return false;
 }
 
+std::shared_ptr<const EnsembleSnapshot> RadioReceiver::getEnsembleSnapshot(void) const
+{
+    return ficHandler.fibProcessor.getEnsembleSnapshot();
+}
+
 uint16_t RadioReceiver::getEnsembleId(void) const
 {
     return ficHandler.fibProcessor.getEnsembleId();
@@ -214,3 +221,22 @@ DABParams& RadioReceiver::getParams()
 {
     return params;
 }
+
+size_t RadioReceiver::getNumDroppedFrames() const
+{
+    return ofdmProcessor.getNumDroppedFrames();
+}
+
+ReceiverStats RadioReceiver::getStats()
+{
+    ReceiverStats stats;
+    ofdmProcessor.getStats(stats);
+    return stats;
+}
+
+bool RadioReceiver::waitUntilDecoded(std::chrono::milliseconds timeout)
+{
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    return ofdmProcessor.waitUntilDecoded(deadline) and
+        mscHandler.waitUntilIdle(deadline);
+}
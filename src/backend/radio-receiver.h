@@ -33,6 +33,7 @@
 #ifndef RADIO_RECEIVER_H
 #define RADIO_RECEIVER_H
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include "radio-controller.h"
@@ -73,6 +74,11 @@ class RadioReceiver {
 
         bool removeServiceToDecode(const Service& s);
 
+        /* The ensemble information as of the last change of the FIC.
+         * Prefer this over the getters below when reading several
+         * fields, they each take their own snapshot. */
+        std::shared_ptr<const EnsembleSnapshot> getEnsembleSnapshot(void) const;
+
         uint16_t getEnsembleId(void) const;
         uint8_t getEnsembleEcc(void) const;
         DabLabel getEnsembleLabel(void) const;
@@ -93,6 +99,18 @@ class RadioReceiver {
 
         DABParams& getParams(void);
 
+        /* Number of frames that were dropped because the OFDM decoder
+         * did not keep up with the input */
+        size_t getNumDroppedFrames(void) const;
+
+        // Counters of the decoding threads, for monitoring
+        ReceiverStats getStats(void);
+
+        /* For an input that ends, e.g. a file read with pull: wait until
+         * all of it has been demodulated and the programmes are decoded,
+         * or for at most timeout. Returns true once that is the case. */
+        bool waitUntilDecoded(std::chrono::milliseconds timeout);
+
     private:
         bool playProgramme(ProgrammeHandlerInterface& handler,
                 const Service& s,
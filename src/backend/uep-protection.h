@@ -33,6 +33,7 @@ class UEPProtection: public Protection, public Viterbi
     public:
         UEPProtection(int16_t bitRate, int16_t protLevel);
         bool deconvolve(const softbit_t *v, int32_t size, uint8_t *outBuffer);
+        const PuncturingScheme& puncturing(void) const { return scheme; }
     private:
         int16_t L1;
         int16_t L2;
@@ -42,8 +43,7 @@ class UEPProtection: public Protection, public Viterbi
         const int8_t *PI2;
         const int8_t *PI3;
         const int8_t *PI4;
-        int32_t outSize;
-        std::vector<softbit_t> viterbiBlock;
+        PuncturingScheme scheme;
 };
 
 #endif
@@ -21,7 +21,11 @@
 #include    <stdio.h>
 #include    <stdlib.h>
 #include    "viterbi.h"
+#include    "protection.h"
 #include    <cstring>
+#include    <stdexcept>
+#include    <algorithm>
+#include    <new>
 
 #ifdef  __MINGW32__
 #  include <intrin.h>
@@ -29,6 +33,16 @@
 #  include <windows.h>
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define VITERBI_X86 1
+#  include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  define VITERBI_NEON 1
+#  include <arm_neon.h>
+#endif
+
 //  It took a while to discover that the polynomes we used
 //  in our own "straightforward" implementation was bitreversed!!
 //  The official one is on top.
@@ -43,6 +57,11 @@
 #define PRECISIONSHIFT  0
 #define RENORMALIZE_THRESHOLD   137
 
+// The vectorised butterflies below only implement the unscaled metric
+#if (METRICSHIFT != 0) || (PRECISIONSHIFT != 0) || (NUMSTATES != 64) || (RATE != 4)
+#  error "SIMD viterbi kernels need METRICSHIFT=PRECISIONSHIFT=0, 64 states and rate 1/4"
+#endif
+
 /* ADDSHIFT and SUBSHIFT make sure that the thing returned is a byte. */
 #if (K-1<8)
 #define ADDSHIFT (8-(K-1))
@@ -119,11 +138,72 @@ void renormalize(COMPUTETYPE* X, COMPUTETYPE threshold)
     }
 }
 
+const char* viterbiKernelToString(ViterbiKernel kernel)
+{
+    switch (kernel) {
+        case ViterbiKernel::Auto: return "Auto";
+        case ViterbiKernel::Generic: return "Generic";
+        case ViterbiKernel::SSE2: return "SSE2";
+        case ViterbiKernel::AVX2: return "AVX2";
+        case ViterbiKernel::NEON: return "NEON";
+    }
+    throw std::logic_error("Unhandled viterbi kernel");
+}
+
+bool Viterbi::kernelAvailable(ViterbiKernel kernel)
+{
+    switch (kernel) {
+        case ViterbiKernel::Auto:
+        case ViterbiKernel::Generic:
+            return true;
+        case ViterbiKernel::SSE2:
+#if defined(VITERBI_X86)
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+#else
+            return false;
+#endif
+        case ViterbiKernel::AVX2:
+#if defined(VITERBI_X86)
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+        case ViterbiKernel::NEON:
+#if defined(VITERBI_NEON)
+            // NEON is only enabled at compile time when the target has it
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+static ViterbiKernel selectKernel(ViterbiKernel requested)
+{
+    if (requested != ViterbiKernel::Auto) {
+        return Viterbi::kernelAvailable(requested) ?
+            requested : ViterbiKernel::Generic;
+    }
+
+    const ViterbiKernel preferred[] = {
+        ViterbiKernel::AVX2, ViterbiKernel::SSE2, ViterbiKernel::NEON };
+    for (const auto k : preferred) {
+        if (Viterbi::kernelAvailable(k)) {
+            return k;
+        }
+    }
+    return ViterbiKernel::Generic;
+}
+
 //  The main use of the viterbi decoder is in handling the FIC blocks
 //  There are (in mode 1) 3 ofdm blocks, giving 4 FIC blocks
 //  There all have a predefined length. In that case we use the
 //  "fast" (i.e. spiral) code, otherwise we use the generic code
-Viterbi::Viterbi(int16_t wordlength)
+Viterbi::Viterbi(int16_t wordlength, ViterbiKernel kernel) :
+    kernel(selectKernel(kernel))
 {
     int polys[RATE] = POLYS;
     int16_t i, state;
@@ -221,26 +301,391 @@ uint8_t getbit (uint8_t v, int32_t o)
 //  }
 //}
 
+/*  Vectorised versions of update_viterbi_blk_GENERIC.
+ *
+ *  For every input bit, butterfly i (0 .. 31) combines the old metrics
+ *  of states i and i + 32 into the new states 2i and 2i + 1. The branch
+ *  metric for butterfly i is the sum over the RATE symbols of
+ *  Branchtab[j * 32 + i] ^ sym[j], so one vector of 16-bit lanes handles
+ *  8 (SSE2, NEON) or 16 (AVX2) butterflies at once.
+ *
+ *  The decision for new state n ends up in bit n of the 64-bit
+ *  decision_t, which is where BFLY puts it. Survivor selection and
+ *  renormalisation use unsigned 16-bit arithmetic with the same
+ *  wrap-around semantics as the C version, so the results are bit-exact.
+ */
+#if defined(VITERBI_X86)
+__attribute__((target("sse2")))
+static inline __m128i min_epu16_sse2(__m128i a, __m128i b)
+{
+    return _mm_sub_epi16(a, _mm_subs_epu16(a, b));
+}
+
+__attribute__((target("sse2")))
+static inline void renormalize_sse2(__m128i *X)
+{
+    __m128i m = _mm_loadu_si128(&X[0]);
+    for (int i = 1; i < NUMSTATES / 8; i++) {
+        m = min_epu16_sse2(m, _mm_loadu_si128(&X[i]));
+    }
+    m = min_epu16_sse2(m, _mm_srli_si128(m, 8));
+    m = min_epu16_sse2(m, _mm_srli_si128(m, 4));
+    m = min_epu16_sse2(m, _mm_srli_si128(m, 2));
+    const __m128i min = _mm_set1_epi16(_mm_extract_epi16(m, 0));
+
+    for (int i = 0; i < NUMSTATES / 8; i++) {
+        _mm_storeu_si128(&X[i], _mm_sub_epi16(_mm_loadu_si128(&X[i]), min));
+    }
+}
+
+__attribute__((target("sse2")))
+static void update_viterbi_blk_SSE2(
+        const COMPUTETYPE *branchtab,
+        struct v *vp,
+        const COMPUTETYPE *syms,
+        int16_t nbits)
+{
+    const __m128i max = _mm_set1_epi16(RATE * 255);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i *bt = (const __m128i *)branchtab;
+
+    for (int32_t s = 0; s < nbits; s++) {
+        const __m128i *old_m = (const __m128i *)vp->old_metrics->t;
+        __m128i *new_m = (__m128i *)vp->new_metrics->t;
+        decision_t *d = &vp->decisions[s];
+
+        const __m128i sym0 = _mm_set1_epi16(syms[s * RATE + 0]);
+        const __m128i sym1 = _mm_set1_epi16(syms[s * RATE + 1]);
+        const __m128i sym2 = _mm_set1_epi16(syms[s * RATE + 2]);
+        const __m128i sym3 = _mm_set1_epi16(syms[s * RATE + 3]);
+
+        for (int g = 0; g < NUMSTATES / 16; g++) {
+            __m128i metric = _mm_xor_si128(_mm_loadu_si128(&bt[g]), sym0);
+            metric = _mm_add_epi16(metric,
+                    _mm_xor_si128(_mm_loadu_si128(&bt[4 + g]), sym1));
+            metric = _mm_add_epi16(metric,
+                    _mm_xor_si128(_mm_loadu_si128(&bt[8 + g]), sym2));
+            metric = _mm_add_epi16(metric,
+                    _mm_xor_si128(_mm_loadu_si128(&bt[12 + g]), sym3));
+            const __m128i inv_metric = _mm_sub_epi16(max, metric);
+
+            const __m128i lo = _mm_loadu_si128(&old_m[g]);
+            const __m128i hi = _mm_loadu_si128(&old_m[g + 4]);
+            const __m128i m0 = _mm_add_epi16(lo, metric);
+            const __m128i m1 = _mm_add_epi16(hi, inv_metric);
+            const __m128i m2 = _mm_add_epi16(lo, inv_metric);
+            const __m128i m3 = _mm_add_epi16(hi, metric);
+
+            // Saturated difference is non-zero iff m0 > m1 (unsigned)
+            const __m128i diff0 = _mm_subs_epu16(m0, m1);
+            const __m128i diff1 = _mm_subs_epu16(m2, m3);
+            const __m128i survivor0 = _mm_sub_epi16(m0, diff0);
+            const __m128i survivor1 = _mm_sub_epi16(m2, diff1);
+
+            _mm_storeu_si128(&new_m[2 * g], _mm_unpacklo_epi16(survivor0, survivor1));
+            _mm_storeu_si128(&new_m[2 * g + 1], _mm_unpackhi_epi16(survivor0, survivor1));
+
+            const __m128i keep0 = _mm_cmpeq_epi16(diff0, zero);
+            const __m128i keep1 = _mm_cmpeq_epi16(diff1, zero);
+            const __m128i keep = _mm_packs_epi16(
+                    _mm_unpacklo_epi16(keep0, keep1),
+                    _mm_unpackhi_epi16(keep0, keep1));
+            d->s[g] = ~_mm_movemask_epi8(keep);
+        }
+
+        if (vp->new_metrics->t[0] > RENORMALIZE_THRESHOLD) {
+            renormalize_sse2(new_m);
+        }
+
+        metric_t *tmp = vp->old_metrics;
+        vp->old_metrics = vp->new_metrics;
+        vp->new_metrics = tmp;
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i min_epu16_avx2(__m256i a, __m256i b)
+{
+    return _mm256_sub_epi16(a, _mm256_subs_epu16(a, b));
+}
+
+__attribute__((target("avx2")))
+static void update_viterbi_blk_AVX2(
+        const COMPUTETYPE *branchtab,
+        struct v *vp,
+        const COMPUTETYPE *syms,
+        int16_t nbits)
+{
+    const __m256i max = _mm256_set1_epi16(RATE * 255);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i *bt = (const __m256i *)branchtab;
+
+    for (int32_t s = 0; s < nbits; s++) {
+        const __m256i *old_m = (const __m256i *)vp->old_metrics->t;
+        __m256i *new_m = (__m256i *)vp->new_metrics->t;
+        decision_t *d = &vp->decisions[s];
+
+        const __m256i sym0 = _mm256_set1_epi16(syms[s * RATE + 0]);
+        const __m256i sym1 = _mm256_set1_epi16(syms[s * RATE + 1]);
+        const __m256i sym2 = _mm256_set1_epi16(syms[s * RATE + 2]);
+        const __m256i sym3 = _mm256_set1_epi16(syms[s * RATE + 3]);
+
+        for (int g = 0; g < NUMSTATES / 32; g++) {
+            __m256i metric = _mm256_xor_si256(_mm256_loadu_si256(&bt[g]), sym0);
+            metric = _mm256_add_epi16(metric,
+                    _mm256_xor_si256(_mm256_loadu_si256(&bt[2 + g]), sym1));
+            metric = _mm256_add_epi16(metric,
+                    _mm256_xor_si256(_mm256_loadu_si256(&bt[4 + g]), sym2));
+            metric = _mm256_add_epi16(metric,
+                    _mm256_xor_si256(_mm256_loadu_si256(&bt[6 + g]), sym3));
+            const __m256i inv_metric = _mm256_sub_epi16(max, metric);
+
+            const __m256i lo = _mm256_loadu_si256(&old_m[g]);
+            const __m256i hi = _mm256_loadu_si256(&old_m[g + 2]);
+            const __m256i m0 = _mm256_add_epi16(lo, metric);
+            const __m256i m1 = _mm256_add_epi16(hi, inv_metric);
+            const __m256i m2 = _mm256_add_epi16(lo, inv_metric);
+            const __m256i m3 = _mm256_add_epi16(hi, metric);
+
+            const __m256i diff0 = _mm256_subs_epu16(m0, m1);
+            const __m256i diff1 = _mm256_subs_epu16(m2, m3);
+            const __m256i survivor0 = _mm256_sub_epi16(m0, diff0);
+            const __m256i survivor1 = _mm256_sub_epi16(m2, diff1);
+
+            // unpack works within 128-bit lanes, permute to restore the order
+            const __m256i s_lo = _mm256_unpacklo_epi16(survivor0, survivor1);
+            const __m256i s_hi = _mm256_unpackhi_epi16(survivor0, survivor1);
+            _mm256_storeu_si256(&new_m[2 * g],
+                    _mm256_permute2x128_si256(s_lo, s_hi, 0x20));
+            _mm256_storeu_si256(&new_m[2 * g + 1],
+                    _mm256_permute2x128_si256(s_lo, s_hi, 0x31));
+
+            const __m256i keep0 = _mm256_cmpeq_epi16(diff0, zero);
+            const __m256i keep1 = _mm256_cmpeq_epi16(diff1, zero);
+            const __m256i k_lo = _mm256_unpacklo_epi16(keep0, keep1);
+            const __m256i k_hi = _mm256_unpackhi_epi16(keep0, keep1);
+            const __m256i keep = _mm256_permute4x64_epi64(
+                    _mm256_packs_epi16(
+                        _mm256_permute2x128_si256(k_lo, k_hi, 0x20),
+                        _mm256_permute2x128_si256(k_lo, k_hi, 0x31)),
+                    _MM_SHUFFLE(3, 1, 2, 0));
+            d->w[g] = ~(uint32_t)_mm256_movemask_epi8(keep);
+        }
+
+        if (vp->new_metrics->t[0] > RENORMALIZE_THRESHOLD) {
+            __m256i m = _mm256_loadu_si256(&new_m[0]);
+            for (int i = 1; i < NUMSTATES / 16; i++) {
+                m = min_epu16_avx2(m, _mm256_loadu_si256(&new_m[i]));
+            }
+            __m128i m128 = _mm256_castsi256_si128(m);
+            const __m128i m128_hi = _mm256_extracti128_si256(m, 1);
+            m128 = _mm_sub_epi16(m128, _mm_subs_epu16(m128, m128_hi));
+            m128 = _mm_sub_epi16(m128, _mm_subs_epu16(m128, _mm_srli_si128(m128, 8)));
+            m128 = _mm_sub_epi16(m128, _mm_subs_epu16(m128, _mm_srli_si128(m128, 4)));
+            m128 = _mm_sub_epi16(m128, _mm_subs_epu16(m128, _mm_srli_si128(m128, 2)));
+            const __m256i min = _mm256_set1_epi16(_mm_extract_epi16(m128, 0));
+
+            for (int i = 0; i < NUMSTATES / 16; i++) {
+                _mm256_storeu_si256(&new_m[i],
+                        _mm256_sub_epi16(_mm256_loadu_si256(&new_m[i]), min));
+            }
+        }
+
+        metric_t *tmp = vp->old_metrics;
+        vp->old_metrics = vp->new_metrics;
+        vp->new_metrics = tmp;
+    }
+}
+#endif // defined(VITERBI_X86)
+
+#if defined(VITERBI_NEON)
+// Equivalent of _mm_movemask_epi8 for a vector of 0x00/0xFF bytes
+static inline uint16_t movemask_neon(uint8x16_t m)
+{
+    static const uint8_t bitweights[16] = {
+        1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t t = vandq_u8(m, vld1q_u8(bitweights));
+    uint8x8_t p = vpadd_u8(vget_low_u8(t), vget_high_u8(t));
+    p = vpadd_u8(p, p);
+    p = vpadd_u8(p, p);
+    return vget_lane_u8(p, 0) | (vget_lane_u8(p, 1) << 8);
+}
+
+static void update_viterbi_blk_NEON(
+        const COMPUTETYPE *branchtab,
+        struct v *vp,
+        const COMPUTETYPE *syms,
+        int16_t nbits)
+{
+    const uint16x8_t max = vdupq_n_u16(RATE * 255);
+
+    for (int32_t s = 0; s < nbits; s++) {
+        const COMPUTETYPE *old_m = vp->old_metrics->t;
+        COMPUTETYPE *new_m = vp->new_metrics->t;
+        decision_t *d = &vp->decisions[s];
+
+        const uint16x8_t sym0 = vdupq_n_u16(syms[s * RATE + 0]);
+        const uint16x8_t sym1 = vdupq_n_u16(syms[s * RATE + 1]);
+        const uint16x8_t sym2 = vdupq_n_u16(syms[s * RATE + 2]);
+        const uint16x8_t sym3 = vdupq_n_u16(syms[s * RATE + 3]);
+
+        for (int g = 0; g < NUMSTATES / 16; g++) {
+            uint16x8_t metric = veorq_u16(vld1q_u16(&branchtab[8 * g]), sym0);
+            metric = vaddq_u16(metric, veorq_u16(vld1q_u16(&branchtab[32 + 8 * g]), sym1));
+            metric = vaddq_u16(metric, veorq_u16(vld1q_u16(&branchtab[64 + 8 * g]), sym2));
+            metric = vaddq_u16(metric, veorq_u16(vld1q_u16(&branchtab[96 + 8 * g]), sym3));
+            const uint16x8_t inv_metric = vsubq_u16(max, metric);
+
+            const uint16x8_t lo = vld1q_u16(&old_m[8 * g]);
+            const uint16x8_t hi = vld1q_u16(&old_m[NUMSTATES / 2 + 8 * g]);
+            const uint16x8_t m0 = vaddq_u16(lo, metric);
+            const uint16x8_t m1 = vaddq_u16(hi, inv_metric);
+            const uint16x8_t m2 = vaddq_u16(lo, inv_metric);
+            const uint16x8_t m3 = vaddq_u16(hi, metric);
+
+            const uint16x8x2_t survivors = vzipq_u16(vminq_u16(m0, m1), vminq_u16(m2, m3));
+            vst1q_u16(&new_m[16 * g], survivors.val[0]);
+            vst1q_u16(&new_m[16 * g + 8], survivors.val[1]);
+
+            const uint16x8x2_t decisions = vzipq_u16(vcgtq_u16(m0, m1), vcgtq_u16(m2, m3));
+            d->s[g] = movemask_neon(vcombine_u8(
+                        vmovn_u16(decisions.val[0]),
+                        vmovn_u16(decisions.val[1])));
+        }
+
+        if (new_m[0] > RENORMALIZE_THRESHOLD) {
+            uint16x8_t m = vld1q_u16(&new_m[0]);
+            for (int i = 1; i < NUMSTATES / 8; i++) {
+                m = vminq_u16(m, vld1q_u16(&new_m[8 * i]));
+            }
+            uint16x4_t r = vpmin_u16(vget_low_u16(m), vget_high_u16(m));
+            r = vpmin_u16(r, r);
+            r = vpmin_u16(r, r);
+            const uint16x8_t min = vdupq_n_u16(vget_lane_u16(r, 0));
+
+            for (int i = 0; i < NUMSTATES / 8; i++) {
+                vst1q_u16(&new_m[8 * i], vsubq_u16(vld1q_u16(&new_m[8 * i]), min));
+            }
+        }
+
+        metric_t *tmp = vp->old_metrics;
+        vp->old_metrics = vp->new_metrics;
+        vp->new_metrics = tmp;
+    }
+}
+#endif // defined(VITERBI_NEON)
+
 //  Note that our DAB environment maps the softbits to -127 .. 127
 //  we have to map that onto 0 .. 255
 
+static inline COMPUTETYPE softbitToSymbol(softbit_t softbit)
+{
+    COMPUTETYPE temp = (COMPUTETYPE)softbit + 127;
+    if (temp > 255) temp = 255;
+    return temp;
+}
+
+// Symbol for a punctured (i.e. not transmitted) bit
+#define ERASED_SYMBOL 127
+
+void PuncturingScheme::addBlocks(int16_t numBlocks, const int8_t *pcodes)
+{
+    if (numBlocks > 0) {
+        blocks.push_back({numBlocks, getPIndex(pcodes)});
+    }
+}
+
+int32_t PuncturingScheme::codewordBits() const
+{
+    int32_t bits = 24;
+    for (const auto& b : blocks) {
+        bits += 128 * b.numBlocks;
+    }
+    return bits;
+}
+
+int32_t PuncturingScheme::puncturedBits() const
+{
+    int32_t bits = 0;
+    for (int i = 0; i < 24; i++) {
+        bits += PI_X[i] ? 1 : 0;
+    }
+    for (const auto& b : blocks) {
+        bits += 4 * b.numBlocks * b.index->count;
+    }
+    return bits;
+}
+
+void PuncturingScheme::depuncture(const softbit_t *input,
+        COMPUTETYPE *symbols, int32_t stride) const
+{
+    for (const auto& b : blocks) {
+        const PunctureIndex *index = b.index;
+
+        for (int32_t i = 0; i < 4 * b.numBlocks; i++) {
+            for (int k = 0; k < 32; k++) {
+                symbols[k * stride] = ERASED_SYMBOL;
+            }
+            for (int k = 0; k < index->count; k++) {
+                symbols[index->positions[k] * stride] = softbitToSymbol(input[k]);
+            }
+            input += index->count;
+            symbols += 32 * stride;
+        }
+    }
+
+    for (int k = 0; k < 24; k++) {
+        symbols[k * stride] = PI_X[k] ? softbitToSymbol(*input++) : ERASED_SYMBOL;
+    }
+}
+
 void Viterbi::deconvolve(softbit_t *input, uint8_t *output)
 {
-    uint32_t    i;
+    for (int32_t i = 0; i < (frameBits + (K - 1)) * RATE; i ++) {
+        symbols[i] = softbitToSymbol(input[i]);
+    }
+
+    decodeSymbols(output);
+}
+
+void Viterbi::deconvolve(const softbit_t *input,
+        const PuncturingScheme& puncturing, uint8_t *output)
+{
+    if (puncturing.codewordBits() != (frameBits + (K - 1)) * RATE) {
+        throw std::logic_error("Puncturing does not match Viterbi frame length");
+    }
+
+    puncturing.depuncture(input, symbols, 1);
+
+    decodeSymbols(output);
+}
 
+void Viterbi::decodeSymbols(uint8_t *output)
+{
     init_viterbi (&vp, 0);
-    for (i = 0; i < (uint16_t)(frameBits + (K - 1)) * RATE; i ++) {
-        COMPUTETYPE temp = (COMPUTETYPE)input[i] + 127;
-        if (temp < 0) temp = 0;
-        if (temp > 255) temp = 255;
-        symbols[i] = temp;
-    }
 
-    update_viterbi_blk_GENERIC (&vp, symbols, frameBits + (K - 1));
+    switch (kernel) {
+#if defined(VITERBI_X86)
+        case ViterbiKernel::AVX2:
+            update_viterbi_blk_AVX2(Branchtab, &vp, symbols, frameBits + (K - 1));
+            break;
+        case ViterbiKernel::SSE2:
+            update_viterbi_blk_SSE2(Branchtab, &vp, symbols, frameBits + (K - 1));
+            break;
+#endif
+#if defined(VITERBI_NEON)
+        case ViterbiKernel::NEON:
+            update_viterbi_blk_NEON(Branchtab, &vp, symbols, frameBits + (K - 1));
+            break;
+#endif
+        default:
+            update_viterbi_blk_GENERIC (&vp, symbols, frameBits + (K - 1));
+            break;
+    }
 
     chainback_viterbi (&vp, data, frameBits, 0);
 
-    for (i = 0; i < (uint16_t)frameBits; i ++)
+    for (int32_t i = 0; i < frameBits; i ++)
         output[i] = getbit (data[i >> 3], i & 07);
 }
 
@@ -353,3 +798,258 @@ void Viterbi::init_viterbi(struct v *p, int16_t starting_state)
     vp->old_metrics-> t[starting_state & (NUMSTATES-1)] = 0;
 }
 
+
+/*  Batched decoder
+ *
+ *  The metrics of each state are held in a vector with one lane per
+ *  codeword, so that every butterfly of the trellis is computed for all
+ *  codewords at once. The decisions for states 16g .. 16g + 15 are
+ *  collected as bits 0 .. 15 of the lane of decision vector g, which
+ *  gives the same 64 bits per step and codeword as decision_t.
+ *
+ *  The code uses the GCC vector extensions, which compile to SSE2 or
+ *  NEON (two registers per vector), and an AVX2 version is selected at
+ *  runtime on CPUs that support it.
+ */
+static inline __attribute__((always_inline))
+void update_viterbi_batch(
+        const uint8_t *branchCombination,
+        const batch_metric_t *syms,
+        batch_metric_t *decisions,
+        int32_t nsteps)
+{
+    const batch_metric_t zero = {};
+    const batch_metric_t ones = zero + (COMPUTETYPE)255;
+    const batch_metric_t max = zero + (COMPUTETYPE)(RATE * 255);
+    const batch_metric_t threshold = zero + (COMPUTETYPE)RENORMALIZE_THRESHOLD;
+
+    batch_metric_t metrics1[NUMSTATES];
+    batch_metric_t metrics2[NUMSTATES];
+    batch_metric_t *old_m = metrics1;
+    batch_metric_t *new_m = metrics2;
+
+    for (int i = 0; i < NUMSTATES; i++) {
+        metrics1[i] = zero + (COMPUTETYPE)63;
+    }
+    metrics1[0] = zero;
+
+    for (int32_t s = 0; s < nsteps; s++) {
+        const batch_metric_t *sym = &syms[s * RATE];
+        batch_metric_t *d = &decisions[s * NUMSTATES / 16];
+
+        // Branch metric for each of the 16 combinations of encoder outputs
+        batch_metric_t inv_sym[RATE];
+        for (int j = 0; j < RATE; j++) {
+            inv_sym[j] = ones - sym[j];
+        }
+
+        batch_metric_t branch_metrics[1 << RATE];
+        for (int c = 0; c < (1 << RATE); c++) {
+            branch_metrics[c] =
+                ((c & 1) ? inv_sym[0] : sym[0]) +
+                ((c & 2) ? inv_sym[1] : sym[1]) +
+                ((c & 4) ? inv_sym[2] : sym[2]) +
+                ((c & 8) ? inv_sym[3] : sym[3]);
+        }
+
+        // Butterflies 8g .. 8g + 7 produce the states of decision word g
+        for (int g = 0; g < NUMSTATES / 16; g++) {
+            batch_metric_t decision_word = zero;
+
+            for (int i = 8 * g; i < 8 * (g + 1); i++) {
+                const batch_metric_t metric = branch_metrics[branchCombination[i]];
+                const batch_metric_t inv_metric = max - metric;
+
+                const batch_metric_t m0 = old_m[i] + metric;
+                const batch_metric_t m1 = old_m[i + NUMSTATES / 2] + inv_metric;
+                const batch_metric_t m2 = old_m[i] + inv_metric;
+                const batch_metric_t m3 = old_m[i + NUMSTATES / 2] + metric;
+
+                new_m[2 * i] = (m0 > m1) ? m1 : m0;
+                new_m[2 * i + 1] = (m2 > m3) ? m3 : m2;
+
+                const batch_metric_t decision0 = (batch_metric_t)(m0 > m1);
+                const batch_metric_t decision1 = (batch_metric_t)(m2 > m3);
+                decision_word |=
+                    (decision0 & (COMPUTETYPE)(1 << ((2 * i) % 16))) |
+                    (decision1 & (COMPUTETYPE)(1 << ((2 * i + 1) % 16)));
+            }
+
+            d[g] = decision_word;
+        }
+
+        // Same renormalisation as the single decoder, but per lane
+        const batch_metric_t renormalize = (batch_metric_t)(new_m[0] > threshold);
+        batch_metric_t min = new_m[0];
+        for (int i = 1; i < NUMSTATES; i++) {
+            min = (new_m[i] < min) ? new_m[i] : min;
+        }
+        min &= renormalize;
+        for (int i = 0; i < NUMSTATES; i++) {
+            new_m[i] -= min;
+        }
+
+        batch_metric_t *tmp = old_m;
+        old_m = new_m;
+        new_m = tmp;
+    }
+}
+
+#if defined(VITERBI_X86)
+__attribute__((target("avx2")))
+static void update_viterbi_batch_AVX2(
+        const uint8_t *branchCombination,
+        const batch_metric_t *syms,
+        batch_metric_t *decisions,
+        int32_t nsteps)
+{
+    update_viterbi_batch(branchCombination, syms, decisions, nsteps);
+}
+#endif
+
+static void update_viterbi_batch_default(
+        const uint8_t *branchCombination,
+        const batch_metric_t *syms,
+        batch_metric_t *decisions,
+        int32_t nsteps)
+{
+    update_viterbi_batch(branchCombination, syms, decisions, nsteps);
+}
+
+ViterbiBatch::ViterbiBatch()
+{
+    const int polys[RATE] = POLYS;
+
+    for (int state = 0; state < NUMSTATES / 2; state++) {
+        uint8_t combination = 0;
+        for (int i = 0; i < RATE; i++) {
+            int x = (2 * state) & abs(polys[i]);
+            x ^= (x >> 16);
+            x ^= (x >> 8);
+            if ((polys[i] < 0) ^ Partab[x & 0xFF]) {
+                combination |= 1 << i;
+            }
+        }
+        branchCombination[state] = combination;
+    }
+
+    use_avx2 = Viterbi::kernelAvailable(ViterbiKernel::AVX2);
+}
+
+ViterbiBatch::~ViterbiBatch()
+{
+#ifdef  __MINGW32__
+    _aligned_free(symbols);
+    _aligned_free(decisions);
+#else
+    free(symbols);
+    free(decisions);
+#endif
+}
+
+void ViterbiBatch::reserve(int32_t numSteps)
+{
+    if (numSteps <= capacity) {
+        return;
+    }
+
+    const size_t symbolsSize = RATE * numSteps * sizeof(batch_metric_t);
+    const size_t decisionsSize = NUMSTATES / 16 * numSteps * sizeof(batch_metric_t);
+#ifdef  __MINGW32__
+    _aligned_free(symbols);
+    _aligned_free(decisions);
+    symbols = (batch_metric_t *)_aligned_malloc(symbolsSize, sizeof(batch_metric_t));
+    decisions = (batch_metric_t *)_aligned_malloc(decisionsSize, sizeof(batch_metric_t));
+    if (symbols == nullptr or decisions == nullptr) {
+        throw std::bad_alloc();
+    }
+#else
+    free(symbols);
+    free(decisions);
+    symbols = nullptr;
+    decisions = nullptr;
+    if (posix_memalign((void**)&symbols, sizeof(batch_metric_t), symbolsSize) or
+        posix_memalign((void**)&decisions, sizeof(batch_metric_t), decisionsSize)) {
+        throw std::bad_alloc();
+    }
+#endif
+    capacity = numSteps;
+}
+
+void ViterbiBatch::deconvolve(const std::vector<Job>& jobs)
+{
+    // Group codewords of similar length together so that short ones do
+    // not have to run through the padding of a much longer one
+    sortedJobs.clear();
+    for (const auto& job : jobs) {
+        sortedJobs.push_back(&job);
+    }
+    std::stable_sort(sortedJobs.begin(), sortedJobs.end(),
+            [](const Job *a, const Job *b) { return a->frameBits > b->frameBits; });
+
+    for (size_t first = 0; first < sortedJobs.size(); first += VITERBI_BATCH_LANES) {
+        const int numJobs = std::min<size_t>(VITERBI_BATCH_LANES, sortedJobs.size() - first);
+        deconvolveGroup(&sortedJobs[first], numJobs);
+    }
+}
+
+void ViterbiBatch::deconvolveGroup(const Job *const *group, int numJobs)
+{
+    // Jobs are sorted, the first one is the longest
+    const int32_t numSteps = group[0]->frameBits + (K - 1);
+    reserve(numSteps);
+
+    for (int lane = 0; lane < numJobs; lane++) {
+        const PuncturingScheme *puncturing = group[lane]->puncturing;
+        if (puncturing and puncturing->codewordBits() !=
+                RATE * (group[lane]->frameBits + (K - 1))) {
+            throw std::logic_error("Puncturing does not match Viterbi frame length");
+        }
+    }
+
+    COMPUTETYPE *syms = (COMPUTETYPE *)symbols;
+    for (int lane = 0; lane < VITERBI_BATCH_LANES; lane++) {
+        const int32_t length = (lane < numJobs) ?
+            RATE * (group[lane]->frameBits + (K - 1)) : 0;
+
+        int32_t i = 0;
+        if (lane < numJobs and group[lane]->puncturing) {
+            group[lane]->puncturing->depuncture(group[lane]->input,
+                    syms + lane, VITERBI_BATCH_LANES);
+            i = length;
+        }
+        for (; i < length; i++) {
+            syms[i * VITERBI_BATCH_LANES + lane] =
+                softbitToSymbol(group[lane]->input[i]);
+        }
+        for (; i < RATE * numSteps; i++) {
+            syms[i * VITERBI_BATCH_LANES + lane] = ERASED_SYMBOL;
+        }
+    }
+
+#if defined(VITERBI_X86)
+    if (use_avx2) {
+        update_viterbi_batch_AVX2(branchCombination, symbols, decisions, numSteps);
+    }
+    else
+#endif
+    {
+        update_viterbi_batch_default(branchCombination, symbols, decisions, numSteps);
+    }
+
+    const COMPUTETYPE *d = (const COMPUTETYPE *)decisions;
+    for (int lane = 0; lane < numJobs; lane++) {
+        const Job *job = group[lane];
+        uint32_t endstate = 0;
+
+        // See chainback_viterbi, the decoded bit is the one shifted in
+        for (int32_t nbits = job->frameBits - 1; nbits >= 0; nbits--) {
+            const uint32_t state = endstate >> ADDSHIFT;
+            const int32_t step = nbits + (K - 1);
+            const uint32_t bit = (d[(step * NUMSTATES / 16 + state / 16) *
+                    VITERBI_BATCH_LANES + lane] >> (state % 16)) & 1;
+            endstate = (endstate >> 1) | (bit << (K - 2 + ADDSHIFT));
+            job->output[nbits] = bit;
+        }
+    }
+}
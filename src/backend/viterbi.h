@@ -3,8 +3,10 @@
 /*
  *  Viterbi.h according to the SPIRAL project
  */
+#include    <vector>
 #include    "dab-constants.h"
 #include    "MathHelper.h"
+#include    "protTables.h"
 
 //  For our particular viterbi decoder, we have
 #define RATE    4
@@ -38,15 +40,61 @@ struct v {
     decision_t *decisions;   /* decisions */
 };
 
+/* Puncturing of a codeword according to EN 300 401 clause 11: groups of
+ * 128-bit blocks, each punctured per 32 bits with a vector from
+ * getPCodes(), followed by the 24 tail bits punctured with PI_X.
+ * Used by the decoders to read punctured softbits directly, without
+ * first building the full rate 1/4 codeword.
+ */
+class PuncturingScheme
+{
+    public:
+        void addBlocks(int16_t numBlocks, const int8_t *pcodes);
+
+        // Length of the depunctured codeword, including the tail
+        int32_t codewordBits(void) const;
+
+        // Number of softbits consumed from the punctured input
+        int32_t puncturedBits(void) const;
+
+        // Write the Viterbi symbols of the codeword to every stride-th
+        // element of symbols, erased bits get the neutral value
+        void depuncture(const softbit_t *input,
+                COMPUTETYPE *symbols, int32_t stride) const;
+
+    private:
+        struct Blocks {
+            int16_t numBlocks;
+            const PunctureIndex *index;
+        };
+        std::vector<Blocks> blocks;
+};
+
+// Implementation of the add-compare-select butterflies. All kernels
+// give bit-exact results, Auto selects the fastest one supported by the CPU.
+enum class ViterbiKernel { Auto, Generic, SSE2, AVX2, NEON };
+
+const char* viterbiKernelToString(ViterbiKernel kernel);
+
 class Viterbi
 {
     public:
-        Viterbi(int16_t);
+        Viterbi(int16_t, ViterbiKernel kernel = ViterbiKernel::Auto);
         ~Viterbi(void);
         Viterbi(const Viterbi& other) = delete;
         Viterbi& operator=(const Viterbi& other) = delete;
         void deconvolve(softbit_t *input, uint8_t *output);
 
+        // Decode punctured input in one pass, the puncturing
+        // scheme must describe a codeword of the right length
+        void deconvolve(const softbit_t *input,
+                const PuncturingScheme& puncturing, uint8_t *output);
+
+        ViterbiKernel getKernel(void) const { return kernel; }
+
+        // Returns true if the kernel can run on this CPU
+        static bool kernelAvailable(ViterbiKernel kernel);
+
     private:
         struct v    vp;
         COMPUTETYPE Branchtab   [NUMSTATES / 2 * RATE] __attribute__ ((aligned (16)));
@@ -55,6 +103,7 @@ class Viterbi
         void partab_init (void);
         //  uint8_t Partab  [256];
         void init_viterbi(struct v *, int16_t starting_state);
+        void decodeSymbols(uint8_t *output);
 
         void update_viterbi_blk_GENERIC( struct v *vp,
                                          COMPUTETYPE *syms,
@@ -70,6 +119,58 @@ class Viterbi
         uint8_t *data;
         COMPUTETYPE *symbols;
         int16_t frameBits;
+        ViterbiKernel kernel;
+};
+
+// Number of codewords decoded side by side in one trellis pass
+#define VITERBI_BATCH_LANES 16
+
+typedef COMPUTETYPE batch_metric_t
+    __attribute__ ((vector_size (VITERBI_BATCH_LANES * sizeof(COMPUTETYPE))));
+
+/* Decodes several independent codewords of (possibly) different lengths
+ * with one trellis pass, using one SIMD lane per codeword. This saves the
+ * per-call overhead of running one Viterbi instance per subchannel when
+ * many subchannels of a CIF are decoded, and the output is bit-exact
+ * with Viterbi::deconvolve().
+ */
+class ViterbiBatch
+{
+    public:
+        struct Job {
+            Job(const softbit_t *input, int16_t frameBits, uint8_t *output,
+                    const PuncturingScheme *puncturing = nullptr) :
+                input(input), frameBits(frameBits), output(output),
+                puncturing(puncturing) {}
+
+            // Depunctured codeword of RATE * (frameBits + 6) softbits,
+            // or punctured input if puncturing is given
+            const softbit_t *input;
+            int16_t frameBits;
+            // One decoded bit per byte, frameBits entries
+            uint8_t *output;
+            const PuncturingScheme *puncturing;
+        };
+
+        ViterbiBatch();
+        ~ViterbiBatch();
+        ViterbiBatch(const ViterbiBatch& other) = delete;
+        ViterbiBatch& operator=(const ViterbiBatch& other) = delete;
+
+        void deconvolve(const std::vector<Job>& jobs);
+
+    private:
+        void deconvolveGroup(const Job *const *group, int numJobs);
+        void reserve(int32_t numSteps);
+
+        // Which of the 16 combinations of branch outputs butterfly i uses
+        uint8_t branchCombination[NUMSTATES / 2];
+        bool use_avx2 = false;
+
+        int32_t capacity = 0;
+        batch_metric_t *symbols = nullptr;  // RATE vectors per step
+        batch_metric_t *decisions = nullptr;  // NUMSTATES/16 vectors per step
+        std::vector<const Job*> sortedJobs;
 };
 
 #endif
@@ -45,10 +45,15 @@
 static const int EXTIO_NS = 8192;
 static const int EXTIO_BASE_TYPE_SIZE = sizeof(float);
 
+// Attenuates the adjacent channels that fold into the DAB band by more
+// than 55dB, where averaging pairs of samples only gave 5dB.
+static const int AIRSPY_DECIMATOR_TAPS = 47;
+
 CAirspy::CAirspy(RadioControllerInterface &radioController) :
     radioController(radioController),
     SampleBuffer(256 * 1024),
-    SpectrumSampleBuffer(8192)
+    SpectrumSampleBuffer(8192),
+    decimator(AIRSPY_DECIMATOR_TAPS)
 {
     std::clog << "Airspy: " << "Open airspy" << std::endl;
 
@@ -127,6 +132,7 @@ bool CAirspy::restart(void)
 
     SampleBuffer.FlushRingBuffer();
     SpectrumSampleBuffer.FlushRingBuffer();
+    decimator.reset();
     result = airspy_set_sample_type(device, AIRSPY_SAMPLE_FLOAT32_IQ);
     if (result != AIRSPY_SUCCESS) {
         std::clog  << "Airspy: airspy_set_sample_type () failed: " << airspy_error_name((airspy_error)result) << "(" << result << ")" << std::endl;
@@ -191,23 +197,13 @@ int CAirspy::data_available(const DSPCOMPLEX* buf, size_t num_samples)
         throw std::runtime_error("CAirspy::data_available() needs an even number of IQ samples to be able to decimate");
     }
 
-    const DSPCOMPLEX* sbuf = reinterpret_cast<const DSPCOMPLEX*>(buf);
-
-    std::vector<DSPCOMPLEX> temp(num_samples/2);
-
-    float maxnorm = 0;
-
-    for (size_t i = 0; i < num_samples/2; i++) {
-        const auto z = 0.5f * (sbuf[2*i] + sbuf[2*i+1]);
-        temp[i] = z;
-
-        if (sw_agc and (num_frames % 10) == 0) {
-            if (norm(z) > maxnorm) {
-                maxnorm = norm(z);
-            }
-        }
+    // The buffer only grows when the transfer size changes
+    if (decimatedBuffer.size() < num_samples/2) {
+        decimatedBuffer.resize(num_samples/2);
     }
 
+    const float maxnorm = decimator.process(buf, num_samples, decimatedBuffer.data());
+
     if (sw_agc and (num_frames % 10) == 0) {
         const float maxampl = sqrt(maxnorm);
         //  std::clog  << "Airspy: maxampl: " << maxampl << std::endl;
@@ -228,8 +224,8 @@ int CAirspy::data_available(const DSPCOMPLEX* buf, size_t num_samples)
 
     num_frames++;
 
-    SampleBuffer.putDataIntoBuffer(temp.data(), num_samples/2);
-    SpectrumSampleBuffer.putDataIntoBuffer(temp.data(), num_samples/2);
+    SampleBuffer.putDataIntoBuffer(decimatedBuffer.data(), num_samples/2);
+    SpectrumSampleBuffer.putDataIntoBuffer(decimatedBuffer.data(), num_samples/2);
 
     return 0;
 }
@@ -260,6 +256,11 @@ int32_t CAirspy::getSamplesToRead(void)
     return SampleBuffer.GetRingBufferReadAvailable();
 }
 
+int32_t CAirspy::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return SampleBuffer.waitForData(n, timeout);
+}
+
 int CAirspy::getGainCount()
 {
     return 21;
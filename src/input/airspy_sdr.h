@@ -38,6 +38,7 @@
 #include "dab-constants.h"
 #include "MathHelper.h"
 #include "ringbuffer.h"
+#include "halfband_decimator.h"
 
 #include <vector>
 
@@ -67,6 +68,7 @@ public:
     int32_t getSamples(DSPCOMPLEX* Buffer, int32_t Size);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    int32_t waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     float getGain(void) const;
     float setGain(int gain);
     int getGainCount(void);
@@ -94,6 +96,10 @@ private:
     RingBuffer<DSPCOMPLEX> SpectrumSampleBuffer;
     struct airspy_device *device;
 
+    // Brings the 4096ksps of the AirSpy down to INPUT_RATE
+    HalfbandDecimator decimator;
+    std::vector<DSPCOMPLEX> decimatedBuffer;
+
     static int callback(airspy_transfer_t*);
     int data_available(const DSPCOMPLEX* buf, size_t num_samples);
 };
@@ -0,0 +1,422 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "channelizer.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define CHANNELIZER_NEON
+#endif
+
+// Half the bandwidth of a DAB signal is 768kHz. The filter passes that,
+// and has its transition band before the images of the adjacent channels,
+// which start folding into the channel above INPUT_RATE - 768kHz.
+static const double CHANNEL_CUTOFF = 900e3;
+static const double CHANNEL_HALF_BANDWIDTH = 768e3;
+
+// Number of output samples calculated per channel in each block
+static const int32_t CHANNELIZER_BLOCKSIZE = 2048;
+
+// Output of the filter with the taps for the interleaved I/Q samples x,
+// n floats long and a multiple of 8. taps_re * x gives the products of the
+// real part of the taps with I and Q in the even and odd elements, and
+// taps_im * x those of the imaginary part.
+static DSPCOMPLEX filter(const float *taps_re, const float *taps_im,
+        const float *x, int32_t n)
+{
+    float sum_re[4];
+    float sum_im[4];
+#if defined(__SSE2__)
+    __m128 re0 = _mm_setzero_ps();
+    __m128 re1 = _mm_setzero_ps();
+    __m128 im0 = _mm_setzero_ps();
+    __m128 im1 = _mm_setzero_ps();
+    for (int32_t i = 0; i < n; i += 8) {
+        const __m128 x0 = _mm_loadu_ps(x + i);
+        const __m128 x1 = _mm_loadu_ps(x + i + 4);
+        re0 = _mm_add_ps(re0, _mm_mul_ps(_mm_loadu_ps(taps_re + i), x0));
+        re1 = _mm_add_ps(re1, _mm_mul_ps(_mm_loadu_ps(taps_re + i + 4), x1));
+        im0 = _mm_add_ps(im0, _mm_mul_ps(_mm_loadu_ps(taps_im + i), x0));
+        im1 = _mm_add_ps(im1, _mm_mul_ps(_mm_loadu_ps(taps_im + i + 4), x1));
+    }
+    _mm_storeu_ps(sum_re, _mm_add_ps(re0, re1));
+    _mm_storeu_ps(sum_im, _mm_add_ps(im0, im1));
+#elif defined(CHANNELIZER_NEON)
+    float32x4_t re0 = vdupq_n_f32(0);
+    float32x4_t re1 = vdupq_n_f32(0);
+    float32x4_t im0 = vdupq_n_f32(0);
+    float32x4_t im1 = vdupq_n_f32(0);
+    for (int32_t i = 0; i < n; i += 8) {
+        const float32x4_t x0 = vld1q_f32(x + i);
+        const float32x4_t x1 = vld1q_f32(x + i + 4);
+        re0 = vmlaq_f32(re0, vld1q_f32(taps_re + i), x0);
+        re1 = vmlaq_f32(re1, vld1q_f32(taps_re + i + 4), x1);
+        im0 = vmlaq_f32(im0, vld1q_f32(taps_im + i), x0);
+        im1 = vmlaq_f32(im1, vld1q_f32(taps_im + i + 4), x1);
+    }
+    vst1q_f32(sum_re, vaddq_f32(re0, re1));
+    vst1q_f32(sum_im, vaddq_f32(im0, im1));
+#else
+    //  Independent partial sums to allow vectorisation
+    for (int j = 0; j < 4; j++) {
+        sum_re[j] = 0;
+        sum_im[j] = 0;
+    }
+    for (int32_t i = 0; i < n; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            sum_re[j] += taps_re[i + j] * x[i + j];
+            sum_im[j] += taps_im[i + j] * x[i + j];
+        }
+    }
+#endif
+    return DSPCOMPLEX(sum_re[0] + sum_re[2] - sum_im[1] - sum_im[3],
+            sum_re[1] + sum_re[3] + sum_im[0] + sum_im[2]);
+}
+
+CChannelizerOutput::CChannelizerOutput(
+        CChannelizer& channelizer, int frequency, int offset) :
+    channelizer(channelizer),
+    frequency(frequency),
+    outBuffer(CHANNELIZER_BLOCKSIZE),
+    sampleBuffer(1024 * 1024),
+    spectrumSampleBuffer(8192)
+{
+    const int32_t L = channelizer.filterLength;
+    const int32_t N = channelizer.numTaps;
+    const double rate = (double)channelizer.decimation * INPUT_RATE;
+    const double fc = CHANNEL_CUTOFF / rate;
+    const double w = 2 * M_PI * offset / rate;
+
+    // Windowed sinc low-pass with unity gain at DC, padded with zeros
+    std::vector<double> h(N, 0.0);
+    double sum = 0;
+    for (int32_t k = 0; k < L; k++) {
+        const double t = k - (L - 1) / 2.0;
+        const double sinc = (t == 0) ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+        const double hamming = 0.54 - 0.46 * cos(2 * M_PI * k / (L - 1));
+        h[k] = sinc * hamming;
+        sum += h[k];
+    }
+
+    // Filtering the mixed signal is the same as filtering the input with
+    // the filter shifted to the offset, and mixing the filter output:
+    //  y[n] = e^(-jwn) sum_k h[k] e^(jwk) x[n-k]
+    // so that the mixing only needs to be done after decimation.
+    taps_re.resize(2 * N);
+    taps_im.resize(2 * N);
+    for (int32_t k = 0; k < N; k++) {
+        const int32_t i = 2 * (N - 1 - k);
+        taps_re[i] = taps_re[i + 1] = h[k] / sum * cos(w * k);
+        taps_im[i] = taps_im[i + 1] = h[k] / sum * sin(w * k);
+    }
+
+    rotation_step = std::polar(1.0, -w * channelizer.decimation);
+}
+
+void CChannelizerOutput::process(const DSPCOMPLEX *in, int32_t size)
+{
+    const int32_t n = taps_re.size();
+    const int32_t D = channelizer.decimation;
+    const int32_t numOut = size / D;
+    const float *x = reinterpret_cast<const float*>(in);
+
+    for (int32_t m = 0; m < numOut; m++) {
+        const DSPCOMPLEX acc = filter(taps_re.data(), taps_im.data(), x + 2 * m * D, n);
+
+        const std::complex<double> y = std::complex<double>(acc) * rotation;
+        outBuffer[m] = DSPCOMPLEX(y.real(), y.imag());
+        rotation *= rotation_step;
+    }
+
+    // Avoid the accumulation of rounding errors in the amplitude
+    rotation /= std::abs(rotation);
+
+    if (running) {
+        sampleBuffer.putDataIntoBuffer(outBuffer.data(), numOut);
+        spectrumSampleBuffer.putDataIntoBuffer(outBuffer.data(), numOut);
+    }
+}
+
+void CChannelizerOutput::setFrequency(int Frequency)
+{
+    if (Frequency != frequency) {
+        std::clog << "Channelizer: cannot retune channel at " <<
+            frequency / 1000 << " kHz" << std::endl;
+    }
+}
+
+int CChannelizerOutput::getFrequency() const
+{
+    return frequency;
+}
+
+bool CChannelizerOutput::restart()
+{
+    running = true;
+    return channelizer.start();
+}
+
+bool CChannelizerOutput::is_ok()
+{
+    return channelizer.running and channelizer.input.is_ok();
+}
+
+void CChannelizerOutput::stop()
+{
+    running = false;
+}
+
+void CChannelizerOutput::reset()
+{
+    sampleBuffer.FlushRingBuffer();
+}
+
+int32_t CChannelizerOutput::getSamples(DSPCOMPLEX *Buffer, int32_t Size)
+{
+    return sampleBuffer.getDataFromBuffer(Buffer, Size);
+}
+
+std::vector<DSPCOMPLEX> CChannelizerOutput::getSpectrumSamples(int size)
+{
+    std::vector<DSPCOMPLEX> buffer(size);
+    int32_t amount = spectrumSampleBuffer.getDataFromBuffer(buffer.data(), size);
+    if (amount < size) {
+        buffer.resize(amount);
+    }
+    return buffer;
+}
+
+int32_t CChannelizerOutput::getSamplesToRead()
+{
+    return sampleBuffer.GetRingBufferReadAvailable();
+}
+
+int32_t CChannelizerOutput::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return sampleBuffer.waitForData(n, timeout);
+}
+
+float CChannelizerOutput::setGain(int gainIndex)
+{
+    return channelizer.input.setGain(gainIndex);
+}
+
+float CChannelizerOutput::getGain() const
+{
+    return channelizer.input.getGain();
+}
+
+int CChannelizerOutput::getGainCount()
+{
+    return channelizer.input.getGainCount();
+}
+
+void CChannelizerOutput::setAgc(bool AGC)
+{
+    channelizer.input.setAgc(AGC);
+}
+
+std::string CChannelizerOutput::getDescription()
+{
+    return channelizer.input.getDescription() +
+        " channel " + std::to_string(frequency / 1000) + " kHz";
+}
+
+CDeviceID CChannelizerOutput::getID()
+{
+    return channelizer.input.getID();
+}
+
+CChannelizer::CChannelizer(CVirtualInput& input, int centreFrequency, int decimation) :
+    input(input),
+    centreFrequency(centreFrequency),
+    decimation(decimation),
+    filterLength(32 * decimation + 1),
+    numTaps((filterLength + 3) / 4 * 4)
+{
+    if (decimation < 2) {
+        throw std::logic_error("Channelizer decimation must be at least 2");
+    }
+
+    input.setFrequency(centreFrequency);
+}
+
+CChannelizer::~CChannelizer()
+{
+    running = false;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+CVirtualInput& CChannelizer::addChannel(int frequency)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running) {
+        throw std::logic_error("Cannot add channels to a running channelizer");
+    }
+
+    const int offset = frequency - centreFrequency;
+    if (std::abs(offset) + CHANNEL_HALF_BANDWIDTH > decimation * INPUT_RATE / 2) {
+        throw std::runtime_error("Channel at " + std::to_string(frequency / 1000) +
+                " kHz is outside of the input bandwidth");
+    }
+
+    outputs.emplace_back(new CChannelizerOutput(*this, frequency, offset));
+    return *outputs.back();
+}
+
+bool CChannelizer::start()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running) {
+        return true;
+    }
+
+    // The thread ends by itself when the input fails
+    if (thread.joinable()) {
+        thread.join();
+    }
+
+    if (not input.restart()) {
+        return false;
+    }
+
+    running = true;
+    thread = std::thread(&CChannelizer::workerthread, this);
+    return true;
+}
+
+void CChannelizer::workerthread()
+{
+    const int32_t blockSize = CHANNELIZER_BLOCKSIZE * decimation;
+    const int32_t history = numTaps - 1;
+
+    // The last samples of the previous block precede the new block,
+    // so that the filters see a continuous input.
+    std::vector<DSPCOMPLEX> buffer(history + blockSize);
+
+    {
+        std::lock_guard<std::mutex> lock(block_mutex);
+        block_quit = false;
+    }
+    std::vector<std::thread> helpers;
+    for (size_t i = 1; i < outputs.size(); i++) {
+        helpers.emplace_back(&CChannelizer::helperthread, this);
+    }
+
+    while (running) {
+        if (input.waitForSamples(blockSize, std::chrono::milliseconds(100)) < blockSize) {
+            if (not input.is_ok()) {
+                std::clog << "Channelizer: input failed" << std::endl;
+                running = false;
+                break;
+            }
+            continue;
+        }
+
+        const int32_t numRead = input.getSamples(buffer.data() + history, blockSize);
+        if (numRead < blockSize) {
+            std::fill(buffer.begin() + history + numRead, buffer.end(), DSPCOMPLEX(0, 0));
+        }
+
+        filterBlock(buffer.data(), blockSize);
+
+        memmove(buffer.data(), buffer.data() + blockSize, history * sizeof(DSPCOMPLEX));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(block_mutex);
+        block_quit = true;
+    }
+    block_start_cv.notify_all();
+    for (auto& helper : helpers) {
+        helper.join();
+    }
+}
+
+void CChannelizer::filterBlock(const DSPCOMPLEX *in, int32_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(block_mutex);
+        block = in;
+        block_size = size;
+        block_outputs_done = 0;
+        block_next_output = 0;
+        block_generation++;
+    }
+    block_start_cv.notify_all();
+
+    filterOutputs();
+
+    std::unique_lock<std::mutex> lock(block_mutex);
+    block_done_cv.wait(lock, [&]() { return block_outputs_done == outputs.size(); });
+}
+
+void CChannelizer::filterOutputs()
+{
+    size_t i;
+    while ((i = block_next_output++) < outputs.size()) {
+        outputs[i]->process(block, block_size);
+
+        if (++block_outputs_done == outputs.size()) {
+            std::lock_guard<std::mutex> lock(block_mutex);
+            block_done_cv.notify_one();
+        }
+    }
+}
+
+void CChannelizer::helperthread()
+{
+    uint32_t generation = 0;
+    {
+        std::lock_guard<std::mutex> lock(block_mutex);
+        generation = block_generation;
+    }
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(block_mutex);
+            block_start_cv.wait(lock, [&]() {
+                    return block_quit or block_generation != generation; });
+            if (block_quit) {
+                return;
+            }
+            generation = block_generation;
+        }
+
+        filterOutputs();
+    }
+}
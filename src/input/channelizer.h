@@ -0,0 +1,159 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "virtual_input.h"
+#include "ringbuffer.h"
+
+class CChannelizer;
+
+/* One DAB channel extracted from the wideband input by the CChannelizer.
+ * It behaves like any other input at INPUT_RATE, and can be given to its
+ * own RadioReceiver. Gain settings are passed on to the wideband input,
+ * and are therefore shared by all channels. */
+class CChannelizerOutput : public CVirtualInput
+{
+public:
+    CChannelizerOutput(CChannelizer& channelizer, int frequency, int offset);
+    CChannelizerOutput(const CChannelizerOutput&) = delete;
+    CChannelizerOutput operator=(const CChannelizerOutput&) = delete;
+
+    virtual void setFrequency(int Frequency);
+    virtual int getFrequency(void) const;
+    virtual bool restart(void);
+    virtual bool is_ok(void);
+    virtual void stop(void);
+    virtual void reset(void);
+    virtual int32_t getSamples(DSPCOMPLEX* Buffer, int32_t Size);
+    virtual std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
+    virtual int32_t getSamplesToRead(void);
+    virtual int32_t waitForSamples(int32_t n, std::chrono::milliseconds timeout);
+    virtual float setGain(int gainIndex);
+    virtual float getGain(void) const;
+    virtual int getGainCount(void);
+    virtual void setAgc(bool AGC);
+    virtual std::string getDescription(void);
+    virtual CDeviceID getID(void);
+
+private:
+    friend class CChannelizer;
+
+    // Filter and decimate the wideband samples in, which are preceded
+    // by the history of the filter.
+    void process(const DSPCOMPLEX *in, int32_t size);
+
+    CChannelizer& channelizer;
+    const int frequency;
+    std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+
+    // The low-pass filter shifted to the channel offset, with the taps
+    // stored in reverse order, split into real and imaginary parts.
+    // Each part is repeated twice, so that they line up with the
+    // interleaved I/Q samples in the vector loops.
+    std::vector<float> taps_re;
+    std::vector<float> taps_im;
+
+    // Brings the filtered channel down to baseband after decimation
+    std::complex<double> rotation = 1.0;
+    std::complex<double> rotation_step;
+
+    std::vector<DSPCOMPLEX> outBuffer;
+    IQRingBuffer<DSPCOMPLEX> sampleBuffer;
+    RingBuffer<DSPCOMPLEX> spectrumSampleBuffer;
+};
+
+/* Splits a wideband input running at decimation * INPUT_RATE into several
+ * DAB channels at INPUT_RATE. This allows one SDR to receive a few adjacent
+ * ensembles at the same time.
+ *
+ * The DAB channel raster is not a multiple of INPUT_RATE, so each channel
+ * has its own polyphase decimating filter, shifted to the offset of the
+ * channel from the centre frequency. Only every decimation-th output of
+ * the filter is calculated.
+ *
+ * Each block of input is filtered into the channels in parallel, by the
+ * worker thread and one helper thread per additional channel. */
+class CChannelizer
+{
+public:
+    /* The input gets tuned to centreFrequency, and has to deliver
+     * decimation * INPUT_RATE samples per second. */
+    CChannelizer(CVirtualInput& input, int centreFrequency, int decimation);
+    ~CChannelizer();
+    CChannelizer(const CChannelizer&) = delete;
+    CChannelizer operator=(const CChannelizer&) = delete;
+
+    /* Add a channel at frequency in Hz. It has to fit within the
+     * bandwidth of the input, and channels can only be added before
+     * the first channel is restarted. */
+    CVirtualInput& addChannel(int frequency);
+
+    int getDecimation(void) const { return decimation; }
+
+private:
+    friend class CChannelizerOutput;
+    bool start(void);
+    void workerthread(void);
+
+    // Filter the block into all outputs, with the help of the helpers
+    void filterBlock(const DSPCOMPLEX *in, int32_t size);
+    void filterOutputs(void);
+    void helperthread(void);
+
+    CVirtualInput& input;
+    const int centreFrequency;
+    const int decimation;
+
+    // Length of the low-pass filter, and the number of taps it is
+    // padded to with zeros for the vector loops
+    const int32_t filterLength;
+    const int32_t numTaps;
+
+    std::vector<std::unique_ptr<CChannelizerOutput> > outputs;
+
+    std::mutex mutex;
+    std::atomic<bool> running = ATOMIC_VAR_INIT(false);
+    std::thread thread;
+
+    // The outputs are taken one by one from the current block by the
+    // worker thread and the helpers.
+    std::mutex block_mutex;
+    std::condition_variable block_start_cv;
+    std::condition_variable block_done_cv;
+    bool block_quit = false;
+    uint32_t block_generation = 0;
+    const DSPCOMPLEX *block = nullptr;
+    int32_t block_size = 0;
+    std::atomic<size_t> block_next_output = ATOMIC_VAR_INIT(0);
+    std::atomic<size_t> block_outputs_done = ATOMIC_VAR_INIT(0);
+};
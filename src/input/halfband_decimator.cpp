@@ -0,0 +1,171 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include "halfband_decimator.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#endif
+
+HalfbandDecimator::HalfbandDecimator(int numTaps) :
+    K((numTaps + 1) / 4)
+{
+    if (numTaps < 3 or (numTaps + 1) % 4 != 0) {
+        throw std::logic_error("Half-band filter needs 4K - 1 taps");
+    }
+
+    // Blackman-windowed sinc with its cutoff at a quarter of the input
+    // rate. The tap at distance d = 2j + 1 from the centre is
+    // (-1)^j / (pi d) before windowing.
+    const int N = numTaps;
+    const int centre = (N - 1) / 2;
+    double sum = 0;
+    for (int j = 0; j < K; j++) {
+        const int d = 2 * j + 1;
+        const int n = centre + d;
+        const double sinc = ((j % 2) ? -1.0 : 1.0) / (M_PI * d);
+        const double blackman = 0.42 - 0.5 * cos(2 * M_PI * n / (N - 1)) +
+            0.08 * cos(4 * M_PI * n / (N - 1));
+        taps.push_back(sinc * blackman);
+        sum += 2 * taps.back();
+    }
+
+    // Unity gain at DC, with the centre tap of 0.5
+    for (auto& t : taps) {
+        t *= 0.5 / sum;
+    }
+
+    reset();
+}
+
+void HalfbandDecimator::reset()
+{
+    even.assign(2 * (2 * K - 1), 0.0f);
+    odd.assign(2 * K, 0.0f);
+}
+
+float HalfbandDecimator::process(const DSPCOMPLEX *in, size_t numIn, DSPCOMPLEX *out)
+{
+    if (numIn % 2 != 0) {
+        throw std::logic_error("Half-band decimator needs an even number of samples");
+    }
+
+    const size_t numOut = numIn / 2;
+    const size_t evenHistory = 2 * (2 * K - 1);
+    const size_t oddHistory = 2 * K;
+
+    // The buffers only grow when a larger block than before arrives
+    even.resize(evenHistory + 2 * numOut);
+    odd.resize(oddHistory + 2 * numOut);
+
+    const float *x = reinterpret_cast<const float*>(in);
+    float *e = even.data() + evenHistory;
+    float *o = odd.data() + oddHistory;
+    for (size_t m = 0; m < numOut; m++) {
+        e[2 * m] = x[4 * m];
+        e[2 * m + 1] = x[4 * m + 1];
+        o[2 * m] = x[4 * m + 2];
+        o[2 * m + 1] = x[4 * m + 3];
+    }
+
+    // Output sample m is
+    //  0.5 odd[m] + sum_j taps[j] * (even[m + K + j] + even[m + K - 1 - j])
+    // in the buffers that include the history. Both I and Q get the same
+    // real taps, so that the loops run over the interleaved floats.
+    const float *eb = even.data();
+    const float *ob = odd.data();
+    float *y = reinterpret_cast<float*>(out);
+    const size_t numFloats = 2 * numOut;
+    size_t f = 0;
+    float maxNorm = 0;
+
+#if defined(__SSE2__)
+    __m128 maxNorm4 = _mm_setzero_ps();
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (; f + 4 <= numFloats; f += 4) {
+        __m128 acc = _mm_mul_ps(half, _mm_loadu_ps(ob + f));
+        for (int j = 0; j < K; j++) {
+            const __m128 pair = _mm_add_ps(
+                    _mm_loadu_ps(eb + f + 2 * (K + j)),
+                    _mm_loadu_ps(eb + f + 2 * (K - 1 - j)));
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(taps[j]), pair));
+        }
+        _mm_storeu_ps(y + f, acc);
+
+        // I^2 + Q^2 of both samples, in both of their lanes
+        const __m128 sq = _mm_mul_ps(acc, acc);
+        const __m128 norms = _mm_add_ps(sq,
+                _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 3, 0, 1)));
+        maxNorm4 = _mm_max_ps(maxNorm4, norms);
+    }
+    float norms[4];
+    _mm_storeu_ps(norms, maxNorm4);
+    maxNorm = std::max(norms[0], norms[2]);
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    float32x4_t maxNorm4 = vdupq_n_f32(0);
+    for (; f + 4 <= numFloats; f += 4) {
+        float32x4_t acc = vmulq_n_f32(vld1q_f32(ob + f), 0.5f);
+        for (int j = 0; j < K; j++) {
+            const float32x4_t pair = vaddq_f32(
+                    vld1q_f32(eb + f + 2 * (K + j)),
+                    vld1q_f32(eb + f + 2 * (K - 1 - j)));
+            acc = vmlaq_n_f32(acc, pair, taps[j]);
+        }
+        vst1q_f32(y + f, acc);
+
+        const float32x4_t sq = vmulq_f32(acc, acc);
+        maxNorm4 = vmaxq_f32(maxNorm4, vaddq_f32(sq, vrev64q_f32(sq)));
+    }
+    float norms[4];
+    vst1q_f32(norms, maxNorm4);
+    maxNorm = std::max(norms[0], norms[2]);
+#endif
+
+    for (; f < numFloats; f += 2) {
+        float acc_re = 0.5f * ob[f];
+        float acc_im = 0.5f * ob[f + 1];
+        for (int j = 0; j < K; j++) {
+            const size_t a = f + 2 * (K + j);
+            const size_t b = f + 2 * (K - 1 - j);
+            acc_re += taps[j] * (eb[a] + eb[b]);
+            acc_im += taps[j] * (eb[a + 1] + eb[b + 1]);
+        }
+        y[f] = acc_re;
+        y[f + 1] = acc_im;
+        maxNorm = std::max(maxNorm, acc_re * acc_re + acc_im * acc_im);
+    }
+
+    // Keep the last samples as history for the next block
+    memmove(even.data(), even.data() + 2 * numOut, evenHistory * sizeof(float));
+    memmove(odd.data(), odd.data() + 2 * numOut, oddHistory * sizeof(float));
+
+    return maxNorm;
+}
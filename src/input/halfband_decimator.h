@@ -0,0 +1,67 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "dab-constants.h"
+
+/* Decimates complex samples by two with a half-band FIR filter.
+ *
+ * All even taps of a half-band filter are zero, except for the centre tap
+ * which is 0.5. The input is therefore split into its even and odd
+ * samples: the odd ones are only scaled by the centre tap, and the even
+ * ones are filtered by the K remaining symmetric taps, which only needs
+ * K multiplications per output sample. */
+class HalfbandDecimator
+{
+public:
+    // numTaps includes the zero taps, and has to be 4K - 1, e.g. 31 or 47
+    explicit HalfbandDecimator(int numTaps);
+    HalfbandDecimator(const HalfbandDecimator&) = delete;
+    HalfbandDecimator operator=(const HalfbandDecimator&) = delete;
+
+    /* Filter and decimate numIn samples from in, which has to be even,
+     * and write numIn / 2 samples to out. Returns the largest norm of
+     * the output samples, which is calculated in the same pass. */
+    float process(const DSPCOMPLEX *in, size_t numIn, DSPCOMPLEX *out);
+
+    // Clear the history of the filter
+    void reset(void);
+
+    int getNumTaps(void) const { return 4 * K - 1; }
+
+private:
+    const int K;
+
+    // The non-zero taps next to the centre, from the inside out
+    std::vector<float> taps;
+
+    // Even and odd input samples as interleaved I/Q, preceded by
+    // 2K - 1 even and K odd samples of history.
+    std::vector<float> even;
+    std::vector<float> odd;
+};
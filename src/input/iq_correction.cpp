@@ -0,0 +1,218 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include "iq_correction.h"
+#include "sample_conversion.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define IQ_CORRECTION_NEON
+#endif
+
+const int32_t IQCorrection::DC_TIME_CONSTANT;
+const int32_t IQCorrection::IQ_TIME_CONSTANT;
+
+// The 8-bit samples are converted in blocks that stay in the L1 cache
+// until they are corrected.
+static const int32_t U8_BLOCKSIZE = 1024;
+
+static void convertU8(const uint8_t *in, DSPCOMPLEX *out, int32_t n)
+{
+    convertInt8(in, reinterpret_cast<float*>(out), 2 * n, false);
+}
+
+/* Subtract the DC offset, correct Q, and if moments is not null, sum the
+ * components, and the products of the components after DC removal.
+ * x holds n interleaved I/Q pairs. */
+void IQCorrection::correct(float *x, int32_t n, const coefficients_t& c,
+        moments_t *moments)
+{
+    const int32_t len = 2 * n;
+    int32_t k = 0;
+    moments_t m;
+
+#if defined(__SSE2__)
+    // Two samples per vector, as I, Q, I, Q
+    const __m128 dc = _mm_setr_ps(c.dc_i, c.dc_q, c.dc_i, c.dc_q);
+    const __m128 same = _mm_setr_ps(1, c.c_q, 1, c.c_q);
+    const __m128 other = _mm_setr_ps(0, c.c_i, 0, c.c_i);
+    __m128 sum = _mm_setzero_ps();
+    __m128 sum_sq = _mm_setzero_ps();
+    __m128 sum_iq = _mm_setzero_ps();
+    for (; k + 4 <= len; k += 4) {
+        const __m128 raw = _mm_loadu_ps(x + k);
+        const __m128 v = _mm_sub_ps(raw, dc);
+        // Q, I, Q, I
+        const __m128 swapped = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_ps(x + k, _mm_add_ps(_mm_mul_ps(v, same),
+                    _mm_mul_ps(swapped, other)));
+
+        sum = _mm_add_ps(sum, raw);
+        sum_sq = _mm_add_ps(sum_sq, _mm_mul_ps(v, v));
+        sum_iq = _mm_add_ps(sum_iq, _mm_mul_ps(v, swapped));
+    }
+    float s[4], sq[4], iq[4];
+    _mm_storeu_ps(s, sum);
+    _mm_storeu_ps(sq, sum_sq);
+    _mm_storeu_ps(iq, sum_iq);
+    m.sum_i = s[0] + s[2];
+    m.sum_q = s[1] + s[3];
+    m.sum_ii = sq[0] + sq[2];
+    m.sum_qq = sq[1] + sq[3];
+    m.sum_iq = iq[0] + iq[2];
+#elif defined(IQ_CORRECTION_NEON)
+    const float dc_v[4] = {c.dc_i, c.dc_q, c.dc_i, c.dc_q};
+    const float same_v[4] = {1, c.c_q, 1, c.c_q};
+    const float other_v[4] = {0, c.c_i, 0, c.c_i};
+    const float32x4_t dc = vld1q_f32(dc_v);
+    const float32x4_t same = vld1q_f32(same_v);
+    const float32x4_t other = vld1q_f32(other_v);
+    float32x4_t sum = vdupq_n_f32(0);
+    float32x4_t sum_sq = vdupq_n_f32(0);
+    float32x4_t sum_iq = vdupq_n_f32(0);
+    for (; k + 4 <= len; k += 4) {
+        const float32x4_t raw = vld1q_f32(x + k);
+        const float32x4_t v = vsubq_f32(raw, dc);
+        const float32x4_t swapped = vrev64q_f32(v);
+        vst1q_f32(x + k, vmlaq_f32(vmulq_f32(v, same), swapped, other));
+
+        sum = vaddq_f32(sum, raw);
+        sum_sq = vmlaq_f32(sum_sq, v, v);
+        sum_iq = vmlaq_f32(sum_iq, v, swapped);
+    }
+    float s[4], sq[4], iq[4];
+    vst1q_f32(s, sum);
+    vst1q_f32(sq, sum_sq);
+    vst1q_f32(iq, sum_iq);
+    m.sum_i = s[0] + s[2];
+    m.sum_q = s[1] + s[3];
+    m.sum_ii = sq[0] + sq[2];
+    m.sum_qq = sq[1] + sq[3];
+    m.sum_iq = iq[0] + iq[2];
+#endif
+
+    for (; k < len; k += 2) {
+        const float i = x[k] - c.dc_i;
+        const float q = x[k + 1] - c.dc_q;
+        m.sum_i += x[k];
+        m.sum_q += x[k + 1];
+        m.sum_ii += i * i;
+        m.sum_qq += q * q;
+        m.sum_iq += i * q;
+        x[k] = i;
+        x[k + 1] = c.c_i * i + c.c_q * q;
+    }
+
+    if (moments) {
+        moments->sum_i += m.sum_i;
+        moments->sum_q += m.sum_q;
+        moments->sum_ii += m.sum_ii;
+        moments->sum_qq += m.sum_qq;
+        moments->sum_iq += m.sum_iq;
+    }
+}
+
+IQCorrection::coefficients_t IQCorrection::getCoefficients() const
+{
+    coefficients_t c;
+    c.dc_i = dc_i.load(std::memory_order_relaxed);
+    c.dc_q = dc_q.load(std::memory_order_relaxed);
+    c.c_i = c_i.load(std::memory_order_relaxed);
+    c.c_q = c_q.load(std::memory_order_relaxed);
+    return c;
+}
+
+void IQCorrection::update(const moments_t& m, int32_t n)
+{
+    if (n == 0) {
+        return;
+    }
+
+    // The first block initialises the estimates, then the weight of every
+    // block depends on its length.
+    const double alpha_dc = initialised ? (double)n / (n + DC_TIME_CONSTANT) : 1.0;
+    const double alpha_iq = initialised ? (double)n / (n + IQ_TIME_CONSTANT) : 1.0;
+    initialised = true;
+
+    mean_i += alpha_dc * (m.sum_i / n - mean_i);
+    mean_q += alpha_dc * (m.sum_q / n - mean_q);
+    power_i += alpha_iq * (m.sum_ii / n - power_i);
+    power_q += alpha_iq * (m.sum_qq / n - power_q);
+    cross_iq += alpha_iq * (m.sum_iq / n - cross_iq);
+
+    dc_i.store(mean_i, std::memory_order_relaxed);
+    dc_q.store(mean_q, std::memory_order_relaxed);
+
+    // Without a signal, or with an implausible imbalance, Q stays as it is
+    double p = 0;
+    double a = 1;
+    if (power_i > 1e-9) {
+        p = cross_iq / power_i;
+        const double power_orthogonal = power_q - cross_iq * p;
+        if (power_orthogonal > 1e-9) {
+            a = std::sqrt(power_i / power_orthogonal);
+        }
+    }
+    if (std::fabs(p) > 0.5 or a < 0.5 or a > 2) {
+        p = 0;
+        a = 1;
+    }
+
+    c_i.store(-a * p, std::memory_order_relaxed);
+    c_q.store(a, std::memory_order_relaxed);
+}
+
+void IQCorrection::process(DSPCOMPLEX *samples, int32_t n)
+{
+    moments_t m;
+    correct(reinterpret_cast<float*>(samples), n, getCoefficients(), &m);
+    update(m, n);
+}
+
+void IQCorrection::processU8(const uint8_t *in, DSPCOMPLEX *out, int32_t n)
+{
+    const coefficients_t c = getCoefficients();
+    moments_t m;
+    for (int32_t i = 0; i < n; i += U8_BLOCKSIZE) {
+        const int32_t len = std::min(U8_BLOCKSIZE, n - i);
+        convertU8(in + 2 * i, out + i, len);
+        correct(reinterpret_cast<float*>(out + i), len, c, &m);
+    }
+    update(m, n);
+}
+
+void IQCorrection::applyU8(const uint8_t *in, DSPCOMPLEX *out, int32_t n) const
+{
+    const coefficients_t c = getCoefficients();
+    for (int32_t i = 0; i < n; i += U8_BLOCKSIZE) {
+        const int32_t len = std::min(U8_BLOCKSIZE, n - i);
+        convertU8(in + 2 * i, out + i, len);
+        correct(reinterpret_cast<float*>(out + i), len, c, nullptr);
+    }
+}
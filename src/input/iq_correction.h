@@ -0,0 +1,101 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "dab-constants.h"
+
+/* Removes the DC offset and corrects the gain and phase imbalance between
+ * I and Q, which inexpensive receivers like the RTL-SDR dongles show as a
+ * spike in the middle of the spectrum and as a mirror image of the signal.
+ *
+ * The DC offset is the mean of each component. The imbalance is estimated
+ * blindly, knowing that I and Q of a DAB signal are uncorrelated and have
+ * the same power: Q is corrected to
+ *   Q' = a (Q - p I)
+ * with p = E[IQ] / E[I^2], which removes the correlation, and a the ratio
+ * of the RMS of I and of (Q - p I). The estimates are updated after every
+ * block, and averaged over DC_TIME_CONSTANT and IQ_TIME_CONSTANT samples.
+ *
+ * Any input can use it. process() and processU8() have to be called from
+ * a single thread, applyU8() from any thread. */
+class IQCorrection
+{
+public:
+    IQCorrection() = default;
+    IQCorrection(const IQCorrection&) = delete;
+    IQCorrection operator=(const IQCorrection&) = delete;
+
+    // Correct the n samples, and update the estimates
+    void process(DSPCOMPLEX *samples, int32_t n);
+
+    // Convert n interleaved unsigned 8-bit I/Q pairs to out, correct them,
+    // and update the estimates
+    void processU8(const uint8_t *in, DSPCOMPLEX *out, int32_t n);
+
+    // Like processU8, but without updating the estimates, e.g. for the
+    // spectrum samples that are read separately
+    void applyU8(const uint8_t *in, DSPCOMPLEX *out, int32_t n) const;
+
+    static const int32_t DC_TIME_CONSTANT = 1 << 16;
+    static const int32_t IQ_TIME_CONSTANT = 1 << 18;
+
+private:
+    struct coefficients_t {
+        float dc_i = 0;
+        float dc_q = 0;
+        float c_i = 0; // Q' = c_i I + c_q Q
+        float c_q = 1;
+    };
+
+    struct moments_t {
+        double sum_i = 0;
+        double sum_q = 0;
+        double sum_ii = 0;
+        double sum_qq = 0;
+        double sum_iq = 0;
+    };
+
+    static void correct(float *x, int32_t n, const coefficients_t& c,
+            moments_t *moments);
+    coefficients_t getCoefficients(void) const;
+    void update(const moments_t& m, int32_t n);
+
+    // Only used by the thread calling process()
+    bool initialised = false;
+    double mean_i = 0;
+    double mean_q = 0;
+    double power_i = 0;
+    double power_q = 0;
+    double cross_iq = 0;
+
+    // Published for applyU8()
+    std::atomic<float> dc_i = ATOMIC_VAR_INIT(0.0f);
+    std::atomic<float> dc_q = ATOMIC_VAR_INIT(0.0f);
+    std::atomic<float> c_i = ATOMIC_VAR_INIT(0.0f);
+    std::atomic<float> c_q = ATOMIC_VAR_INIT(1.0f);
+};
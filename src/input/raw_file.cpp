@@ -31,15 +31,32 @@
  */
 
 #include <string>
+#include <cstring>
+#include <cerrno>
 #include <iostream>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
+#include <algorithm>
+
+#if !defined(_WIN32)
+#  include <sys/mman.h>
+#  define HAVE_MMAP
+#endif
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define RAW_FILE_NEON
+#endif
 
 #include "raw_file.h"
+#include "sample_conversion.h"
 
 // For Qt translation if Qt is exisiting
 #ifdef QT_CORE_LIB
@@ -58,11 +75,59 @@ static inline int64_t getMyTime(void)
 
 #define INPUT_FRAMEBUFFERSIZE 8 * 32768
 
+/*
+ * Format converter from n 16-bit words to n floats, the 8-bit formats
+ * are converted by convertInt8().
+ * I and Q are interleaved in the input like in a complex<float>,
+ * so the conversion is the same for every value.
+ */
+
+// Signed 16-bit words, without scaling
+static void convertInt16(const uint8_t *in, float *out, int32_t n, bool bigEndian)
+{
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    const bool swap = not bigEndian;
+#else
+    const bool swap = bigEndian;
+#endif
+    int32_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i w = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+        if (swap) {
+            w = _mm_or_si128(_mm_slli_epi16(w, 8), _mm_srli_epi16(w, 8));
+        }
+        const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16);
+        const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(w, w), 16);
+        _mm_storeu_ps(out + i,     _mm_cvtepi32_ps(lo));
+        _mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(hi));
+    }
+#elif defined(RAW_FILE_NEON)
+    for (; i + 8 <= n; i += 8) {
+        uint8x16_t b = vld1q_u8(in + 2 * i);
+        if (swap) {
+            b = vrev16q_u8(b);
+        }
+        const int16x8_t w = vreinterpretq_s16_u8(b);
+        vst1q_f32(out + i,     vcvtq_f32_s32(vmovl_s16(vget_low_s16(w))));
+        vst1q_f32(out + i + 4, vcvtq_f32_s32(vmovl_s16(vget_high_s16(w))));
+    }
+#endif
+    (void)swap;
+    for (; i < n; i++) {
+        const uint8_t b0 = in[2 * i];
+        const uint8_t b1 = in[2 * i + 1];
+        out[i] = bigEndian ? (float)(int16_t)((b0 << 8) | b1) :
+                             (float)(int16_t)((b1 << 8) | b0);
+    }
+}
+
 CRAWFile::CRAWFile(RadioControllerInterface& radioController,
-        bool throttle, bool rewind) :
+        bool throttle, bool rewind, bool pull) :
     radioController(radioController),
     throttle(throttle),
-    autoRewind(rewind),
+    autoRewind(rewind and not pull),
+    pull(pull),
     fileName(""),
     fileFormat(CRAWFileFormat::Unknown),
     IQByteSize(1),
@@ -74,11 +139,14 @@ CRAWFile::CRAWFile(RadioControllerInterface& radioController,
 CRAWFile::~CRAWFile(void)
 {
     ExitCondition = true;
+    notifyMapped();
     if (readerOK) {
         if (thread.joinable()) {
             thread.join();
         }
 
+        unmapFile();
+
         if (filePointer) {
             fclose(filePointer);
         }
@@ -104,6 +172,8 @@ bool CRAWFile::restart(void)
 
 bool CRAWFile::is_ok()
 {
+    if (pull and endReached)
+        return false;
     return readerOK;
 }
 
@@ -119,7 +189,14 @@ void CRAWFile::reset()
 
 void CRAWFile::rewind()
 {
-    if (filePointer) {
+    if (mappedFile) {
+        mappedRead = 0;
+        mappedReleased = 0;
+        currPos = 0;
+        endReached = false;
+        notifyMapped();
+    }
+    else if (filePointer) {
         fseek(filePointer, 0, SEEK_SET);
         endReached = false;
     }
@@ -157,6 +234,17 @@ CDeviceID CRAWFile::getID()
     return CDeviceID::RAWFILE;
 }
 
+bool CRAWFile::setDeviceParam(DeviceParam param, int value)
+{
+    switch (param) {
+        case DeviceParam::SampleRate:
+            sampleRate = value;
+            return true;
+        default:
+            return false;
+    }
+}
+
 bool ends_with(const std::string& value, const std::string& ending)
 {
     if (ending.size() > value.size()) return false;
@@ -181,7 +269,10 @@ void CRAWFile::setFileName(const std::string& fileName,
     readerOK = true;
     readerPausing = true;
     currPos = 0;
-    thread = std::thread(&CRAWFile::run, this);
+    mapFile();
+    if (not pull) {
+        thread = std::thread(&CRAWFile::run, this);
+    }
 }
 
 void CRAWFile::setFileHandle(int handle, const std::string& fileFormat)
@@ -201,7 +292,10 @@ void CRAWFile::setFileHandle(int handle, const std::string& fileFormat)
     readerOK = true;
     readerPausing = true;
     currPos = 0;
-    thread = std::thread(&CRAWFile::run, this);
+    mapFile();
+    if (not pull) {
+        thread = std::thread(&CRAWFile::run, this);
+    }
 }
 
 std::string CRAWFile::getFileName() const
@@ -215,11 +309,19 @@ int32_t CRAWFile::getSamples(DSPCOMPLEX* V, int32_t size)
     if (filePointer == nullptr)
         return 0;
 
-    while ((int32_t)(SampleBuffer.GetRingBufferReadAvailable()) < IQByteSize * size)
-        if (readerPausing)
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        else
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (mappedFile)
+        return getMappedSamples(V, size);
+
+    if (pull)
+        return pullSamples(V, size);
+
+    // The timeout only bounds each wait, the reader thread signals
+    // the buffer as soon as it writes into it.
+    while (SampleBuffer.waitForData(IQByteSize * size,
+                std::chrono::milliseconds(100)) < IQByteSize * size) {
+        if (ExitCondition)
+            return 0;
+    }
 
     return convertSamples(SampleBuffer, V, size);
 }
@@ -238,9 +340,57 @@ std::vector<DSPCOMPLEX> CRAWFile::getSpectrumSamples(int size)
 
 int32_t CRAWFile::getSamplesToRead(void)
 {
+    // Reading from the file never needs to wait for data to arrive,
+    // only the end of the file limits what can be read
+    if (pull)
+        return endReached ? 0 : INPUT_FRAMEBUFFERSIZE;
+
+    if (mappedFile)
+        return (mappedReleased - mappedRead) / IQByteSize;
+
     return SampleBuffer.GetRingBufferReadAvailable() / 2;
 }
 
+int32_t CRAWFile::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    // Reading from the file directly never waits
+    if (pull)
+        return getSamplesToRead();
+
+    if (mappedFile) {
+        std::unique_lock<std::mutex> lock(mappedMutex);
+        mappedReleasedCond.wait_for(lock, timeout, [&]() {
+                return getSamplesToRead() >= n or ExitCondition; });
+        return getSamplesToRead();
+    }
+
+    SampleBuffer.waitForData(IQByteSize * n, timeout);
+    return getSamplesToRead();
+}
+
+int32_t CRAWFile::pullSamples(DSPCOMPLEX *V, int32_t size)
+{
+    if (endReached)
+        return 0;
+
+    const int32_t length = IQByteSize * size;
+    pullBuffer.resize(length);
+
+    int32_t n = fread(pullBuffer.data(), sizeof(uint8_t), length, filePointer);
+    currPos += n;
+    if (n < length) {
+        radioController.onMessage(message_level_t::Information, QT_TRANSLATE_NOOP("CRadioController", "End of file"));
+        endReached = true;
+    }
+
+    n -= n % IQByteSize;
+    SpectrumSampleBuffer.putDataIntoBuffer(pullBuffer.data(), n);
+    putIntoRecordBuffer(*pullBuffer.data(), n);
+
+    convertSamples(pullBuffer.data(), n, V);
+    return n / IQByteSize;
+}
+
 void CRAWFile::run(void)
 {
     int32_t t;
@@ -251,9 +401,14 @@ void CRAWFile::run(void)
     if (!readerOK)
         return;
 
+    if (mappedFile) {
+        runMapped();
+        return;
+    }
+
     ExitCondition = false;
 
-    period = (32768 * 1000) / (IQByteSize * 2048); // full IQs read
+    period = ((int64_t)32768 * 1000000) / (IQByteSize * sampleRate); // full IQs read
 
     std::clog << "RAWFile" << "Period =" << period << std::endl;
     std::vector<uint8_t> bi(bufferSize);
@@ -289,6 +444,187 @@ void CRAWFile::run(void)
     std::clog << "RAWFile:" <<  "Read threads ends" << std::endl;
 }
 
+bool CRAWFile::mapFile(void)
+{
+#if defined(HAVE_MMAP)
+    if (fileFormat == CRAWFileFormat::Unknown)
+        return false;
+
+    // Only regular files read from their beginning can be mapped,
+    // pipes and devices go through the reader thread and fread.
+    const int fd = fileno(filePointer);
+    struct stat st;
+    if (fstat(fd, &st) != 0 or not S_ISREG(st.st_mode) or
+            ftell(filePointer) != 0) {
+        return false;
+    }
+
+    const int64_t size = st.st_size - st.st_size % IQByteSize;
+    if (size == 0)
+        return false;
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        std::clog << "RAWFile: Cannot map file, using read: " <<
+            strerror(errno) << std::endl;
+        return false;
+    }
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    mappedFile = static_cast<const uint8_t*>(data);
+    mappedSize = size;
+    mappedRead = 0;
+    mappedReleased = 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void CRAWFile::unmapFile(void)
+{
+#if defined(HAVE_MMAP)
+    if (mappedFile) {
+        munmap(const_cast<uint8_t*>(mappedFile), mappedSize);
+        mappedFile = nullptr;
+        mappedSize = 0;
+    }
+#endif
+}
+
+const uint8_t *CRAWFile::mappedData(int64_t pos, int64_t& length) const
+{
+    if (autoRewind)
+        pos %= mappedSize;
+    else if (pos >= mappedSize)
+        return nullptr;
+
+    length = std::min(length, mappedSize - pos);
+    return mappedFile + pos;
+}
+
+int32_t CRAWFile::getMappedSamples(DSPCOMPLEX *V, int32_t size)
+{
+    int64_t length = (int64_t)IQByteSize * size;
+    const int64_t pos = mappedRead;
+
+    if (pull) {
+        if (endReached)
+            return 0;
+
+        if (length >= mappedSize - pos) {
+            length = mappedSize - pos;
+            radioController.onMessage(message_level_t::Information, QT_TRANSLATE_NOOP("CRadioController", "End of file"));
+            endReached = true;
+        }
+
+        uint8_t *data = const_cast<uint8_t*>(mappedFile + pos);
+        SpectrumSampleBuffer.putDataIntoBuffer(data, length);
+        putIntoRecordBuffer(*data, length);
+    }
+    else {
+        std::unique_lock<std::mutex> lock(mappedMutex);
+        mappedReleasedCond.wait(lock, [&]() {
+                return mappedReleased - pos >= length or ExitCondition; });
+        if (mappedReleased - pos < length)
+            return 0;
+    }
+
+    // Convert directly from the mapping, in pieces if the file wraps around.
+    // Past the end of a file that is not rewound, the samples are zero.
+    for (int64_t done = 0; done < length; ) {
+        int64_t n = length - done;
+        const uint8_t *data = mappedData(pos + done, n);
+        DSPCOMPLEX *out = V + done / IQByteSize;
+        if (data) {
+            convertSamples(data, n, out);
+        }
+        else {
+            std::fill(out, out + n / IQByteSize, DSPCOMPLEX(0, 0));
+        }
+        done += n;
+    }
+
+    mappedRead = pos + length;
+    currPos += length;
+    return length / IQByteSize;
+}
+
+void CRAWFile::notifyMapped(void)
+{
+    // Taking the lock orders the update of mappedReleased before the
+    // wakeup, so that a waiter cannot miss it between check and wait.
+    { std::lock_guard<std::mutex> lock(mappedMutex); }
+    mappedReleasedCond.notify_all();
+}
+
+/*
+ *	The file is already in memory, the reader thread only makes
+ *	it available to getSamples() at the rate of the input, and
+ *	feeds the spectrum and record buffers.
+ */
+void CRAWFile::runMapped(void)
+{
+    const int32_t bufferSize = 32768;
+    const int32_t period = ((int64_t)bufferSize * 1000000) / (IQByteSize * sampleRate);
+
+    ExitCondition = false;
+
+    int64_t nextStop = getMyTime();
+    while (!ExitCondition) {
+        if (readerPausing) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            nextStop = getMyTime();
+            continue;
+        }
+
+        // Do not get further ahead of the receiver than the
+        // sample buffer would allow.
+        while (mappedReleased - mappedRead > INPUT_FRAMEBUFFERSIZE - bufferSize) {
+            if (ExitCondition)
+                break;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        nextStop += period;
+        const int64_t pos = mappedReleased;
+
+        for (int64_t done = 0; done < bufferSize; ) {
+            int64_t n = bufferSize - done;
+            uint8_t *data = const_cast<uint8_t*>(mappedData(pos + done, n));
+            if (data == nullptr)
+                break;
+            SpectrumSampleBuffer.putDataIntoBuffer(data, n);
+            putIntoRecordBuffer(*data, n);
+            done += n;
+        }
+
+        // rewind() may have reset the position meanwhile
+        int64_t expected = pos;
+        if (not mappedReleased.compare_exchange_strong(expected, pos + bufferSize))
+            continue;
+        notifyMapped();
+
+        if ((pos + bufferSize) / mappedSize > pos / mappedSize) {
+            if (autoRewind) {
+                std::clog << "RAWFile:"  << "End of file, restarting" << std::endl;
+                radioController.onMessage(message_level_t::Information,
+                        QT_TRANSLATE_NOOP("CRadioController", "End of file, restarting"));
+            }
+            else if (not endReached) {
+                radioController.onMessage(message_level_t::Information, QT_TRANSLATE_NOOP("CRadioController", "End of file"));
+                endReached = true;
+            }
+        }
+
+        int64_t t_to_wait = nextStop - getMyTime();
+        if (throttle and t_to_wait > 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(t_to_wait));
+    }
+
+    std::clog << "RAWFile:" <<  "Read threads ends" << std::endl;
+}
+
 /*
  *	length is number of uints that we read.
  */
@@ -330,38 +666,40 @@ int32_t CRAWFile::convertSamples(RingBufferBase<uint8_t>& Buffer, DSPCOMPLEX *V,
 
     int32_t amount = Buffer.getDataFromBuffer(temp, IQByteSize * size);
 
-    // Unsigned 8-bit
-    if (fileFormat == CRAWFileFormat::U8) {
-        for (int i = 0; i < amount / 2; i++)
-            V[i] = DSPCOMPLEX(float(temp[2 * i] - 128) / 128.0,
-                              float(temp[2 * i + 1] - 128) / 128.0);
-    }
-    // Signed 8-bit
-    else if (fileFormat == CRAWFileFormat::S8) {
-        for (int i = 0; i < amount / 2; i++)
-            V[i] = DSPCOMPLEX(float((int8_t)temp[2 * i]) / 128.0,
-                              float((int8_t)temp[2 * i + 1]) / 128.0);
-    }
-    // Signed 16-bit little endian
-    else if (fileFormat == CRAWFileFormat::S16LE) {
-        for (int i = 0, j = 0; i < amount / 4; i++, j+= IQByteSize) {
-            int16_t IQ_I = (int16_t)(temp[j + 0] << 8) | temp[j + 1];
-            int16_t IQ_Q = (int16_t)(temp[j + 2] << 8) | temp[j + 3];
-            V[i] = DSPCOMPLEX((float)(IQ_I), (float)(IQ_Q));
-        }
-    }
-    // Signed 16-bit big endian
-    else if (fileFormat == CRAWFileFormat::S16BE) {
-        for (int i = 0, j = 0; i < amount / 4; i++, j += IQByteSize) {
-            int16_t IQ_I = (int16_t)(temp[j + 1] << 8) | temp[j + 0];
-            int16_t IQ_Q = (int16_t)(temp[j + 3] << 8) | temp[j + 2];
-            V[i] = DSPCOMPLEX((float)(IQ_I), (float)(IQ_Q));
-        }
-    }
+    convertSamples(temp, amount, V);
 
     return amount / IQByteSize;
 }
 
+//	amount is in bytes
+void CRAWFile::convertSamples(const uint8_t *temp, int32_t amount, DSPCOMPLEX *V)
+{
+    float *out = reinterpret_cast<float*>(V);
+
+    switch (fileFormat) {
+        // Native endianness complex<float>
+        case CRAWFileFormat::COMPLEXF:
+            memcpy(V, temp, amount);
+            break;
+        case CRAWFileFormat::U8:
+            convertInt8(temp, out, amount, false);
+            break;
+        case CRAWFileFormat::S8:
+            convertInt8(temp, out, amount, true);
+            break;
+        // Note that s16le files are read with the most significant
+        // byte first, and s16be files with the least significant byte first
+        case CRAWFileFormat::S16LE:
+            convertInt16(temp, out, amount / 2, true);
+            break;
+        case CRAWFileFormat::S16BE:
+            convertInt16(temp, out, amount / 2, false);
+            break;
+        case CRAWFileFormat::Unknown:
+            break;
+    }
+}
+
 void CRAWFile::setFileFormat(const std::string &fileFormat)
 {
     if (fileFormat == "u8" or
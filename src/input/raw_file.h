@@ -35,6 +35,8 @@
 
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 #include "virtual_input.h"
 #include "dab-constants.h"
@@ -46,9 +48,18 @@ enum class CRAWFileFormat {U8, S8, S16LE, S16BE, COMPLEXF, Unknown};
 
 class CRAWFile : public CVirtualInput {
 public:
+    /* With pull set, no reader thread is started: getSamples() reads
+     * from the file directly, so that the file is decoded as fast as
+     * the receiver can process it. is_ok() becomes false at the end of
+     * the file. throttle and rewind are ignored in that mode.
+     *
+     * Regular files are memory-mapped when possible, and getSamples()
+     * converts the samples directly from the mapping. The reader thread
+     * then only paces how much of the file is made available. */
     CRAWFile(RadioControllerInterface& radioController,
             bool throttle = true,
-            bool rewind = true);
+            bool rewind = true,
+            bool pull = false);
     ~CRAWFile(void);
 
     // Interface methods
@@ -57,6 +68,7 @@ public:
     int32_t getSamples(DSPCOMPLEX*, int32_t);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    int32_t waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     bool restart(void);
     bool is_ok(void);
     void stop(void);
@@ -68,6 +80,7 @@ public:
     void setAgc(bool AGC);
     std::string getDescription(void);
     CDeviceID getID(void);
+    bool setDeviceParam(DeviceParam param, int value);
 
     // Specific methods
     void setFileName(const std::string& FileName, const std::string& FileFormat);
@@ -76,17 +89,32 @@ public:
 
     bool endWasReached() const { return endReached; }
 
+    // Number of IQ samples read from the file so far
+    int64_t getSamplesRead() const { return currPos / IQByteSize; }
+
 private:
     RadioControllerInterface& radioController;
     bool throttle;
     bool autoRewind;
+    bool pull;
     std::string fileName;
     CRAWFileFormat fileFormat;
     uint8_t IQByteSize;
+    // Used to throttle the reading
+    int sampleRate = INPUT_RATE;
 
     void run(void);
     int32_t readBuffer(uint8_t*, int32_t);
     int32_t convertSamples(RingBufferBase<uint8_t>& Buffer, DSPCOMPLEX* V, int32_t size);
+    void convertSamples(const uint8_t *data, int32_t amount, DSPCOMPLEX* V);
+    int32_t pullSamples(DSPCOMPLEX* V, int32_t size);
+
+    bool mapFile(void);
+    void unmapFile(void);
+    void runMapped(void);
+    const uint8_t *mappedData(int64_t pos, int64_t& length) const;
+    int32_t getMappedSamples(DSPCOMPLEX* V, int32_t size);
+    void notifyMapped(void);
     void setFileFormat(const std::string& fileFormat);
 
     IQRingBuffer<uint8_t> SampleBuffer;
@@ -94,9 +122,20 @@ private:
     FILE* filePointer = nullptr;
     bool readerOK = false;
     bool readerPausing = false;
-    bool endReached = false;
+    std::atomic<bool> endReached = ATOMIC_VAR_INIT(false);
     std::atomic<bool> ExitCondition = ATOMIC_VAR_INIT(false);
-    int64_t currPos = 0;
+    std::atomic<int64_t> currPos = ATOMIC_VAR_INIT(0);
+    std::vector<uint8_t> pullBuffer;
+
+    // The mapped file, truncated to a multiple of IQByteSize. The positions
+    // are in bytes and keep increasing when the file is rewound.
+    const uint8_t *mappedFile = nullptr;
+    int64_t mappedSize = 0;
+    std::atomic<int64_t> mappedReleased = ATOMIC_VAR_INIT(0);
+    std::atomic<int64_t> mappedRead = ATOMIC_VAR_INIT(0);
+    // Signalled whenever mappedReleased changes or the reader exits
+    std::mutex mappedMutex;
+    std::condition_variable mappedReleasedCond;
 
     std::thread thread;
 };
@@ -310,12 +310,8 @@ int32_t CRTL_SDR::getSamples(DSPCOMPLEX *buffer, int32_t size)
 
     int32_t amount = sampleBuffer.getDataFromBuffer(tempBuffer.data(), 2 * size);
 
-    // Normalise samples
-    for (int i = 0; i < amount / 2; i++) {
-        buffer[i] = DSPCOMPLEX(
-                (float(tempBuffer[2 * i] - 128)) / 128.0,
-                (float(tempBuffer[2 * i + 1] - 128)) / 128.0);
-    }
+    // Normalise samples, and remove DC offset and IQ imbalance
+    iqCorrection.processU8(tempBuffer.data(), buffer, amount / 2);
 
     return amount / 2;
 }
@@ -330,12 +326,9 @@ std::vector<DSPCOMPLEX> CRTL_SDR::getSpectrumSamples(int size)
 
     std::vector<DSPCOMPLEX> buffer(amount / 2);
 
-    // Convert samples into generic format
-    for (int i = 0; i < amount / 2; i++) {
-        buffer[i] = DSPCOMPLEX(
-                (float(tempBuffer[2 * i] - 128)) / 128.0,
-                (float(tempBuffer[2 * i + 1] - 128)) / 128.0);
-    }
+    // Convert samples into generic format, with the same correction
+    // as the samples given to the receiver
+    iqCorrection.applyU8(tempBuffer.data(), buffer.data(), amount / 2);
 
     return buffer;
 }
@@ -345,6 +338,11 @@ int32_t CRTL_SDR::getSamplesToRead(void)
     return sampleBuffer.GetRingBufferReadAvailable() / 2;
 }
 
+int32_t CRTL_SDR::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return sampleBuffer.waitForData(2 * n, timeout) / 2;
+}
+
 void CRTL_SDR::reset(void)
 {
     sampleBuffer.FlushRingBuffer();
@@ -43,6 +43,7 @@
 #include "dab-constants.h"
 #include "MathHelper.h"
 #include "ringbuffer.h"
+#include "iq_correction.h"
 #include "radio-controller.h"
 
 // This class is a simple wrapper around the
@@ -61,6 +62,7 @@ public:
     int32_t getSamples(DSPCOMPLEX *buffer, int32_t size);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    int32_t waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     void setFrequency(int Frequency);
     int getFrequency(void) const;
     float getGain(void) const;
@@ -96,6 +98,7 @@ private:
 
     IQRingBuffer<uint8_t> sampleBuffer;
     RingBuffer<uint8_t> spectrumSampleBuffer;
+    IQCorrection iqCorrection;
     struct rtlsdr_dev *device = nullptr;
     int32_t sampleCounter = 0;
 
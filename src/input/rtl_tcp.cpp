@@ -134,30 +134,36 @@ void CRTL_TCP_Client::stop(void)
     }
 }
 
+// Only the samples for the receiver update the correction, the spectrum
+// samples get the same correction.
 static int32_t read_convert_from_buffer(
-        RingBufferBase<uint8_t>& buffer,
-        DSPCOMPLEX *v, int32_t size)
+        RingBufferBase<uint8_t>& buffer, IQCorrection& iqCorrection,
+        bool update, DSPCOMPLEX *v, int32_t size)
 {
-    int32_t amount, i;
+    int32_t amount;
     std::vector<uint8_t> tempBuffer(2 * size);
 
     // Get data from the ring buffer
     amount = buffer.getDataFromBuffer(tempBuffer.data(), 2 * size);
-    for (i = 0; i < amount / 2; i ++)
-        v[i] = DSPCOMPLEX(((float)tempBuffer[2 * i] - 128.0f) / 128.0f,
-                          ((float)tempBuffer[2 * i + 1] - 128.0f) / 128.0f);
+    if (update) {
+        iqCorrection.processU8(tempBuffer.data(), v, amount / 2);
+    }
+    else {
+        iqCorrection.applyU8(tempBuffer.data(), v, amount / 2);
+    }
     return amount / 2;
 }
 
 int32_t CRTL_TCP_Client::getSamples(DSPCOMPLEX *v, int32_t size)
 {
-    return read_convert_from_buffer(sampleBuffer, v, size);
+    return read_convert_from_buffer(sampleBuffer, iqCorrection, true, v, size);
 }
 
 std::vector<DSPCOMPLEX> CRTL_TCP_Client::getSpectrumSamples(int size)
 {
     std::vector<DSPCOMPLEX> buffer(size);
-    int sizeRead = read_convert_from_buffer(spectrumSampleBuffer, buffer.data(), size);
+    int sizeRead = read_convert_from_buffer(spectrumSampleBuffer, iqCorrection,
+            false, buffer.data(), size);
     if (sizeRead < size) {
         buffer.resize(sizeRead);
     }
@@ -169,6 +175,11 @@ int32_t CRTL_TCP_Client::getSamplesToRead(void)
     return sampleBuffer.GetRingBufferReadAvailable () / 2;
 }
 
+int32_t CRTL_TCP_Client::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return sampleBuffer.waitForData(2 * n, timeout) / 2;
+}
+
 void CRTL_TCP_Client::reset(void)
 {
     sampleBuffer.FlushRingBuffer();
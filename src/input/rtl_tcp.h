@@ -42,6 +42,7 @@
 #include "dab-constants.h"
 #include "MathHelper.h"
 #include "ringbuffer.h"
+#include "iq_correction.h"
 #include "radio-controller.h"
 
 struct dongle_info_t { /* structure size must be multiple of 2 bytes */
@@ -63,6 +64,7 @@ public:
     int32_t getSamples(DSPCOMPLEX* V, int32_t size);
     std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     int32_t getSamplesToRead(void);
+    int32_t waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     void reset(void);
     float getGain(void) const;
     float setGain(int gain);
@@ -99,6 +101,7 @@ private:
     int frequency = kHz(220000);
     IQRingBuffer<uint8_t> sampleBuffer;
     RingBuffer<uint8_t> spectrumSampleBuffer;
+    IQCorrection iqCorrection;
     bool connected = false;
     bool rtlsdrRunning = false;
     std::string serverAddress = "127.0.0.1";
@@ -0,0 +1,172 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "sample_conversion.h"
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#  define SAMPLE_CONVERSION_NEON
+#endif
+
+// The value of the signed byte b ^ offset
+static inline float scale(uint8_t b, uint8_t offset)
+{
+    return float((int8_t)(b ^ offset)) / 128.0f;
+}
+
+static void convertScalar(const uint8_t *in, float *out, int32_t n, uint8_t offset)
+{
+    for (int32_t i = 0; i < n; i++) {
+        out[i] = scale(in[i], offset);
+    }
+}
+
+static void convertSIMD(const uint8_t *in, float *out, int32_t n, uint8_t offset)
+{
+    int32_t i = 0;
+#if defined(__SSE2__)
+    const __m128i flip = _mm_set1_epi8((char)offset);
+    const __m128 scale = _mm_set1_ps(1.0f / 128.0f);
+    for (; i + 16 <= n; i += 16) {
+        // xor with 0x80 maps unsigned to signed values
+        const __m128i b = _mm_xor_si128(
+                _mm_loadu_si128((const __m128i*)(in + i)), flip);
+        // Sign-extend by placing the bytes in the upper half and shifting
+        const __m128i lo16 = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+        const __m128i hi16 = _mm_srai_epi16(_mm_unpackhi_epi8(b, b), 8);
+        const __m128i w0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo16, lo16), 16);
+        const __m128i w1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo16, lo16), 16);
+        const __m128i w2 = _mm_srai_epi32(_mm_unpacklo_epi16(hi16, hi16), 16);
+        const __m128i w3 = _mm_srai_epi32(_mm_unpackhi_epi16(hi16, hi16), 16);
+        _mm_storeu_ps(out + i,      _mm_mul_ps(_mm_cvtepi32_ps(w0), scale));
+        _mm_storeu_ps(out + i + 4,  _mm_mul_ps(_mm_cvtepi32_ps(w1), scale));
+        _mm_storeu_ps(out + i + 8,  _mm_mul_ps(_mm_cvtepi32_ps(w2), scale));
+        _mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(w3), scale));
+    }
+#elif defined(SAMPLE_CONVERSION_NEON)
+    const int8x16_t flip = vdupq_n_s8((int8_t)offset);
+    for (; i + 16 <= n; i += 16) {
+        const int8x16_t b = veorq_s8(vreinterpretq_s8_u8(vld1q_u8(in + i)), flip);
+        const int16x8_t lo16 = vmovl_s8(vget_low_s8(b));
+        const int16x8_t hi16 = vmovl_s8(vget_high_s8(b));
+        vst1q_f32(out + i,      vcvtq_n_f32_s32(vmovl_s16(vget_low_s16(lo16)), 7));
+        vst1q_f32(out + i + 4,  vcvtq_n_f32_s32(vmovl_s16(vget_high_s16(lo16)), 7));
+        vst1q_f32(out + i + 8,  vcvtq_n_f32_s32(vmovl_s16(vget_low_s16(hi16)), 7));
+        vst1q_f32(out + i + 12, vcvtq_n_f32_s32(vmovl_s16(vget_high_s16(hi16)), 7));
+    }
+#endif
+    convertScalar(in + i, out + i, n - i, offset);
+}
+
+/* When the compiler vectorises the arithmetic, e.g. with -O3, the explicit
+ * SIMD code is no faster, and can be slower. With -O2 it is about four
+ * times faster. Auto therefore times both once, on a block of the size the
+ * callers convert at a time, and keeps the faster one. */
+static Int8Conversion fastestConversion()
+{
+#if defined(__SSE2__) || defined(SAMPLE_CONVERSION_NEON)
+    static const Int8Conversion fastest = []() {
+        // Volatile, so that the compiler cannot specialise the conversions
+        // for constants, which is not what the callers get
+        volatile int32_t blockSize = 4096;
+        volatile uint8_t unsignedOffset = 0x80;
+        const int32_t n = blockSize;
+        std::vector<uint8_t> in(n);
+        for (int32_t i = 0; i < n; i++) {
+            in[i] = i * 97;
+        }
+        std::vector<float> out(n);
+        volatile float sink = 0;
+
+        using namespace std::chrono;
+        auto timeOf = [&](void (*convert)(const uint8_t*, float*, int32_t, uint8_t)) {
+            auto best = steady_clock::duration::max();
+            for (int round = 0; round < 8; round++) {
+                const auto start = steady_clock::now();
+                for (int i = 0; i < 16; i++) {
+                    convert(in.data(), out.data(), blockSize, unsignedOffset);
+                    sink = sink + out[i];
+                }
+                best = std::min(best, steady_clock::now() - start);
+            }
+            return best;
+        };
+
+        // Once to warm up the caches
+        timeOf(convertScalar);
+        return timeOf(convertSIMD) < timeOf(convertScalar) ?
+            Int8Conversion::SIMD : Int8Conversion::Scalar;
+    }();
+    return fastest;
+#else
+    return Int8Conversion::Scalar;
+#endif
+}
+
+void convertInt8(const uint8_t *in, float *out, int32_t n, bool isSigned,
+        Int8Conversion conversion)
+{
+    const uint8_t offset = isSigned ? 0 : 0x80;
+    switch (conversion) {
+        case Int8Conversion::Scalar:
+            convertScalar(in, out, n, offset);
+            break;
+        case Int8Conversion::SIMD:
+            convertSIMD(in, out, n, offset);
+            break;
+        case Int8Conversion::Auto:
+            if (fastestConversion() == Int8Conversion::SIMD) {
+                convertSIMD(in, out, n, offset);
+            }
+            else {
+                convertScalar(in, out, n, offset);
+            }
+            break;
+    }
+}
+
+const char *int8ConversionName(Int8Conversion conversion)
+{
+    switch (conversion) {
+        case Int8Conversion::Auto:
+            return fastestConversion() == Int8Conversion::SIMD ?
+                "Auto (SIMD)" : "Auto (Scalar)";
+        case Int8Conversion::Scalar: return "Scalar";
+        case Int8Conversion::SIMD:
+#if defined(__SSE2__)
+            return "SSE2";
+#elif defined(SAMPLE_CONVERSION_NEON)
+            return "NEON";
+#else
+            return "Scalar";
+#endif
+    }
+    return "Unknown";
+}
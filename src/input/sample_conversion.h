@@ -0,0 +1,46 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/* Conversion of the 8-bit samples of the RTL-SDR, rtl_tcp and IQ files
+ * to the floats of a DSPCOMPLEX, scaled to [-1, 1). I and Q are
+ * interleaved in the input like in a complex<float>, so the conversion
+ * is the same for every value. */
+
+enum class Int8Conversion {
+    Auto,      // Whichever of Scalar and SIMD is faster here
+    Scalar,    // Arithmetic on every value, which the compiler may vectorise
+    SIMD,      // SSE2 or NEON widening, Scalar if neither is available
+};
+
+/* Convert the n bytes in to n floats. Unsigned bytes are offset by 128,
+ * like those of the RTL-SDR. */
+void convertInt8(const uint8_t *in, float *out, int32_t n, bool isSigned,
+        Int8Conversion conversion = Int8Conversion::Auto);
+
+const char *int8ConversionName(Int8Conversion conversion);
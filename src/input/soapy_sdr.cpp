@@ -105,7 +105,7 @@ bool CSoapySdr::restart()
     std::clog << "SoapySDR master clock rate set to " <<
         m_device->getMasterClockRate()/1000.0 << " kHz" << std::endl;
 
-    m_device->setSampleRate(SOAPY_SDR_RX, 0, INPUT_RATE);
+    m_device->setSampleRate(SOAPY_SDR_RX, 0, m_sampleRate);
     std::clog << "OutputSoapySDR:Actual RX rate: " <<
         m_device->getSampleRate(SOAPY_SDR_RX, 0) / 1000.0 <<
         " ksps." << std::endl;
@@ -199,6 +199,11 @@ int32_t CSoapySdr::getSamplesToRead()
     return m_sampleBuffer.GetRingBufferReadAvailable();
 }
 
+int32_t CSoapySdr::waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+{
+    return m_sampleBuffer.waitForData(n, timeout);
+}
+
 float CSoapySdr::getGain() const
 {
     if (m_device != nullptr) {
@@ -322,6 +327,14 @@ CDeviceID CSoapySdr::getID()
     return CDeviceID::SOAPYSDR;
 }
 
+bool CSoapySdr::setDeviceParam(DeviceParam param, int value)
+{
+    switch(param) {
+        case DeviceParam::SampleRate: m_sampleRate = value; return true;
+        default: return false;
+    }
+}
+
 bool CSoapySdr::setDeviceParam(DeviceParam param, const std::string& value)
 {
     switch(param) {
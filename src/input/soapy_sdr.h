@@ -54,12 +54,14 @@ public:
     virtual int32_t getSamples(DSPCOMPLEX* Buffer, int32_t Size);
     virtual std::vector<DSPCOMPLEX> getSpectrumSamples(int size);
     virtual int32_t getSamplesToRead(void);
+    virtual int32_t waitForSamples(int32_t n, std::chrono::milliseconds timeout);
     virtual float setGain(int gainIndex);
     virtual float getGain(void) const;
     virtual int getGainCount(void);
     virtual void setAgc(bool AGC);
     virtual std::string getDescription(void);
     virtual CDeviceID getID(void);
+    virtual bool setDeviceParam(DeviceParam param, int value);
     virtual bool setDeviceParam(DeviceParam param, const std::string& value);
 
 private:
@@ -71,6 +73,7 @@ private:
 
     RadioControllerInterface& radioController;
     int m_freq = 0;
+    int m_sampleRate = INPUT_RATE;
     std::string m_driver_args;
     std::string m_antenna;
     std::string m_clock_source;
@@ -36,6 +36,7 @@
 
 #include "radio-receiver.h"
 #include "raw_file.h"
+#include "MathHelper.h"
 
 class TestRadioInterface : public RadioControllerInterface {
     public:
@@ -58,6 +59,34 @@ class TestRadioInterface : public RadioControllerInterface {
         virtual void onTIIMeasurement(tii_measurement_t&& m) override { (void)m; }
 };
 
+// Records the FIB given to the per-bit callback
+class BitFIBRadioInterface : public TestRadioInterface {
+    public:
+        std::vector<uint8_t> fib;
+
+        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override {
+            (void)crcCheckOk;
+            this->fib.assign(fib, fib + 256);
+        }
+};
+
+// Records the FIB given to the packed callback
+class PackedFIBRadioInterface : public TestRadioInterface {
+    public:
+        std::vector<uint8_t> fib;
+        bool bitCallbackCalled = false;
+
+        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override {
+            (void)crcCheckOk; (void)fib;
+            bitCallbackCalled = true;
+        }
+
+        virtual void onFIBDecodeSuccessPacked(bool crcCheckOk, const uint8_t* fib) override {
+            (void)crcCheckOk;
+            this->fib.assign(fib, fib + 32);
+        }
+};
+
 class TestProgrammeHandler: public ProgrammeHandlerInterface {
 
 public:
@@ -93,6 +122,9 @@ private slots:
     void cleanupTestCase() {}
     void testTuneToService();
     void testDLS();
+    void testFIBDecodeSuccessUnpacked();
+    void testFIBDecodeSuccessPacked();
+    void testGetBits();
 
 private:
     void runRadio(const std::string &rawFileName,
@@ -192,6 +224,66 @@ void BackendTests::testDLS()
     QCOMPARE(isOK, true);
 }
 
+static std::vector<uint8_t> randomBytes(size_t n)
+{
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<int> dist(0, 255);
+    std::vector<uint8_t> bytes(n);
+    for (auto& b : bytes) {
+        b = dist(gen);
+    }
+    return bytes;
+}
+
+void BackendTests::testFIBDecodeSuccessUnpacked()
+{
+    // The default packed callback unpacks the FIB for the per-bit one
+    const auto packed = randomBytes(32);
+    BitFIBRadioInterface ri;
+    ri.onFIBDecodeSuccessPacked(true, packed.data());
+
+    QCOMPARE(ri.fib.size(), (size_t)256);
+    for (int i = 0; i < 256; i++) {
+        QCOMPARE((int)ri.fib[i], (packed[i / 8] >> (7 - i % 8)) & 1);
+    }
+}
+
+void BackendTests::testFIBDecodeSuccessPacked()
+{
+    const auto packed = randomBytes(32);
+    PackedFIBRadioInterface ri;
+    ri.onFIBDecodeSuccessPacked(true, packed.data());
+
+    QVERIFY(ri.fib == packed);
+    QCOMPARE(ri.bitCallbackCalled, false);
+}
+
+void BackendTests::testGetBits()
+{
+    // Compare with the previous reader, which took one bit per byte.
+    // getBits reads up to 8 bytes beyond the field.
+    const int numBytes = 32;
+    const auto packed = randomBytes(numBytes + 8);
+    std::vector<uint8_t> bits(8 * numBytes);
+    for (size_t i = 0; i < bits.size(); i++) {
+        bits[i] = (packed[i / 8] >> (7 - i % 8)) & 1;
+    }
+
+    for (int size = 0; size <= 32; size++) {
+        for (int offset = 0; offset + size <= 8 * numBytes; offset++) {
+            uint32_t expected = 0;
+            for (int i = 0; i < size; i++) {
+                expected = (expected << 1) | bits[offset + i];
+            }
+            QCOMPARE(getBits(packed.data(), offset, size), expected);
+        }
+    }
+
+    for (int offset = 0; offset < 8 * numBytes; offset++) {
+        QCOMPARE((uint32_t)getBits_1(packed.data(), offset), (uint32_t)bits[offset]);
+    }
+}
+
 QTEST_APPLESS_MAIN(BackendTests)
 
 #include "backend_tests.moc"
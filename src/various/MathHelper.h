@@ -35,6 +35,8 @@
 
 #include <complex>
 #include <cstring>
+#include <cstdint>
+#include <stdexcept>
 
 #define Hz(x) (x)
 #define kHz(x) (x * 1000)
@@ -101,122 +103,75 @@ static inline bool check_crc_bytes(const uint8_t *msg, int len)
     return (crc ^ accumulator) == 0;
 }
 
+/* The FIB data is packed into bytes, most significant bit first. getBits
+ * reads size bits (at most 32) at the bit offset with one unaligned load
+ * of the 64-bit window starting at the byte that contains offset. The
+ * buffer must therefore extend 8 bytes beyond the last field read. */
 static inline uint32_t getBits(const uint8_t* d, int16_t offset, uint8_t size)
 {
     if (size > 32) {
         throw std::logic_error("getBits called with size>32");
     }
+    else if (size == 0) {
+        // Shifting the window by 64 is undefined
+        return 0;
+    }
 
-    uint32_t res = 0;
-
-    for (int i = 0; i < size; i++) {
-        res <<= 1;
-        res |= d[offset + i];
+    const uint8_t *p = d + offset / 8;
+    uint64_t window;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&window, p, sizeof(window));
+    window = __builtin_bswap64(window);
+#elif defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(&window, p, sizeof(window));
+#else
+    window = 0;
+    for (int i = 0; i < 8; i++) {
+        window = (window << 8) | p[i];
     }
-    return res;
+#endif
+
+    return (window << (offset % 8)) >> (64 - size);
 }
 
 static inline uint16_t getBits_1(const uint8_t* d, int16_t offset)
 {
-    return (d[offset] & 0x01);
+    return (d[offset / 8] >> (7 - offset % 8)) & 0x01;
 }
 
 static inline uint16_t getBits_2(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    return res;
+    return getBits(d, offset, 2);
 }
 
 static inline uint16_t getBits_3(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    return res;
+    return getBits(d, offset, 3);
 }
 
 static inline uint16_t getBits_4(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    return res;
+    return getBits(d, offset, 4);
 }
 
 static inline uint16_t getBits_5(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    res <<= 1;
-    res |= d[offset + 4];
-    return res;
+    return getBits(d, offset, 5);
 }
 
 static inline uint16_t getBits_6(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    res <<= 1;
-    res |= d[offset + 4];
-    res <<= 1;
-    res |= d[offset + 5];
-    return res;
+    return getBits(d, offset, 6);
 }
 
 static inline uint16_t getBits_7(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    res <<= 1;
-    res |= d[offset + 4];
-    res <<= 1;
-    res |= d[offset + 5];
-    res <<= 1;
-    res |= d[offset + 6];
-    return res;
+    return getBits(d, offset, 7);
 }
 
 static inline uint16_t getBits_8(const uint8_t* d, int16_t offset)
 {
-    uint16_t res = d[offset];
-    res <<= 1;
-    res |= d[offset + 1];
-    res <<= 1;
-    res |= d[offset + 2];
-    res <<= 1;
-    res |= d[offset + 3];
-    res <<= 1;
-    res |= d[offset + 4];
-    res <<= 1;
-    res |= d[offset + 5];
-    res <<= 1;
-    res |= d[offset + 6];
-    res <<= 1;
-    res |= d[offset + 7];
-    return res;
+    return getBits(d, offset, 8);
 }
 
 #endif // MATHHELPER_H
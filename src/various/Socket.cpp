@@ -109,6 +109,20 @@ ssize_t Socket::send(const void *buffer, size_t length, int flags)
     return ::send(sock, (const char*)buffer, length, flags);
 }
 
+bool Socket::set_nonblocking()
+{
+#if defined(_WIN32)
+    unsigned long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    const int flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1) {
+        return false;
+    }
+    return fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
 bool Socket::bind(int port)
 {
     if (valid()) {
@@ -153,7 +167,7 @@ bool Socket::bind(int port)
 
 bool Socket::listen()
 {
-    const int listen_ret = ::listen(sock, 1);
+    const int listen_ret = ::listen(sock, SOMAXCONN);
     if (listen_ret == -1) {
         perror("Could not listen");
         return false;
@@ -167,7 +181,10 @@ Socket Socket::accept()
     socklen_t remote_addr_len = sizeof(remote_addr);
     int conn = ::accept(sock, (sockaddr*)&remote_addr, &remote_addr_len);
     if (conn == -1) {
-        if (errno == ECONNABORTED) {
+        // Running out of file descriptors is left to the caller,
+        // which finds errno unchanged
+        if (errno == ECONNABORTED or errno == EAGAIN or errno == EWOULDBLOCK or
+                errno == EMFILE or errno == ENFILE) {
             return {};
         }
         perror("accept failed");
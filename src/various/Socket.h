@@ -78,6 +78,12 @@ class Socket {
         ssize_t recv(void *buffer, size_t length, int flags);
         ssize_t send(const void *buffer, size_t length, int flags);
 
+        // Make recv, send and accept return -1 with errno set to
+        // EAGAIN or EWOULDBLOCK instead of blocking
+        bool set_nonblocking();
+
+        int native_handle() const { return sock; }
+
     private:
         int sock = INVALID_SOCKET;
 };
@@ -27,23 +27,72 @@
  */
 #include    "fft.h"
 #include    <cstring>
+#include    <iostream>
+#include    <map>
+#include    <mutex>
+#include    <stdexcept>
+#include    <utility>
 
 namespace fft {
 
+/* The plans are never destroyed. Threads can still be executing them
+ * while the process exits, e.g. through exit() after an input failure,
+ * which must not free them during static destruction. */
+
+// Protects the plans, and the FFTW planner which is not thread-safe
+static std::mutex& plans_mutex = *new std::mutex;
+
 #ifndef KISSFFT
+static auto& plans = *new std::map<std::pair<int32_t, int>, FFTW_PLAN>;
+static std::string& wisdom_filename = *new std::string;
+
+bool use_wisdom_file(const std::string& filename)
+{
+    std::lock_guard<std::mutex> lock(plans_mutex);
+    wisdom_filename = filename;
+    return fftwf_import_wisdom_from_filename(filename.c_str()) != 0;
+}
+
+static FFTW_PLAN get_plan(int32_t fft_size, int sign)
+{
+    std::lock_guard<std::mutex> lock(plans_mutex);
+    const auto key = std::make_pair(fft_size, sign);
+    const auto it = plans.find(key);
+    if (it != plans.end()) {
+        return it->second;
+    }
+
+    // The plan gets executed in-place on other vectors. They have the same
+    // alignment because they all come from FFTW_MALLOC. Measuring
+    // overwrites the array, which is therefore a temporary one.
+    auto *tmp = (fftwf_complex*)FFTW_MALLOC(sizeof(fftwf_complex) * fft_size);
+    const unsigned flags = wisdom_filename.empty() ? FFTW_ESTIMATE : FFTW_MEASURE;
+    FFTW_PLAN plan = FFTW_PLAN_DFT_1D(fft_size, tmp, tmp, sign, flags);
+    FFTW_FREE(tmp);
+
+    if (plan == nullptr) {
+        throw std::runtime_error("Cannot create FFT plan of size " +
+                std::to_string(fft_size));
+    }
+    plans[key] = plan;
+
+    if (not wisdom_filename.empty() and
+            fftwf_export_wisdom_to_filename(wisdom_filename.c_str()) == 0) {
+        std::clog << "Cannot save FFTW wisdom to " << wisdom_filename << std::endl;
+    }
+
+    return plan;
+}
+
 Forward::Forward(int32_t fft_size)
 {
     vector = (DSPCOMPLEX *)FFTW_MALLOC(sizeof (DSPCOMPLEX) * fft_size);
     memset((void*)vector, 0, sizeof(DSPCOMPLEX) * fft_size);
-    plan  = FFTW_PLAN_DFT_1D(fft_size,
-            reinterpret_cast<fftwf_complex*>(vector),
-            reinterpret_cast<fftwf_complex*>(vector),
-            FFTW_FORWARD, FFTW_ESTIMATE);
+    plan = get_plan(fft_size, FFTW_FORWARD);
 }
 
 Forward::~Forward()
 {
-    FFTW_DESTROY_PLAN(plan);
     FFTW_FREE(vector);
 }
 
@@ -54,7 +103,9 @@ DSPCOMPLEX* Forward::getVector()
 
 void Forward::do_FFT()
 {
-    FFTW_EXECUTE (plan);
+    FFTW_EXECUTE_DFT(plan,
+            reinterpret_cast<fftwf_complex*>(vector),
+            reinterpret_cast<fftwf_complex*>(vector));
 }
 
 Backward::Backward(int32_t fft_size) :
@@ -64,15 +115,11 @@ Backward::Backward(int32_t fft_size) :
     for (int i = 0; i < fft_size; i ++) {
         vector [i] = 0;
     }
-    plan  = FFTW_PLAN_DFT_1D(fft_size,
-            reinterpret_cast<fftwf_complex*>(vector),
-            reinterpret_cast<fftwf_complex*>(vector),
-            FFTW_BACKWARD, FFTW_ESTIMATE);
+    plan = get_plan(fft_size, FFTW_BACKWARD);
 }
 
 Backward::~Backward ()
 {
-    FFTW_DESTROY_PLAN(plan);
     FFTW_FREE(vector);
 }
 
@@ -83,7 +130,9 @@ DSPCOMPLEX* Backward::getVector()
 
 void Backward::do_IFFT()
 {
-    FFTW_EXECUTE(plan);
+    FFTW_EXECUTE_DFT(plan,
+            reinterpret_cast<fftwf_complex*>(vector),
+            reinterpret_cast<fftwf_complex*>(vector));
 
     const DSPFLOAT factor = 1.0 / DSPFLOAT(fft_size);
 
@@ -95,10 +144,35 @@ void Backward::do_IFFT()
 
 #else // Kiss FFT
 
+static auto& plans = *new std::map<std::pair<int32_t, int>, kiss_fft_cfg>;
+
+bool use_wisdom_file(const std::string&)
+{
+    return false;
+}
+
+static kiss_fft_cfg get_plan(int32_t fft_size, int inverse)
+{
+    std::lock_guard<std::mutex> lock(plans_mutex);
+    const auto key = std::make_pair(fft_size, inverse);
+    const auto it = plans.find(key);
+    if (it != plans.end()) {
+        return it->second;
+    }
+
+    kiss_fft_cfg cfg = kiss_fft_alloc(fft_size, inverse, NULL, NULL);
+    if (cfg == nullptr) {
+        throw std::runtime_error("Cannot create FFT plan of size " +
+                std::to_string(fft_size));
+    }
+    plans[key] = cfg;
+    return cfg;
+}
+
 Forward::Forward(int32_t fft_size) :
     fft_size(fft_size)
 {
-    cfg = kiss_fft_alloc(fft_size, 0, NULL, NULL);
+    cfg = get_plan(fft_size, 0);
 
     fin = (DSPCOMPLEX*)malloc(fft_size * sizeof(DSPCOMPLEX));
     fout = (DSPCOMPLEX*)malloc(fft_size * sizeof(DSPCOMPLEX));
@@ -109,7 +183,6 @@ Forward::Forward(int32_t fft_size) :
 
 Forward::~Forward()
 {
-    free(cfg);
     free(fin);
     free(fout);
 }
@@ -128,7 +201,7 @@ void Forward::do_FFT()
 Backward::Backward(int32_t fft_size) :
     fft_size(fft_size)
 {
-    cfg = kiss_fft_alloc(fft_size, 1, NULL, NULL);
+    cfg = get_plan(fft_size, 1);
 
     fin = (DSPCOMPLEX*)malloc(fft_size * sizeof(DSPCOMPLEX));
     fout = (DSPCOMPLEX*)malloc(fft_size * sizeof(DSPCOMPLEX));
@@ -139,7 +212,6 @@ Backward::Backward(int32_t fft_size) :
 
 Backward::~Backward()
 {
-    free(cfg);
     free(fin);
     free(fout);
 }
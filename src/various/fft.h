@@ -31,10 +31,21 @@
 #define _COMMON_FFT
 
 // Wrappers around fftwf and KISS FFT for both forward and backward FFTs
+#include <string>
 #include "dab-constants.h"
 
 namespace fft {
 
+/* The plans are shared by all instances of the same size and direction,
+ * and kept until the end of the process, so that creating an instance
+ * only allocates its vector.
+ *
+ * With FFTW, the plans can additionally be stored as wisdom in filename.
+ * It gets loaded if it exists, new plans are measured instead of estimated
+ * and saved to the file. Returns false if the file could not be loaded.
+ * With KISS FFT, this does nothing and returns false. */
+bool use_wisdom_file(const std::string& filename);
+
 #ifndef KISSFFT
 #  define FFTW_MALLOC     fftwf_malloc
 #  define FFTW_PLAN_DFT_1D    fftwf_plan_dft_1d
@@ -42,6 +53,7 @@ namespace fft {
 #  define FFTW_FREE       fftwf_free
 #  define FFTW_PLAN       fftwf_plan
 #  define FFTW_EXECUTE        fftwf_execute
+#  define FFTW_EXECUTE_DFT    fftwf_execute_dft
 #  include <fftw3.h>
 
 class Forward {
@@ -55,6 +67,7 @@ class Forward {
 
     private:
         DSPCOMPLEX *vector;
+        // Shared, executed on vector with the new-array interface
         FFTW_PLAN plan;
 };
 
@@ -71,6 +84,7 @@ class Backward
     private:
         int32_t fft_size;
         DSPCOMPLEX *vector;
+        // Shared, executed on vector with the new-array interface
         FFTW_PLAN plan;
 };
 
@@ -90,6 +104,7 @@ class Forward
     private:
         int32_t fft_size;
 
+        // Shared, read-only
         kiss_fft_cfg cfg;
         DSPCOMPLEX *fin;
         DSPCOMPLEX *fout;
@@ -108,6 +123,7 @@ class Backward
     private:
         int32_t fft_size;
 
+        // Shared, read-only
         kiss_fft_cfg cfg;
         DSPCOMPLEX *fin;
         DSPCOMPLEX *fout;
@@ -0,0 +1,102 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#pragma once
+
+/* Counters the decoding threads update without taking locks, so that they
+ * can be read for monitoring at any time. Unlike the profiler, they are
+ * always enabled, and cost a few relaxed atomic operations per frame. */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <time.h>
+
+// CPU time used so far by the calling thread, 0 where this is unsupported
+inline uint64_t thread_cputime_ns()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+#endif
+    return 0;
+}
+
+/* Histogram with fixed upper bounds. Only one thread may observe values,
+ * any thread can take a snapshot. The snapshot is not atomic as a whole,
+ * which is acceptable for monitoring. */
+class AtomicHistogram {
+    public:
+        struct snapshot_t {
+            std::vector<double> bounds;
+            // Number of values below or equal each bound, and then the total
+            std::vector<uint64_t> cumulative_counts;
+            double sum = 0;
+        };
+
+        explicit AtomicHistogram(const std::vector<double>& bounds) :
+            bounds(bounds),
+            counts(new std::atomic<uint64_t>[bounds.size() + 1])
+        {
+            for (size_t i = 0; i <= bounds.size(); i++) {
+                counts[i] = 0;
+            }
+        }
+
+        AtomicHistogram(const AtomicHistogram&) = delete;
+        AtomicHistogram& operator=(const AtomicHistogram&) = delete;
+
+        void observe(double value) {
+            size_t i = 0;
+            while (i < bounds.size() and value > bounds[i]) {
+                i++;
+            }
+            counts[i].fetch_add(1, std::memory_order_relaxed);
+
+            // There is only one writer
+            sum.store(sum.load(std::memory_order_relaxed) + value,
+                    std::memory_order_relaxed);
+        }
+
+        snapshot_t snapshot() const {
+            snapshot_t s;
+            s.bounds = bounds;
+            uint64_t total = 0;
+            for (size_t i = 0; i <= bounds.size(); i++) {
+                total += counts[i].load(std::memory_order_relaxed);
+                s.cumulative_counts.push_back(total);
+            }
+            s.sum = sum.load(std::memory_order_relaxed);
+            return s;
+        }
+
+    private:
+        const std::vector<double> bounds;
+        std::unique_ptr<std::atomic<uint64_t>[]> counts;
+        std::atomic<double> sum = ATOMIC_VAR_INIT(0.0);
+};
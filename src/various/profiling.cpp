@@ -48,10 +48,12 @@ const char* mark_to_cstr(const ProfilingMark& m) {
         MARK_TO_CSTR_CASE(SyncOnPhase)
         MARK_TO_CSTR_CASE(FindIndex)
         MARK_TO_CSTR_CASE(DataSymbols)
-        MARK_TO_CSTR_CASE(PushAllSymbols)
+        MARK_TO_CSTR_CASE(PushFrame)
         MARK_TO_CSTR_CASE(OnNewNull)
         MARK_TO_CSTR_CASE(DecodeTII)
 
+        MARK_TO_CSTR_CASE(ParallelFFT)
+        MARK_TO_CSTR_CASE(ParallelFFTDone)
         MARK_TO_CSTR_CASE(ProcessPRS)
         MARK_TO_CSTR_CASE(ProcessSymbol)
         MARK_TO_CSTR_CASE(Deinterleaver)
@@ -141,6 +143,13 @@ Profiler::~Profiler() {
     profiling << "cputime,diff," << stop_time_cputime - startup_time_cputime << endl;
     profiling << "monotonic,diff," << stop_time_monotonic - startup_time_monotonic << endl;
     profiling << "frames,decoded," << num_frames_decoded << endl;
+    if (num_latencies > 0) {
+        using ms = chrono::duration<double, milli>;
+        profiling << "framelatency,mean_ms," <<
+            chrono::duration_cast<ms>(latency_sum).count() / num_latencies << endl;
+        profiling << "framelatency,max_ms," <<
+            chrono::duration_cast<ms>(latency_max).count() << endl;
+    }
 
     // See http://www.graphviz.org/documentation/
     ofstream graph("profiling.dot");
@@ -201,4 +210,13 @@ void Profiler::frame_decoded() {
     num_frames_decoded++;
 }
 
+void Profiler::frame_latency(chrono::steady_clock::duration latency) {
+    lock_guard<mutex> lock(m_mutex);
+    num_latencies++;
+    latency_sum += latency;
+    if (latency > latency_max) {
+        latency_max = latency;
+    }
+}
+
 #endif // defined(WITH_PROFILING)
@@ -32,20 +32,27 @@
 #include <unordered_map>
 #include <thread>
 #include <mutex>
+#include <chrono>
 
 #define PROFILE(m) get_profiler().save_time(ProfilingMark::m)
 #define PROFILE_FRAME_DECODED() get_profiler().frame_decoded()
 
+// Measure the wall-clock time the OfdmDecoder takes for one frame
+#define PROFILE_LATENCY_START(t) const auto t = std::chrono::steady_clock::now()
+#define PROFILE_LATENCY_END(t) get_profiler().frame_latency(std::chrono::steady_clock::now() - t)
+
 enum class ProfilingMark {
     NotSynced,
     SyncOnEndNull,
     SyncOnPhase,
     FindIndex,
     DataSymbols,
-    PushAllSymbols,
+    PushFrame,
     OnNewNull,
     DecodeTII,
 
+    ParallelFFT,
+    ParallelFFTDone,
     ProcessPRS,
     ProcessSymbol,
     Deinterleaver,
@@ -82,6 +89,7 @@ class Profiler
 
         void save_time(const ProfilingMark m);
         void frame_decoded();
+        void frame_latency(std::chrono::steady_clock::duration latency);
     private:
         std::mutex m_mutex;
         std::unordered_map<
@@ -91,6 +99,10 @@ class Profiler
         struct timespec startup_time_cputime;
         struct timespec startup_time_monotonic;
         size_t num_frames_decoded = 0;
+
+        size_t num_latencies = 0;
+        std::chrono::steady_clock::duration latency_sum = std::chrono::steady_clock::duration::zero();
+        std::chrono::steady_clock::duration latency_max = std::chrono::steady_clock::duration::zero();
 };
 
 Profiler& get_profiler(void);
@@ -98,5 +110,7 @@ Profiler& get_profiler(void);
 #else
 # define PROFILE(m)
 # define PROFILE_FRAME_DECODED()
+# define PROFILE_LATENCY_START(t)
+# define PROFILE_LATENCY_END(t)
 #endif // defined(WITH_PROFILING)
 
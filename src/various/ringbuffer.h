@@ -75,6 +75,9 @@
 #include    <string.h>
 #include    <stdint.h>
 #include    <iostream>
+#include    <chrono>
+#include    <condition_variable>
+#include    <mutex>
 
 /*
  *  a simple ringbuffer, lockfree, however only for a
@@ -131,7 +134,8 @@
 template <class elementtype>
 class RingBufferBase;
 
-// Ring buffer for IQ input
+// Ring buffer for IQ input. The reader can wait for data instead of
+// polling, the writer wakes it up whenever it puts data into the buffer.
 template <class elementtype>
 class IQRingBuffer : public RingBufferBase<elementtype> {
 public:
@@ -141,6 +145,32 @@ public:
         (void) droppedElements;
         //std::clog << "IQRingBuffer: Dropped " << droppedElements * sizeof(elementtype) << " bytes" << std::endl;;
     }
+
+    int32_t putDataIntoBuffer (const void *data, int32_t elementCount) {
+        const int32_t numWritten =
+            RingBufferBase<elementtype>::putDataIntoBuffer(data, elementCount);
+
+        //  The reader checks the buffer with the mutex held, taking it
+        //  here ensures that it is either waiting or sees the new data.
+        { std::lock_guard<std::mutex> lock(waitMutex); }
+        dataAvailable.notify_one();
+        return numWritten;
+    }
+
+    /*
+     *  Wait until at least elementCount elements can be read, or until
+     *  the timeout expires. Returns the number of elements available.
+     */
+    int32_t waitForData (int32_t elementCount, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(waitMutex);
+        dataAvailable.wait_for(lock, timeout, [&]() {
+                return this->GetRingBufferReadAvailable() >= elementCount; });
+        return this->GetRingBufferReadAvailable();
+    }
+
+private:
+    std::mutex waitMutex;
+    std::condition_variable dataAvailable;
 };
 
 // Fallback
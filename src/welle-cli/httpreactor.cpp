@@ -0,0 +1,684 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <poll.h>
+#if defined(__linux__)
+# include <sys/epoll.h>
+#endif
+#include "welle-cli/httpreactor.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace std;
+
+const int HttpReactor::keepalive_timeout;
+const int HttpReactor::send_timeout;
+
+// Requests with larger headers or bodies are refused
+static const size_t max_header_size = 16 * 1024;
+static const size_t max_body_size = 1024 * 1024;
+
+HttpStream::HttpStream(size_t max_queue_length) :
+    max_queue_length(max_queue_length)
+{
+}
+
+bool HttpStream::push(const data_t& data)
+{
+    unique_lock<std::mutex> lock(mutex);
+    if (closed) {
+        return false;
+    }
+
+    if (queue.size() >= max_queue_length) {
+        num_dropped++;
+        return true;
+    }
+
+    // The reactor takes all data at once, it only needs to be
+    // woken up for the first element.
+    const bool was_empty = queue.empty();
+    queue.push_back(data);
+    if (was_empty and notify) {
+        notify();
+    }
+    return true;
+}
+
+void HttpStream::close()
+{
+    unique_lock<std::mutex> lock(mutex);
+    if (not closed) {
+        closed = true;
+        queue.clear();
+        if (notify) {
+            notify();
+        }
+    }
+}
+
+HttpStream::stats_t HttpStream::get_stats()
+{
+    unique_lock<std::mutex> lock(mutex);
+    stats_t stats;
+    stats.queued = queue.size();
+    stats.dropped = num_dropped;
+    return stats;
+}
+
+bool HttpStream::pop_all(deque<data_t>& out)
+{
+    unique_lock<std::mutex> lock(mutex);
+    for (auto& d : queue) {
+        out.push_back(move(d));
+    }
+    queue.clear();
+    return not closed;
+}
+
+void HttpStream::set_notify(function<void()>&& n)
+{
+    unique_lock<std::mutex> lock(mutex);
+    notify = move(n);
+}
+
+static string to_lower(string s)
+{
+    transform(s.begin(), s.end(), s.begin(),
+            [](unsigned char c) { return tolower(c); });
+    return s;
+}
+
+static string trim(const string& s)
+{
+    const auto first = s.find_first_not_of(" \t");
+    if (first == string::npos) {
+        return "";
+    }
+    const auto last = s.find_last_not_of(" \t");
+    return s.substr(first, last - first + 1);
+}
+
+enum class ParseResult { Incomplete, Complete, Invalid };
+
+// Parse one request from the start of buf, and remove it from buf
+static ParseResult parse_request(string& buf, HttpRequest& req)
+{
+    const auto header_end = buf.find("\r\n\r\n");
+    if (header_end == string::npos) {
+        return buf.size() > max_header_size ?
+            ParseResult::Invalid : ParseResult::Incomplete;
+    }
+
+    size_t pos = buf.find("\r\n");
+    const string request_line = buf.substr(0, pos);
+
+    const auto sp1 = request_line.find(' ');
+    const auto sp2 = request_line.rfind(' ');
+    if (sp1 == string::npos or sp1 == sp2) {
+        cerr << "Malformed request: " << request_line << endl;
+        return ParseResult::Invalid;
+    }
+
+    req.method = request_line.substr(0, sp1);
+    req.url = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+    req.version = request_line.substr(sp2 + 1);
+    req.headers.clear();
+
+    while (pos < header_end) {
+        const size_t line_start = pos + 2;
+        pos = buf.find("\r\n", line_start);
+        const string line = buf.substr(line_start, pos - line_start);
+        const auto colon = line.find(':');
+        if (colon != string::npos) {
+            req.headers[to_lower(trim(line.substr(0, colon)))] =
+                trim(line.substr(colon + 1));
+        }
+    }
+
+    size_t content_length = 0;
+    const auto cl = req.headers.find("content-length");
+    if (cl != req.headers.end()) {
+        try {
+            content_length = stoul(cl->second);
+        }
+        catch (const exception&) {
+            cerr << "Cannot parse Content-Length: " << cl->second << endl;
+            return ParseResult::Invalid;
+        }
+
+        if (content_length > max_body_size) {
+            cerr << "Unreasonable Content-Length: " << content_length << endl;
+            return ParseResult::Invalid;
+        }
+    }
+
+    const size_t body_start = header_end + 4;
+    if (buf.size() < body_start + content_length) {
+        return ParseResult::Incomplete;
+    }
+
+    req.body = buf.substr(body_start, content_length);
+    buf.erase(0, body_start + content_length);
+    return ParseResult::Complete;
+}
+
+static bool wants_keepalive(const HttpRequest& req)
+{
+    const auto it = req.headers.find("connection");
+    const string connection = (it == req.headers.end()) ? "" : to_lower(it->second);
+
+    if (req.version == "HTTP/1.1") {
+        return connection != "close";
+    }
+    return connection == "keep-alive";
+}
+
+HttpReactor::HttpReactor(Socket& serverSocket, const handler_t& handler) :
+    serverSocket(serverSocket),
+    handler(handler)
+{
+    if (::pipe(wakeup_pipe) == -1) {
+        throw runtime_error(string("HttpReactor: cannot create pipe: ") + strerror(errno));
+    }
+    for (int fd : wakeup_pipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+#if defined(__linux__)
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        throw runtime_error(string("HttpReactor: epoll_create1 failed: ") + strerror(errno));
+    }
+#endif
+
+    if (not serverSocket.set_nonblocking()) {
+        throw runtime_error("HttpReactor: cannot make server socket non-blocking");
+    }
+
+    poll_add(serverSocket.native_handle(), listen_id);
+    poll_add(wakeup_pipe[0], wakeup_id);
+}
+
+HttpReactor::~HttpReactor()
+{
+    while (not connections.empty()) {
+        close_connection(connections.begin()->first);
+    }
+
+    if (epoll_fd != -1) {
+        ::close(epoll_fd);
+    }
+    ::close(wakeup_pipe[0]);
+    ::close(wakeup_pipe[1]);
+}
+
+void HttpReactor::poll_add(int fd, connection_id id)
+{
+#if defined(__linux__)
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        cerr << "HttpReactor: epoll_ctl ADD failed: " << strerror(errno) << endl;
+    }
+#else
+    poll_fds[fd] = make_pair(id, false);
+#endif
+}
+
+void HttpReactor::poll_remove(int fd)
+{
+#if defined(__linux__)
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+#else
+    poll_fds.erase(fd);
+#endif
+}
+
+void HttpReactor::poll_set_writable(int fd, connection_id id, bool writable)
+{
+#if defined(__linux__)
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN | (writable ? EPOLLOUT : 0);
+    ev.data.u64 = id;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        cerr << "HttpReactor: epoll_ctl MOD failed: " << strerror(errno) << endl;
+    }
+#else
+    poll_fds[fd] = make_pair(id, writable);
+#endif
+}
+
+void HttpReactor::notify(connection_id id)
+{
+    bool was_empty = false;
+    {
+        lock_guard<mutex> lock(notify_mutex);
+        was_empty = notified.empty();
+        notified.push_back(id);
+    }
+
+    if (was_empty) {
+        const char c = 0;
+        if (::write(wakeup_pipe[1], &c, 1) == -1 and errno != EAGAIN) {
+            cerr << "HttpReactor: cannot wake up: " << strerror(errno) << endl;
+        }
+    }
+}
+
+void HttpReactor::run(const function<bool()>& keep_running)
+{
+    struct event_t {
+        connection_id id;
+        bool readable;
+        bool writable;
+        bool error;
+    };
+    vector<event_t> events;
+
+#if defined(__linux__)
+    vector<struct epoll_event> epoll_events(64);
+#else
+    vector<struct pollfd> pfds;
+    vector<connection_id> pfd_ids;
+#endif
+
+    while (keep_running()) {
+        events.clear();
+
+#if defined(__linux__)
+        const int n = epoll_wait(epoll_fd, epoll_events.data(), epoll_events.size(), 1000);
+        for (int i = 0; i < n; i++) {
+            const auto e = epoll_events[i].events;
+            events.push_back({epoll_events[i].data.u64,
+                    (e & EPOLLIN) != 0, (e & EPOLLOUT) != 0,
+                    (e & (EPOLLERR | EPOLLHUP)) != 0});
+        }
+#else
+        pfds.clear();
+        pfd_ids.clear();
+        for (const auto& fd : poll_fds) {
+            struct pollfd pfd = {};
+            pfd.fd = fd.first;
+            pfd.events = POLLIN | (fd.second.second ? POLLOUT : 0);
+            pfds.push_back(pfd);
+            pfd_ids.push_back(fd.second.first);
+        }
+
+        const int n = ::poll(pfds.data(), pfds.size(), 1000);
+        for (size_t i = 0; n > 0 and i < pfds.size(); i++) {
+            const auto e = pfds[i].revents;
+            if (e) {
+                events.push_back({pfd_ids[i],
+                        (e & POLLIN) != 0, (e & POLLOUT) != 0,
+                        (e & (POLLERR | POLLHUP | POLLNVAL)) != 0});
+            }
+        }
+#endif
+
+        if (n == -1 and errno != EINTR) {
+            cerr << "HttpReactor: wait failed: " << strerror(errno) << endl;
+        }
+
+        for (const auto& ev : events) {
+            if (ev.id == listen_id) {
+                accept_clients();
+            }
+            else if (ev.id == wakeup_id) {
+                handle_wakeup();
+            }
+            else {
+                auto it = connections.find(ev.id);
+                if (it == connections.end()) {
+                    continue;
+                }
+
+                if (ev.readable or ev.error) {
+                    // Reading also detects errors and the end of the connection
+                    handle_readable(ev.id, it->second);
+                    it = connections.find(ev.id);
+                    if (it == connections.end()) {
+                        continue;
+                    }
+                }
+
+                if (ev.writable) {
+                    flush(ev.id, it->second);
+                    it = connections.find(ev.id);
+                    if (it == connections.end()) {
+                        continue;
+                    }
+
+                    // Pipelined requests wait until the previous
+                    // response is sent
+                    process_requests(ev.id, it->second);
+                }
+            }
+        }
+
+        close_idle_connections();
+    }
+}
+
+void HttpReactor::accept_clients()
+{
+    while (true) {
+        Socket client = serverSocket.accept();
+        if (not client.valid()) {
+            if (errno == EMFILE or errno == ENFILE) {
+                pause_accepting();
+            }
+            else if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                // All waiting clients were accepted
+                fd_exhaustion_logged = false;
+            }
+            return;
+        }
+
+        if (not client.set_nonblocking()) {
+            cerr << "HttpReactor: cannot make client socket non-blocking" << endl;
+            continue;
+        }
+
+        const connection_id id = next_id++;
+        const int fd = client.native_handle();
+        auto& c = connections[id];
+        c.sock = move(client);
+        c.last_activity = chrono::steady_clock::now();
+        poll_add(fd, id);
+    }
+}
+
+void HttpReactor::pause_accepting()
+{
+    if (not fd_exhaustion_logged) {
+        cerr << "HttpReactor: cannot accept clients: " << strerror(errno) << endl;
+        fd_exhaustion_logged = true;
+    }
+
+    poll_remove(serverSocket.native_handle());
+    accept_paused = true;
+    accept_resume_time = chrono::steady_clock::now() + chrono::seconds(1);
+}
+
+void HttpReactor::resume_accepting()
+{
+    if (accept_paused) {
+        accept_paused = false;
+        poll_add(serverSocket.native_handle(), listen_id);
+    }
+}
+
+void HttpReactor::handle_wakeup()
+{
+    char buf[64];
+    while (::read(wakeup_pipe[0], buf, sizeof(buf)) > 0) {
+    }
+
+    vector<connection_id> ids;
+    {
+        lock_guard<mutex> lock(notify_mutex);
+        swap(ids, notified);
+    }
+
+    for (const auto id : ids) {
+        auto it = connections.find(id);
+        // When data is still being sent, the stream is taken up
+        // again once that is done.
+        if (it != connections.end() and it->second.out.empty()) {
+            flush(id, it->second);
+        }
+    }
+}
+
+void HttpReactor::handle_readable(connection_id id, Connection& c)
+{
+    char buf[4096];
+    while (true) {
+        const ssize_t ret = c.sock.recv(buf, sizeof(buf), 0);
+        if (ret > 0) {
+            // Clients of streams are not expected to send anything more
+            if (not c.stream) {
+                c.in.append(buf, ret);
+                if (c.in.size() > max_header_size + max_body_size) {
+                    cerr << "HttpReactor: client sends too much data" << endl;
+                    close_connection(id);
+                    return;
+                }
+            }
+        }
+        else if (ret == 0) {
+            close_connection(id);
+            return;
+        }
+        else if (errno == EAGAIN or errno == EWOULDBLOCK) {
+            break;
+        }
+        else if (errno != EINTR) {
+            close_connection(id);
+            return;
+        }
+    }
+
+    process_requests(id, c);
+}
+
+void HttpReactor::process_requests(connection_id id, Connection& c)
+{
+    // Requests are answered in order, one at a time, and nothing more gets
+    // read once the connection is to be closed or streams data.
+    while (not c.stream and not c.close_after_send and
+            c.out.empty() and not c.in.empty()) {
+        HttpRequest req;
+        const auto result = parse_request(c.in, req);
+        if (result == ParseResult::Incomplete) {
+            break;
+        }
+        else if (result == ParseResult::Invalid) {
+            HttpResponse resp;
+            resp.status = "400 Bad Request";
+            resp.headers = "Content-Type: text/plain\r\n";
+            resp.body = "400 Bad Request\r\n";
+            c.close_after_send = true;
+            send_response(id, c, req, move(resp));
+            return;
+        }
+
+        c.last_activity = chrono::steady_clock::now();
+        c.close_after_send = not wants_keepalive(req);
+
+        HttpResponse resp;
+        try {
+            resp = handler(req);
+        }
+        catch (const exception& e) {
+            cerr << "HttpReactor: handler failed: " << e.what() << endl;
+            resp = HttpResponse();
+            resp.status = "500 Internal Server Error";
+            resp.headers = "Content-Type: text/plain\r\n";
+            resp.body = e.what();
+            c.close_after_send = true;
+        }
+
+        send_response(id, c, req, move(resp));
+        if (connections.count(id) == 0) {
+            return;
+        }
+    }
+}
+
+void HttpReactor::send_response(connection_id id, Connection& c,
+        const HttpRequest& req, HttpResponse&& resp)
+{
+    string headers = (req.version == "HTTP/1.0" ? "HTTP/1.0 " : "HTTP/1.1 ");
+    headers += resp.status + "\r\n";
+    headers += resp.headers;
+
+    if (resp.stream) {
+        // The stream ends when the connection is closed
+        c.close_after_send = true;
+        headers += "Connection: close\r\n\r\n";
+    }
+    else if (resp.status.compare(0, 3, "304") == 0) {
+        // Has no body, and the headers describe the cached response
+        resp.body.clear();
+        headers += c.close_after_send ?
+            "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+    }
+    else {
+        headers += "Content-Length: " + to_string(resp.body.size()) + "\r\n";
+        headers += c.close_after_send ?
+            "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+    }
+
+    auto data = make_shared<vector<uint8_t> >(headers.begin(), headers.end());
+    data->insert(data->end(), resp.body.begin(), resp.body.end());
+    c.out.push_back(move(data));
+
+    if (resp.stream) {
+        c.stream = move(resp.stream);
+        c.on_close = move(resp.on_close);
+        c.stream->set_notify([this, id]() { notify(id); });
+    }
+
+    flush(id, c);
+}
+
+void HttpReactor::flush(connection_id id, Connection& c)
+{
+    while (true) {
+        while (not c.out.empty()) {
+            const auto& data = *c.out.front();
+            const size_t remain = data.size() - c.out_offset;
+            const ssize_t ret = c.sock.send(data.data() + c.out_offset, remain, MSG_NOSIGNAL);
+
+            if (ret >= 0) {
+                c.last_activity = chrono::steady_clock::now();
+                c.out_offset += ret;
+                if (c.out_offset == data.size()) {
+                    c.out.pop_front();
+                    c.out_offset = 0;
+                }
+            }
+            else if (errno == EAGAIN or errno == EWOULDBLOCK) {
+                if (not c.wants_write) {
+                    c.wants_write = true;
+                    poll_set_writable(c.sock.native_handle(), id, true);
+                }
+                return;
+            }
+            else if (errno != EINTR) {
+                close_connection(id);
+                return;
+            }
+        }
+
+        if (c.wants_write) {
+            c.wants_write = false;
+            poll_set_writable(c.sock.native_handle(), id, false);
+        }
+
+        if (c.stream) {
+            // Take what got queued while the socket was busy
+            if (not c.stream->pop_all(c.out)) {
+                close_connection(id);
+                return;
+            }
+            else if (c.out.empty()) {
+                return;
+            }
+        }
+        else if (c.close_after_send) {
+            close_connection(id);
+            return;
+        }
+        else {
+            return;
+        }
+    }
+}
+
+void HttpReactor::close_connection(connection_id id)
+{
+    auto it = connections.find(id);
+    if (it == connections.end()) {
+        return;
+    }
+
+    auto& c = it->second;
+    poll_remove(c.sock.native_handle());
+    c.sock.close();
+
+    auto stream = move(c.stream);
+    auto on_close = move(c.on_close);
+    connections.erase(it);
+
+    if (stream) {
+        stream->set_notify(nullptr);
+        stream->close();
+    }
+
+    if (on_close) {
+        on_close();
+    }
+
+    resume_accepting();
+}
+
+void HttpReactor::close_idle_connections()
+{
+    const auto now = chrono::steady_clock::now();
+
+    vector<connection_id> to_close;
+    for (const auto& it : connections) {
+        const auto& c = it.second;
+        const auto idle = now - c.last_activity;
+        if (not c.out.empty()) {
+            if (idle > chrono::seconds(send_timeout)) {
+                to_close.push_back(it.first);
+            }
+        }
+        else if (not c.stream and idle > chrono::seconds(keepalive_timeout)) {
+            to_close.push_back(it.first);
+        }
+    }
+
+    for (const auto id : to_close) {
+        close_connection(id);
+    }
+
+    if (accept_paused and now >= accept_resume_time) {
+        resume_accepting();
+    }
+}
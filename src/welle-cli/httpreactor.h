@@ -0,0 +1,192 @@
+/*
+ *    Copyright (C) 2019
+ *    Matthias P. Braendli (matthias.braendli@mpb.li)
+ *
+ *    This file is part of the welle.io.
+ *    Many of the ideas as implemented in welle.io are derived from
+ *    other work, made available through the GNU general Public License.
+ *    All copyrights of the original authors are recognized.
+ *
+ *    welle.io is free software; you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation; either version 2 of the License, or
+ *    (at your option) any later version.
+ *
+ *    welle.io is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with welle.io; if not, write to the Free Software
+ *    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "various/Socket.h"
+
+struct HttpRequest {
+    std::string method;
+    std::string url;
+    std::string version;
+
+    // The header names are converted to lower case
+    std::map<std::string, std::string> headers;
+    std::string body;
+};
+
+/* Data that is sent to one client as it becomes available, e.g. an mp3
+ * stream. Any thread can push data, which never waits for the client.
+ *
+ * The queue is bounded: when the client does not keep up, new data is
+ * dropped. */
+class HttpStream {
+    public:
+        using data_t = std::shared_ptr<const std::vector<uint8_t> >;
+
+        struct stats_t {
+            size_t queued = 0;
+            size_t dropped = 0;
+        };
+
+        explicit HttpStream(size_t max_queue_length);
+        HttpStream(const HttpStream&) = delete;
+        HttpStream& operator=(const HttpStream&) = delete;
+
+        // Returns false once the stream is closed
+        bool push(const data_t& data);
+
+        // End the stream, which closes the connection
+        void close();
+
+        stats_t get_stats();
+
+    private:
+        friend class HttpReactor;
+
+        // Move the queued data to out, returns false if the stream is closed
+        bool pop_all(std::deque<data_t>& out);
+        void set_notify(std::function<void()>&& notify);
+
+        const size_t max_queue_length;
+
+        std::mutex mutex;
+        bool closed = false;
+        std::deque<data_t> queue;
+        size_t num_dropped = 0;
+        std::function<void()> notify;
+};
+
+struct HttpResponse {
+    std::string status = "200 OK";
+
+    // Additional header lines, each terminated by \r\n
+    std::string headers;
+    std::string body;
+
+    // When set, the headers are followed by the data of the stream
+    // instead of the body, until either side closes the connection.
+    std::shared_ptr<HttpStream> stream;
+
+    // Called from the reactor thread once the stream connection is closed
+    std::function<void()> on_close;
+};
+
+/* Serves all HTTP clients from one thread, using non-blocking sockets and
+ * epoll, or poll on systems that lack epoll.
+ *
+ * Connections are kept alive between requests as HTTP/1.1 specifies.
+ * The handler is called in the reactor thread, and has to return quickly.
+ * Streaming responses are fed from other threads through an HttpStream
+ * and sent whenever the socket is writable. */
+class HttpReactor {
+    public:
+        using handler_t = std::function<HttpResponse(const HttpRequest&)>;
+
+        // Idle keep-alive connections get closed after this many seconds
+        static const int keepalive_timeout = 30;
+
+        // Clients that do not accept any data for that long get disconnected
+        static const int send_timeout = 10;
+
+        HttpReactor(Socket& serverSocket, const handler_t& handler);
+        ~HttpReactor();
+        HttpReactor(const HttpReactor&) = delete;
+        HttpReactor& operator=(const HttpReactor&) = delete;
+
+        // Serve clients until keep_running returns false. It is checked
+        // at least once per second, and when a signal interrupts the wait.
+        void run(const std::function<bool()>& keep_running);
+
+    private:
+        using connection_id = uint64_t;
+
+        struct Connection {
+            Socket sock;
+            std::string in;
+            std::deque<HttpStream::data_t> out;
+            size_t out_offset = 0;
+            bool wants_write = false;
+            bool close_after_send = false;
+            std::shared_ptr<HttpStream> stream;
+            std::function<void()> on_close;
+            std::chrono::steady_clock::time_point last_activity;
+        };
+
+        void accept_clients(void);
+        void handle_wakeup(void);
+        void handle_readable(connection_id id, Connection& c);
+        void process_requests(connection_id id, Connection& c);
+        void send_response(connection_id id, Connection& c,
+                const HttpRequest& req, HttpResponse&& resp);
+        // Send the pending data, and take more from the stream when
+        // everything is sent
+        void flush(connection_id id, Connection& c);
+        void close_connection(connection_id id);
+        void close_idle_connections(void);
+
+        // Stop polling the listening socket while the process is out of
+        // file descriptors, which would otherwise keep it readable
+        void pause_accepting(void);
+        void resume_accepting(void);
+
+        void poll_add(int fd, connection_id id);
+        void poll_remove(int fd);
+        void poll_set_writable(int fd, connection_id id, bool writable);
+
+        Socket& serverSocket;
+        handler_t handler;
+
+        // Ids that are not given to connections
+        static const connection_id listen_id = 0;
+        static const connection_id wakeup_id = 1;
+        connection_id next_id = 2;
+        std::unordered_map<connection_id, Connection> connections;
+
+        // Accepting resumes when a connection closes, or after a second
+        // in case the file descriptors are used elsewhere
+        bool accept_paused = false;
+        bool fd_exhaustion_logged = false;
+        std::chrono::steady_clock::time_point accept_resume_time;
+
+        // Streams notify the reactor thread through a pipe
+        int wakeup_pipe[2] = {-1, -1};
+        std::mutex notify_mutex;
+        std::vector<connection_id> notified;
+        void notify(connection_id id);
+
+        int epoll_fd = -1;
+        // Without epoll, the fds to poll and the connection they belong to
+        std::map<int, std::pair<connection_id, bool> > poll_fds;
+};
@@ -32,9 +32,19 @@
 
 #include "tests.h"
 #include "backend/radio-receiver.h"
+#include "backend/viterbi.h"
+#include "backend/fic-handler.h"
+#include "backend/tools.h"
+#include "backend/protection.h"
+#include "backend/protTables.h"
 #include "raw_file.h"
+#include "input/channelizer.h"
+#include "input/halfband_decimator.h"
+#include "input/iq_correction.h"
+#include "input/sample_conversion.h"
 #include "various/profiling.h"
 #include <algorithm>
+#include <chrono>
 #include <numeric>
 #include <random>
 #include <condition_variable>
@@ -100,6 +110,8 @@ class ChannelSimulator : public CVirtualInput
 
         virtual int32_t getSamplesToRead(void)
             { return parentInput->getSamplesToRead(); }
+        virtual int32_t waitForSamples(int32_t n, std::chrono::milliseconds timeout)
+            { return parentInput->waitForSamples(n, timeout); }
 
         virtual float getGain() const
             { return parentInput->getGain(); }
@@ -117,6 +129,47 @@ class ChannelSimulator : public CVirtualInput
             { return parentInput->getDescription() + " with ChannelSimulator"; }
 };
 
+// Input that repeats a precomputed signal as fast as it is read
+class PeriodicSource : public CVirtualInput
+{
+    private:
+        vector<DSPCOMPLEX> period;
+        size_t pos = 0;
+        int frequency = 0;
+
+    public:
+        PeriodicSource(vector<DSPCOMPLEX>&& period) :
+            period(move(period)) {}
+
+        virtual CDeviceID getID(void) { return CDeviceID::NULLDEVICE; }
+        virtual void setFrequency(int frequency) { this->frequency = frequency; }
+        virtual int getFrequency(void) const { return frequency; }
+        virtual bool restart(void) { return true; }
+        virtual bool is_ok(void) { return true; }
+        virtual void stop(void) {}
+        virtual void reset(void) {}
+
+        virtual int32_t getSamples(DSPCOMPLEX* buffer, int32_t size)
+        {
+            for (int32_t i = 0; i < size; ) {
+                const int32_t n = std::min<int32_t>(size - i, period.size() - pos);
+                copy(period.begin() + pos, period.begin() + pos + n, buffer + i);
+                pos = (pos + n) % period.size();
+                i += n;
+            }
+            return size;
+        }
+
+        virtual vector<DSPCOMPLEX> getSpectrumSamples(int size)
+            { return vector<DSPCOMPLEX>(size); }
+        virtual int32_t getSamplesToRead(void) { return period.size(); }
+        virtual float getGain() const { return 0; }
+        virtual float setGain(int gain) { (void)gain; return 0; }
+        virtual int getGainCount(void) { return 0; }
+        virtual void setAgc(bool agc) { (void)agc; }
+        virtual std::string getDescription(void) { return "PeriodicSource"; }
+};
+
 class TestRadioInterface : public RadioControllerInterface {
     private:
         struct FILEDeleter{ void operator()(FILE* fd){ if (fd) fclose(fd); }};
@@ -162,7 +215,7 @@ class TestRadioInterface : public RadioControllerInterface {
         }
 
         virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) override { (void)dateTime; }
-        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override { (void)crcCheckOk; (void)fib; }
+        virtual void onFIBDecodeSuccessPacked(bool crcCheckOk, const uint8_t* fib) override { (void)crcCheckOk; (void)fib; }
         virtual void onNewImpulseResponse(std::vector<float>&& data) override
         {
             if (data.size() != 2048) {
@@ -369,6 +422,490 @@ void Tests::test_multipath(int test_id)
     fclose(fd);
 }
 
+void Tests::test_viterbi_kernels()
+{
+    cerr << "Setup test_viterbi_kernels" << endl;
+
+    // FIC length and the EEP lengths for 8, 64 and 384 kbps
+    const int16_t lengths[] = {768, 24 * 8, 24 * 64, 24 * 384};
+    const int polys[4] = {0155, 0117, 0123, 0155};
+    const int K = 7;
+
+    const ViterbiKernel kernels[] = {
+        ViterbiKernel::SSE2, ViterbiKernel::AVX2, ViterbiKernel::NEON };
+
+    size_t num_failures = 0;
+
+    // All codewords are also decoded together with the batched decoder
+    vector<vector<softbit_t> > batch_input;
+    vector<vector<uint8_t> > batch_reference;
+    vector<const PuncturingScheme*> batch_puncturing;
+
+    // The FIC puncturing, and EEP-A level 1 for the MSC lengths
+    const size_t num_lengths = sizeof(lengths) / sizeof(lengths[0]);
+    vector<PuncturingScheme> schemes(num_lengths);
+    vector<vector<pair<int16_t, const int8_t*> > > scheme_blocks(num_lengths);
+    scheme_blocks[0] = { {21, getPCodes(16 - 1)}, {3, getPCodes(15 - 1)} };
+    for (size_t l = 1; l < num_lengths; l++) {
+        const int16_t bitRate = lengths[l] / 24;
+        scheme_blocks[l] = { {6 * bitRate / 8 - 3, getPCodes(24 - 1)},
+                             {3, getPCodes(23 - 1)} };
+    }
+    for (size_t l = 0; l < num_lengths; l++) {
+        for (const auto& b : scheme_blocks[l]) {
+            schemes[l].addBlocks(b.first, b.second);
+        }
+    }
+
+    for (size_t l = 0; l < num_lengths; l++) {
+        const int16_t len = lengths[l];
+        for (int iteration = 0; iteration < 20; iteration++) {
+            // Encode random data terminated in state 0, then add
+            // increasing amounts of noise. The last iterations
+            // use random softbits to stress renormalisation.
+            vector<uint8_t> bits(len + K - 1, 0);
+            for (int16_t i = 0; i < len; i++) {
+                bits[i] = random_generator() & 1;
+            }
+
+            const double stddev = iteration * 8.0;
+            normal_distribution<> noise(0.0, stddev);
+            const bool random_input = iteration >= 16;
+
+            vector<softbit_t> softbits(RATE * (len + K - 1));
+            int sr = 0;
+            for (size_t i = 0; i < bits.size(); i++) {
+                sr = (sr << 1) | bits[i];
+                for (int k = 0; k < RATE; k++) {
+                    double v = __builtin_parity(sr & polys[k]) ? 127 : -127;
+                    v += noise(random_generator);
+                    if (random_input) {
+                        v = (int)(random_generator() % 256) - 128;
+                    }
+                    softbits[i * RATE + k] = std::max(-127.0, std::min(127.0, v));
+                }
+            }
+
+            vector<uint8_t> reference(len);
+            Viterbi generic(len, ViterbiKernel::Generic);
+            generic.deconvolve(softbits.data(), reference.data());
+
+            if (stddev == 0 and
+                    not std::equal(reference.begin(), reference.end(), bits.begin())) {
+                cerr << "Generic kernel failed to decode clean input of length " <<
+                    len << endl;
+                num_failures++;
+            }
+
+            for (const auto k : kernels) {
+                if (not Viterbi::kernelAvailable(k)) {
+                    continue;
+                }
+
+                vector<uint8_t> output(len);
+                Viterbi v(len, k);
+                v.deconvolve(softbits.data(), output.data());
+
+                if (output != reference) {
+                    cerr << "Kernel " << viterbiKernelToString(k) <<
+                        " differs from generic for length " << len <<
+                        " iteration " << iteration << endl;
+                    num_failures++;
+                }
+            }
+
+            // Puncture the codeword, and decode it both from the punctured
+            // softbits and from the codeword with erased bits set to zero
+            vector<softbit_t> punctured;
+            vector<softbit_t> erased(softbits.size(), 0);
+            size_t ix = 0;
+            for (const auto& b : scheme_blocks[l]) {
+                for (int i = 0; i < 128 * b.first; i++, ix++) {
+                    if (b.second[i % 32]) {
+                        punctured.push_back(softbits[ix]);
+                        erased[ix] = softbits[ix];
+                    }
+                }
+            }
+            for (int i = 0; i < 24; i++, ix++) {
+                if (PI_X[i]) {
+                    punctured.push_back(softbits[ix]);
+                    erased[ix] = softbits[ix];
+                }
+            }
+
+            if ((int32_t)punctured.size() != schemes[l].puncturedBits()) {
+                cerr << "Wrong punctured length " << punctured.size() <<
+                    " for length " << len << endl;
+                num_failures++;
+            }
+
+            vector<uint8_t> punctured_reference(len);
+            generic.deconvolve(erased.data(), punctured_reference.data());
+
+            for (const auto k : {ViterbiKernel::Generic, ViterbiKernel::SSE2,
+                    ViterbiKernel::AVX2, ViterbiKernel::NEON}) {
+                if (not Viterbi::kernelAvailable(k)) {
+                    continue;
+                }
+
+                vector<uint8_t> output(len);
+                Viterbi v(len, k);
+                v.deconvolve(punctured.data(), schemes[l], output.data());
+
+                if (output != punctured_reference) {
+                    cerr << "Kernel " << viterbiKernelToString(k) <<
+                        " fails on punctured input of length " << len <<
+                        " iteration " << iteration << endl;
+                    num_failures++;
+                }
+            }
+
+            batch_input.push_back(move(softbits));
+            batch_reference.push_back(move(reference));
+            batch_puncturing.push_back(nullptr);
+
+            batch_input.push_back(move(punctured));
+            batch_reference.push_back(move(punctured_reference));
+            batch_puncturing.push_back(&schemes[l]);
+        }
+    }
+
+    vector<vector<uint8_t> > batch_output;
+    vector<ViterbiBatch::Job> jobs;
+    for (size_t i = 0; i < batch_input.size(); i++) {
+        batch_output.emplace_back(batch_reference[i].size());
+    }
+    for (size_t i = 0; i < batch_input.size(); i++) {
+        jobs.emplace_back(batch_input[i].data(),
+                batch_reference[i].size(), batch_output[i].data(),
+                batch_puncturing[i]);
+    }
+
+    ViterbiBatch batch;
+    batch.deconvolve(jobs);
+
+    for (size_t i = 0; i < batch_input.size(); i++) {
+        if (batch_output[i] != batch_reference[i]) {
+            cerr << "Batched decoder differs from generic for codeword " <<
+                i << " of length " << batch_reference[i].size() << endl;
+            num_failures++;
+        }
+    }
+
+    for (const auto k : kernels) {
+        cerr << "Kernel " << viterbiKernelToString(k) << ": " <<
+            (Viterbi::kernelAvailable(k) ? "tested" : "not available") << endl;
+    }
+
+    Viterbi autoselect(768);
+    cerr << "Auto selects " << viterbiKernelToString(autoselect.getKernel()) << endl;
+    cerr << "Viterbi kernel test " << (num_failures == 0 ? "passed" : "FAILED") << endl;
+}
+
+void Tests::test_fib_crc()
+{
+    cerr << "Setup test_fib_crc" << endl;
+
+    // Half of the FIBs carry a valid CRC, the others have one bit flipped
+    const size_t num_fibs = 12 * 1000;
+    vector<uint8_t> fib_bytes(num_fibs * 32);
+    vector<uint8_t> fib_bits(num_fibs * 256);
+    for (size_t f = 0; f < num_fibs; f++) {
+        uint8_t *fib = &fib_bytes[f * 32];
+        for (int i = 0; i < 30; i++) {
+            fib[i] = random_generator();
+        }
+        const uint16_t crc = CalcCRC::CalcCRC_CRC16_CCITT.Calc(fib, 30);
+        fib[30] = crc >> 8;
+        fib[31] = crc & 0xFF;
+
+        if (f % 2) {
+            const int bit = random_generator() % 256;
+            fib[bit / 8] ^= 0x80 >> (bit % 8);
+        }
+
+        for (int i = 0; i < 256; i++) {
+            fib_bits[f * 256 + i] = (fib[i / 8] >> (7 - i % 8)) & 1;
+        }
+    }
+
+    size_t num_failures = 0;
+    vector<bool> valid_bits(num_fibs);
+    vector<bool> valid_bytes(num_fibs);
+
+    using namespace std::chrono;
+    const auto start_bits = steady_clock::now();
+    for (size_t f = 0; f < num_fibs; f++) {
+        valid_bits[f] = check_CRC_bits(&fib_bits[f * 256], 256);
+    }
+    const auto start_bytes = steady_clock::now();
+    // Includes packing the bits, like the FicHandler does
+    vector<uint8_t> packed(32);
+    for (size_t f = 0; f < num_fibs; f++) {
+        for (int i = 0; i < 32; i++) {
+            uint8_t byte = 0;
+            for (int j = 0; j < 8; j++) {
+                byte = (byte << 1) | fib_bits[f * 256 + 8 * i + j];
+            }
+            packed[i] = byte;
+        }
+        valid_bytes[f] = FicHandler::checkFibCRC(packed.data());
+    }
+    const auto end = steady_clock::now();
+
+    for (size_t f = 0; f < num_fibs; f++) {
+        const bool expected = (f % 2 == 0);
+        if (valid_bits[f] != expected or valid_bytes[f] != expected) {
+            num_failures++;
+        }
+    }
+
+    const auto ns_bits = duration_cast<nanoseconds>(start_bytes - start_bits).count();
+    const auto ns_bytes = duration_cast<nanoseconds>(end - start_bytes).count();
+    cerr << "Bit-serial CRC: " << ns_bits / num_fibs << " ns per FIB" << endl;
+    cerr << "Table CRC:      " << ns_bytes / num_fibs << " ns per FIB" << endl;
+    cerr << "FIB CRC test " << (num_failures == 0 ? "passed" : "FAILED") << endl;
+}
+
+void Tests::test_halfband_decimator()
+{
+    cerr << "Setup test_halfband_decimator" << endl;
+
+    // Tones at 4096ksps, the rate of the AirSpy. The DAB band after
+    // decimation is +-768kHz, and the tones above 1280kHz fold into it.
+    const double rate = 2 * INPUT_RATE;
+    const size_t len = 1 << 18;
+    const size_t blocksize = 65536;
+    struct tone_t { double freq; bool passband; };
+    const vector<tone_t> tones = {
+        {0, true}, {500e3, true}, {-768e3, true},
+        {1280e3, false}, {-1500e3, false}, {1900e3, false}};
+
+    size_t num_failures = 0;
+    vector<DSPCOMPLEX> in(len);
+    vector<DSPCOMPLEX> out(len / 2);
+    double ns_per_sample = 0;
+    for (const auto& tone : tones) {
+        for (size_t i = 0; i < len; i++) {
+            in[i] = polar(1.0, 2 * M_PI * tone.freq / rate * i);
+        }
+
+        HalfbandDecimator decimator(47);
+        using namespace std::chrono;
+        const auto start = steady_clock::now();
+        for (size_t i = 0; i < len; i += blocksize) {
+            decimator.process(&in[i], blocksize, &out[i / 2]);
+        }
+        ns_per_sample += duration_cast<nanoseconds>(
+                steady_clock::now() - start).count() / (double)len;
+
+        // Skip the transient at the start
+        double power = 0;
+        for (size_t i = 100; i < out.size(); i++) {
+            power += norm(out[i]);
+        }
+        const double gain_dB = 10 * log10(power / (out.size() - 100));
+
+        const bool ok = tone.passband ? (fabs(gain_dB) < 0.5) : (gain_dB < -50);
+        if (not ok) {
+            num_failures++;
+        }
+        cerr << "Tone at " << tone.freq / 1000 << " kHz: " << gain_dB <<
+            " dB " << (ok ? "" : "FAILED") << endl;
+    }
+
+    cerr << "Half-band decimator: " << ns_per_sample / tones.size() <<
+        " ns per input sample" << endl;
+    cerr << "Half-band decimator test " << (num_failures == 0 ? "passed" : "FAILED") << endl;
+}
+
+void Tests::test_iq_correction()
+{
+    cerr << "Setup test_iq_correction" << endl;
+
+    // Noise like an OFDM signal, with the DC offset, gain and phase
+    // imbalance of a poor receiver, quantised to 8 bits
+    const int32_t len = 1 << 21;
+    const int32_t blocksize = 2552;
+    const float dc_i = 0.04f, dc_q = -0.03f, gain = 1.1f, phase = 0.08f;
+    normal_distribution<float> noise(0, 0.2f);
+    auto quantise = [](float v) {
+        return (uint8_t)std::min(255l, std::max(0l, lround(v * 128 + 128)));
+    };
+    vector<uint8_t> u8(2 * len);
+    for (int32_t k = 0; k < len; k++) {
+        const float re = noise(random_generator);
+        const float im = noise(random_generator);
+        u8[2 * k] = quantise(re + dc_i);
+        u8[2 * k + 1] = quantise(gain * (sin(phase) * re + cos(phase) * im) + dc_q);
+    }
+
+    IQCorrection correction;
+    vector<DSPCOMPLEX> out(len);
+    using namespace std::chrono;
+    const auto start = steady_clock::now();
+    for (int32_t k = 0; k < len; k += blocksize) {
+        correction.processU8(&u8[2 * k], &out[k], std::min(blocksize, len - k));
+    }
+    const auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+
+    // Once the estimates have settled
+    double mean_i = 0, mean_q = 0, power_i = 0, power_q = 0, cross = 0;
+    const int32_t n = len / 2;
+    for (int32_t k = len - n; k < len; k++) {
+        mean_i += out[k].real();
+        mean_q += out[k].imag();
+        power_i += out[k].real() * out[k].real();
+        power_q += out[k].imag() * out[k].imag();
+        cross += out[k].real() * out[k].imag();
+    }
+    mean_i /= n;
+    mean_q /= n;
+    const double correlation = cross / sqrt(power_i * power_q);
+    const double balance_dB = 10 * log10(power_q / power_i);
+
+    cerr << "DC offset: " << mean_i << " " << mean_q << endl;
+    cerr << "Gain imbalance: " << balance_dB << " dB, correlation of I and Q: " <<
+        correlation << endl;
+    cerr << "IQ correction: " << (double)ns / len << " ns per sample" << endl;
+
+    const bool ok = fabs(mean_i) < 1e-3 and fabs(mean_q) < 1e-3 and
+        fabs(balance_dB) < 0.05 and fabs(correlation) < 5e-3;
+    cerr << "IQ correction test " << (ok ? "passed" : "FAILED") << endl;
+}
+
+void Tests::test_int8_conversion()
+{
+    cerr << "Setup test_int8_conversion" << endl;
+
+    // One second of 8-bit samples, with an odd length to also cover
+    // the tails of the vector loops
+    const int32_t len = 2 * INPUT_RATE + 7;
+    vector<uint8_t> in(len);
+    for (auto& b : in) {
+        b = random_generator();
+    }
+
+    const vector<Int8Conversion> conversions = {
+        Int8Conversion::Scalar, Int8Conversion::SIMD, Int8Conversion::Auto};
+
+    size_t num_failures = 0;
+    for (const bool isSigned : {false, true}) {
+        vector<float> expected(len);
+        convertInt8(in.data(), expected.data(), len, isSigned, Int8Conversion::Scalar);
+
+        for (const auto conversion : conversions) {
+            vector<float> out(len);
+            const int iterations = 20;
+            using namespace std::chrono;
+            const auto start = steady_clock::now();
+            for (int i = 0; i < iterations; i++) {
+                convertInt8(in.data(), out.data(), len, isSigned, conversion);
+            }
+            const double seconds = duration_cast<duration<double> >(
+                    steady_clock::now() - start).count();
+
+            const bool ok = (out == expected);
+            if (not ok) {
+                num_failures++;
+            }
+
+            cerr << (isSigned ? "s8 " : "u8 ") << int8ConversionName(conversion) <<
+                ": " << iterations * (len / 2) / seconds / 1e6 << " MS/s " <<
+                (ok ? "" : "FAILED") << endl;
+        }
+    }
+    cerr << "Int8 conversion test " << (num_failures == 0 ? "passed" : "FAILED") << endl;
+}
+
+void Tests::test_channelizer()
+{
+    cerr << "Setup test_channelizer" << endl;
+
+    // Channels 5A to 5D, each with a tone at a different offset, from
+    // a wideband input. The tones of the other channels are far outside
+    // of the passband of each channel.
+    const vector<int> freqs = {174928000, 176640000, 178352000, 180064000};
+    const int centre = (freqs.front() + freqs.back()) / 2;
+    const int32_t len = 2 * INPUT_RATE;
+
+    size_t num_failures = 0;
+    for (const int decimation : {4, 5}) {
+        // The offsets are multiples of 1kHz, the tones repeat every ms
+        const double rate = (double)decimation * INPUT_RATE;
+        vector<DSPCOMPLEX> period(rate / 1000);
+        for (size_t c = 0; c < freqs.size(); c++) {
+            const double f = freqs[c] - centre + 100e3 * (c + 1);
+            for (size_t i = 0; i < period.size(); i++) {
+                period[i] += DSPCOMPLEX(polar(1.0, 2 * M_PI * f / rate * i));
+            }
+        }
+        PeriodicSource source(move(period));
+
+        CChannelizer channelizer(source, centre, decimation);
+        vector<CVirtualInput*> channels;
+        for (const int freq : freqs) {
+            channels.push_back(&channelizer.addChannel(freq));
+        }
+
+        // All channels are filtered at the same time, and every one
+        // of them has to be faster than realtime.
+        vector<vector<DSPCOMPLEX> > out(channels.size(), vector<DSPCOMPLEX>(len));
+        vector<int32_t> num_read(channels.size(), 0);
+        using namespace std::chrono;
+        const auto start = steady_clock::now();
+        for (auto channel : channels) {
+            channel->restart();
+        }
+        for (bool done = false; not done; ) {
+            done = true;
+            for (size_t c = 0; c < channels.size(); c++) {
+                const int32_t n = std::min<int32_t>(len - num_read[c], 65536);
+                if (n > 0) {
+                    channels[c]->waitForSamples(n, milliseconds(100));
+                    num_read[c] += channels[c]->getSamples(&out[c][num_read[c]], n);
+                    done = false;
+                }
+            }
+        }
+        const double seconds = duration_cast<duration<double> >(
+                steady_clock::now() - start).count();
+        const double msps = len / seconds / 1e6;
+        const bool realtime = msps > INPUT_RATE / 1e6;
+        if (not realtime) {
+            num_failures++;
+        }
+        cerr << "Decimation " << decimation << ", " << channels.size() <<
+            " channels: " << msps << " MS/s per channel " <<
+            (realtime ? "" : "FAILED") << endl;
+
+        // Once the filters have settled, the tone of the channel has to
+        // be there at unity gain, and everything else is rejected.
+        for (size_t c = 0; c < channels.size(); c++) {
+            const double f = 100e3 * (c + 1);
+            complex<double> tone = 0;
+            double power = 0;
+            for (int32_t i = len / 2; i < len; i++) {
+                tone += complex<double>(out[c][i]) * polar(1.0, -2 * M_PI * f / INPUT_RATE * i);
+                power += norm(out[c][i]);
+            }
+            tone /= len / 2;
+            power /= len / 2;
+            const double gain_dB = 10 * log10(norm(tone));
+            const double rejection_dB = 10 * log10(std::max(power - norm(tone), 1e-20));
+
+            const bool ok = fabs(gain_dB) < 0.5 and rejection_dB < -40;
+            if (not ok) {
+                num_failures++;
+            }
+            cerr << "Channel " << freqs[c] / 1000 << " kHz: tone " << gain_dB <<
+                " dB, rest " << rejection_dB << " dB " << (ok ? "" : "FAILED") << endl;
+        }
+    }
+    cerr << "Channelizer test " << (num_failures == 0 ? "passed" : "FAILED") << endl;
+}
+
 void Tests::run_test(int test_id)
 {
     rro.fftPlacementMethod = DEFAULT_FFT_PLACEMENT;
@@ -376,5 +913,11 @@ void Tests::run_test(int test_id)
     if (test_id == 0) test_with_noise();
     else if (test_id == 1 or test_id == 2) test_multipath(test_id);
     else if (test_id == 3) test_with_noise_iteration(0);
+    else if (test_id == 4) test_viterbi_kernels();
+    else if (test_id == 5) test_fib_crc();
+    else if (test_id == 6) test_halfband_decimator();
+    else if (test_id == 7) test_iq_correction();
+    else if (test_id == 8) test_int8_conversion();
+    else if (test_id == 9) test_channelizer();
     else cerr << "Test " << test_id << " does not exist!" << endl;
 }
@@ -45,6 +45,12 @@ class Tests {
         void test_with_noise();
         void test_with_noise_iteration(double stddev);
         void test_multipath(int test_id);
+        void test_viterbi_kernels();
+        void test_fib_crc();
+        void test_halfband_decimator();
+        void test_iq_correction();
+        void test_int8_conversion();
+        void test_channelizer();
 
         std::unique_ptr<CVirtualInput>& input_interface;
         RadioReceiverOptions rro;
@@ -27,49 +27,6 @@
 
 using namespace std;
 
-#ifndef MSG_NOSIGNAL
-#define MSG_NOSIGNAL 0
-#endif
-
-ProgrammeSender::ProgrammeSender(Socket&& s) :
-    s(move(s))
-{
-}
-
-void ProgrammeSender::cancel()
-{
-    s.close();
-}
-
-bool ProgrammeSender::send_mp3(const std::vector<uint8_t>& mp3Data)
-{
-    if (not s.valid()) {
-        return false;
-    }
-
-    const int flags = MSG_NOSIGNAL;
-
-    ssize_t ret = s.send(mp3Data.data(), mp3Data.size(), flags);
-    if (ret == -1) {
-        s.close();
-        std::unique_lock<std::mutex> lock(mutex);
-        running = false;
-        lock.unlock();
-        cv.notify_all();
-        return false;
-    }
-
-    return true;
-}
-
-void ProgrammeSender::wait_for_termination()
-{
-    std::unique_lock<std::mutex> lock(mutex);
-    while (running) {
-        cv.wait_for(lock, chrono::seconds(2));
-    }
-}
-
 WebProgrammeHandler::WebProgrammeHandler(uint32_t serviceId) :
     serviceId(serviceId)
 {
@@ -82,7 +39,7 @@ WebProgrammeHandler::WebProgrammeHandler(uint32_t serviceId) :
 
 WebProgrammeHandler::WebProgrammeHandler(WebProgrammeHandler&& other) :
     serviceId(other.serviceId),
-    senders(move(other.senders))
+    outputs(move(other.outputs))
 {
     const auto now = chrono::system_clock::now();
     time_label = now;
@@ -91,29 +48,82 @@ WebProgrammeHandler::WebProgrammeHandler(WebProgrammeHandler&& other) :
     time_mot_change = now;
 }
 
-void WebProgrammeHandler::registerSender(ProgrammeSender *sender)
+void WebProgrammeHandler::registerSender(AudioFormat format,
+        const std::shared_ptr<HttpStream>& sender)
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    senders.push_back(sender);
+    if (format == AudioFormat::WAV) {
+        outputs[format].new_senders.push_back(sender);
+    }
+    else {
+        outputs[format].senders.push_back(sender);
+    }
 }
 
-void WebProgrammeHandler::removeSender(ProgrammeSender *sender)
+void WebProgrammeHandler::removeSender(AudioFormat format,
+        const std::shared_ptr<HttpStream>& sender)
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    senders.remove(sender);
+    auto& o = outputs[format];
+    o.senders.remove(sender);
+    o.new_senders.remove(sender);
 }
 
 bool WebProgrammeHandler::needsToBeDecoded() const
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    return not senders.empty();
+    for (const auto& o : outputs) {
+        if (not o.second.senders.empty() or not o.second.new_senders.empty()) {
+            return true;
+        }
+    }
+    return false;
 }
 
 void WebProgrammeHandler::cancelAll()
 {
     std::unique_lock<std::mutex> lock(senders_mutex);
-    for (auto& s : senders) {
-        s->cancel();
+    for (auto& o : outputs) {
+        for (auto& s : o.second.senders) {
+            s->close();
+        }
+        for (auto& s : o.second.new_senders) {
+            s->close();
+        }
+    }
+}
+
+std::vector<HttpStream::stats_t> WebProgrammeHandler::getSenderStats(
+        AudioFormat format) const
+{
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    std::vector<HttpStream::stats_t> stats;
+    const auto o = outputs.find(format);
+    if (o != outputs.end()) {
+        for (auto& s : o->second.senders) {
+            stats.push_back(s->get_stats());
+        }
+        for (auto& s : o->second.new_senders) {
+            stats.push_back(s->get_stats());
+        }
+    }
+    return stats;
+}
+
+bool WebProgrammeHandler::hasSenders(AudioFormat format)
+{
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    const auto& o = outputs[format];
+    return not o.senders.empty() or not o.new_senders.empty();
+}
+
+void WebProgrammeHandler::pushToSenders(AudioFormat format,
+        const HttpStream::data_t& data)
+{
+    // All senders share the same data, and only queue it
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    for (auto& sender : outputs[format].senders) {
+        sender->push(data);
     }
 }
 
@@ -161,16 +171,19 @@ WebProgrammeHandler::audiolevels_t WebProgrammeHandler::getAudioLevels() const
 
 WebProgrammeHandler::errorcounters_t WebProgrammeHandler::getErrorCounters() const
 {
-    std::unique_lock<std::mutex> lock(stats_mutex);
-    errorcounters_t r(errorcounters);
+    errorcounters_t r;
+    r.num_frameErrors = num_frameErrors;
+    r.num_rsErrors = num_rsErrors;
+    r.num_aacErrors = num_aacErrors;
+    r.time = chrono::system_clock::time_point(
+            chrono::system_clock::duration(time_errorcounters.load()));
     return r;
 }
 
 void WebProgrammeHandler::onFrameErrors(int frameErrors)
 {
-    std::unique_lock<std::mutex> lock(stats_mutex);
-    errorcounters.num_frameErrors += frameErrors;
-    errorcounters.time = chrono::system_clock::now();
+    num_frameErrors += frameErrors;
+    time_errorcounters = chrono::system_clock::now().time_since_epoch().count();
 }
 
 void WebProgrammeHandler::onNewAudio(std::vector<int16_t>&& audioData,
@@ -206,53 +219,131 @@ void WebProgrammeHandler::onNewAudio(std::vector<int16_t>&& audioData,
         audiolevels.last_audioLevel_R = last_audioLevel_R;
     }
 
-    if (not lame_initialised) {
-        lame_set_in_samplerate(lame.lame, rate);
-        lame_set_num_channels(lame.lame, channels);
-        lame_set_VBR(lame.lame, vbr_default);
-        lame_set_VBR_q(lame.lame, 2);
-        lame_init_params(lame.lame);
-        lame_initialised = true;
+    if (hasSenders(AudioFormat::MP3)) {
+        encodeMP3(audioData, channels);
+    }
+    else {
+        lame.reset();
     }
 
-    vector<uint8_t> mp3buf(16384);
+    if (hasSenders(AudioFormat::WAV)) {
+        encodeWAV(audioData, channels);
+    }
+}
 
-    int written = lame_encode_buffer_interleaved(lame.lame,
-            audioData.data(), audioData.size()/channels,
+void WebProgrammeHandler::encodeMP3(std::vector<int16_t>& audioData, int channels)
+{
+    if (not lame or lame_rate != rate) {
+        lame = make_unique<Lame>();
+        lame_set_in_samplerate(lame->lame, rate);
+        lame_set_num_channels(lame->lame, channels);
+        lame_set_VBR(lame->lame, vbr_default);
+        lame_set_VBR_q(lame->lame, 2);
+        lame_init_params(lame->lame);
+        lame_rate = rate;
+    }
+
+    // Worst case output size, as given in lame.h
+    const int num_samples = audioData.size() / channels;
+    mp3buf.resize(5 * num_samples / 4 + 7200);
+
+    int written = lame_encode_buffer_interleaved(lame->lame,
+            audioData.data(), num_samples,
             mp3buf.data(), mp3buf.size());
 
     if (written < 0) {
         cerr << "Failed to encode mp3: " << written << endl;
     }
-    else if (written > (ssize_t)mp3buf.size()) {
-        cerr << "mp3 encoder wrote more than buffer size!" << endl;
-    }
     else if (written > 0) {
-        mp3buf.resize(written);
-
-        std::unique_lock<std::mutex> lock(senders_mutex);
-        for (auto *sender : senders) {
-            bool success = sender->send_mp3(mp3buf);
-            if (not success) {
-                cerr << "Failed to send audio for " << serviceId << endl;
-            }
+        pushToSenders(AudioFormat::MP3, make_shared<const vector<uint8_t> >(
+                    mp3buf.cbegin(), mp3buf.cbegin() + written));
+    }
+}
+
+// Header of a WAV file of unknown length, the sizes are set to the maximum
+static HttpStream::data_t make_wav_header(int rate, int channels)
+{
+    vector<uint8_t> h;
+    auto append = [&](uint32_t value, size_t bytes) {
+        for (size_t i = 0; i < bytes; i++) {
+            h.push_back((value >> (8 * i)) & 0xFF);
         }
+    };
+    auto append_id = [&](const char *id) {
+        h.insert(h.end(), id, id + 4);
+    };
+
+    const int bytes_per_sample = 2;
+    append_id("RIFF");
+    append(0xFFFFFFFF, 4);
+    append_id("WAVE");
+    append_id("fmt ");
+    append(16, 4);
+    append(1, 2); // PCM
+    append(channels, 2);
+    append(rate, 4);
+    append(rate * channels * bytes_per_sample, 4);
+    append(channels * bytes_per_sample, 2);
+    append(8 * bytes_per_sample, 2);
+    append_id("data");
+    append(0xFFFFFFFF, 4);
+    return make_shared<const vector<uint8_t> >(move(h));
+}
+
+void WebProgrammeHandler::encodeWAV(const std::vector<int16_t>& audioData, int channels)
+{
+    // WAV is little-endian
+    auto pcm = make_shared<vector<uint8_t> >(2 * audioData.size());
+    for (size_t i = 0; i < audioData.size(); i++) {
+        (*pcm)[2 * i] = audioData[i] & 0xFF;
+        (*pcm)[2 * i + 1] = (audioData[i] >> 8) & 0xFF;
+    }
+
+    std::unique_lock<std::mutex> lock(senders_mutex);
+    auto& o = outputs[AudioFormat::WAV];
+
+    if (wav_rate != rate) {
+        // The header of the connected clients does not match anymore
+        for (auto& sender : o.senders) {
+            sender->close();
+        }
+        o.senders.clear();
+        wav_header = make_wav_header(rate, channels);
+        wav_rate = rate;
+    }
+
+    for (auto& sender : o.new_senders) {
+        sender->push(wav_header);
+    }
+    o.senders.splice(o.senders.end(), o.new_senders);
+
+    const HttpStream::data_t data = pcm;
+    for (auto& sender : o.senders) {
+        sender->push(data);
+    }
+}
+
+void WebProgrammeHandler::onNewEncodedAudio(const uint8_t *data, size_t len,
+        const string& format)
+{
+    (void)format;
+    if (hasSenders(AudioFormat::Untouched)) {
+        pushToSenders(AudioFormat::Untouched,
+                make_shared<const vector<uint8_t> >(data, data + len));
     }
 }
 
 void WebProgrammeHandler::onRsErrors(bool uncorrectedErrors, int numCorrectedErrors)
 {
     (void)numCorrectedErrors; // TODO calculate BER before Reed-Solomon
-    std::unique_lock<std::mutex> lock(stats_mutex);
-    errorcounters.num_rsErrors += (uncorrectedErrors ? 1 : 0);
-    errorcounters.time = chrono::system_clock::now();
+    num_rsErrors += (uncorrectedErrors ? 1 : 0);
+    time_errorcounters = chrono::system_clock::now().time_since_epoch().count();
 }
 
 void WebProgrammeHandler::onAacErrors(int aacErrors)
 {
-    std::unique_lock<std::mutex> lock(stats_mutex);
-    errorcounters.num_aacErrors += aacErrors;
-    errorcounters.time = chrono::system_clock::now();
+    num_aacErrors += aacErrors;
+    time_errorcounters = chrono::system_clock::now().time_since_epoch().count();
 }
 
 void WebProgrammeHandler::onNewDynamicLabel(const string& label)
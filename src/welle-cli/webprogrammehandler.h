@@ -24,31 +24,18 @@
  */
 #pragma once
 
-#include "various/Socket.h"
 #include "backend/radio-receiver.h"
+#include "welle-cli/httpreactor.h"
 #include <lame/lame.h>
+#include <atomic>
 #include <cstdint>
+#include <list>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <chrono>
 #include <string>
 
-class ProgrammeSender {
-    private:
-        Socket s;
-
-        bool running = true;
-        std::condition_variable cv;
-        std::mutex mutex;
-
-    public:
-        ProgrammeSender(Socket&& s);
-        bool send_mp3(const std::vector<uint8_t>& mp3data);
-        void wait_for_termination();
-        void cancel();
-};
-
-
 struct Lame {
     lame_t lame;
 
@@ -68,6 +55,13 @@ struct Lame {
 
 enum class MOTType { JPEG, PNG, Unknown };
 
+// The formats in which the audio of a programme can be streamed
+enum class AudioFormat {
+    MP3,       // Encoded by LAME
+    Untouched, // As transmitted: MP2 for DAB, AAC in LATM/LOAS for DAB+
+    WAV,       // Decoded 16-bit stereo PCM, preceded by a WAV header
+};
+
 
 class WebProgrammeHandler : public ProgrammeHandlerInterface {
     public:
@@ -93,15 +87,37 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
     private:
         uint32_t serviceId;
 
-        bool lame_initialised = false;
-        Lame lame;
-
+        /* Every format is only encoded while it has clients, and all of
+         * them share the same data. */
+        struct output_t {
+            std::list<std::shared_ptr<HttpStream> > senders;
+            // Clients that have to get the header before the data
+            std::list<std::shared_ptr<HttpStream> > new_senders;
+        };
         mutable std::mutex senders_mutex;
-        std::list<ProgrammeSender*> senders;
+        std::map<AudioFormat, output_t> outputs;
+
+        // The encoders are only used by the decoder thread, and get
+        // created on demand.
+        std::unique_ptr<Lame> lame;
+        int lame_rate = 0;
+        std::vector<uint8_t> mp3buf;
+        int wav_rate = 0;
+        HttpStream::data_t wav_header;
+
+        bool hasSenders(AudioFormat format);
+        void pushToSenders(AudioFormat format, const HttpStream::data_t& data);
+        void encodeMP3(std::vector<int16_t>& audioData, int channels);
+        void encodeWAV(const std::vector<int16_t>& audioData, int channels);
 
         mutable std::mutex stats_mutex;
 
-        errorcounters_t errorcounters;
+        // The decoder updates the error counters without locking
+        std::atomic<size_t> num_frameErrors = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> num_rsErrors = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> num_aacErrors = ATOMIC_VAR_INIT(0);
+        std::atomic<std::chrono::system_clock::rep> time_errorcounters =
+            ATOMIC_VAR_INIT(0);
 
         bool last_label_valid = false;
         std::chrono::time_point<std::chrono::system_clock> time_label;
@@ -125,11 +141,16 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
         WebProgrammeHandler(uint32_t serviceId);
         WebProgrammeHandler(WebProgrammeHandler&& other);
 
-        void registerSender(ProgrammeSender *sender);
-        void removeSender(ProgrammeSender *sender);
+        void registerSender(AudioFormat format,
+                const std::shared_ptr<HttpStream>& sender);
+        void removeSender(AudioFormat format,
+                const std::shared_ptr<HttpStream>& sender);
         bool needsToBeDecoded() const;
         void cancelAll();
 
+        // Queue state of all clients receiving the audio in that format
+        std::vector<HttpStream::stats_t> getSenderStats(AudioFormat format) const;
+
         struct dls_t {
             std::string label;
             std::chrono::time_point<std::chrono::system_clock> time;
@@ -150,6 +171,8 @@ class WebProgrammeHandler : public ProgrammeHandlerInterface {
         virtual void onFrameErrors(int frameErrors) override;
         virtual void onNewAudio(std::vector<int16_t>&& audioData,
                 int sampleRate, const std::string& mode) override;
+        virtual void onNewEncodedAudio(const uint8_t *data, size_t len,
+                const std::string& format) override;
         virtual void onRsErrors(bool uncorrectedErrors, int numCorrectedErrors) override;
         virtual void onAacErrors(int aacErrors) override;
         virtual void onNewDynamicLabel(const std::string& label) override;
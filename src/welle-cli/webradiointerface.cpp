@@ -23,11 +23,11 @@
  *
  */
 
-#include <future>
 #include <array>
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <locale>
 #include <regex>
 #include <sstream>
 #include <utility>
@@ -44,13 +44,13 @@
 # endif
 #endif
 
+#if defined(HAVE_ZLIB)
+# include <zlib.h>
+#endif
+
 #include "welle-cli/webradiointerface.h"
 #include "libs/json.hpp"
 
-#ifndef MSG_NOSIGNAL
-#define MSG_NOSIGNAL 0
-#endif
-
 #ifdef GITDESCRIBE
 #define VERSION GITDESCRIBE
 #else
@@ -63,13 +63,19 @@ constexpr size_t MAX_PENDING_MESSAGES = 512;
 
 using namespace std;
 
-static const char* http_ok = "HTTP/1.0 200 OK\r\n";
-static const char* http_400 = "HTTP/1.0 400 Bad Request\r\n";
-static const char* http_404 = "HTTP/1.0 404 Not Found\r\n";
-static const char* http_405 = "HTTP/1.0 405 Method Not Allowed\r\n";
-static const char* http_500 = "HTTP/1.0 500 Internal Server Error\r\n";
-static const char* http_503 = "HTTP/1.0 503 Service Unavailable\r\n";
+const size_t WebRadioInterface::audio_queue_length;
+const size_t WebRadioInterface::fic_queue_length;
+const size_t WebRadioInterface::telemetry_queue_length;
+
+static const char* http_ok = "200 OK";
+static const char* http_400 = "400 Bad Request";
+static const char* http_404 = "404 Not Found";
+static const char* http_405 = "405 Method Not Allowed";
+static const char* http_500 = "500 Internal Server Error";
+static const char* http_503 = "503 Service Unavailable";
 static const char* http_contenttype_mp3 = "Content-Type: audio/mpeg\r\n";
+static const char* http_contenttype_aac = "Content-Type: audio/aac\r\n";
+static const char* http_contenttype_wav = "Content-Type: audio/wav\r\n";
 static const char* http_contenttype_text = "Content-Type: text/plain\r\n";
 static const char* http_contenttype_data =
         "Content-Type: application/octet-stream\r\n";
@@ -95,18 +101,12 @@ static string to_hex(uint32_t value)
     return sidstream.str();
 }
 
-static bool send_http_response(Socket& s, const string& statuscode,
+static void set_http_response(HttpResponse& resp, const string& statuscode,
         const string& data, const string& content_type = http_contenttype_text) {
-    string headers = statuscode;
-    headers += content_type;
-    headers += http_nocache;
-    headers += "\r\n";
-    headers += data;
-    ssize_t ret = s.send(headers.data(), headers.size(), MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send response " << statuscode << " " << data << endl;
-    }
-    return ret != -1;
+    resp.status = statuscode;
+    resp.headers = content_type;
+    resp.headers += http_nocache;
+    resp.body = data;
 }
 
 WebRadioInterface::WebRadioInterface(CVirtualInput& in,
@@ -115,7 +115,7 @@ WebRadioInterface::WebRadioInterface(CVirtualInput& in,
         RadioReceiverOptions rro) :
     dabparams(1),
     input(in),
-    spectrum_fft_handler(dabparams.T_u),
+    plot_fft_handler(dabparams.T_u),
     rro(rro),
     decode_settings(ds)
 {
@@ -141,6 +141,7 @@ WebRadioInterface::WebRadioInterface(CVirtualInput& in,
     }
 
     programme_handler_thread = thread(&WebRadioInterface::handle_phs, this);
+    plot_thread = thread(&WebRadioInterface::handle_plots, this);
 }
 
 WebRadioInterface::~WebRadioInterface()
@@ -149,6 +150,11 @@ WebRadioInterface::~WebRadioInterface()
     if (programme_handler_thread.joinable()) {
         programme_handler_thread.join();
     }
+
+    plot_running = false;
+    if (plot_thread.joinable()) {
+        plot_thread.join();
+    }
 }
 
 class TuneFailed {};
@@ -248,17 +254,13 @@ void WebRadioInterface::retune(const std::string& channel)
         {
             lock_guard<mutex> data_lock(data_mut);
             last_dateTime = {};
-            last_snr = 0;
-            last_fine_correction = 0;
-            last_coarse_correction = 0;
         }
 
+        last_snr = 0;
+        last_fine_correction = 0;
+        last_coarse_correction = 0;
         synced = false;
-
-        {
-            lock_guard<mutex> fib_lock(fib_mut);
-            num_fic_crc_errors = 0;
-        }
+        num_fic_crc_errors = 0;
         tiis.clear();
 
         cerr << "Set frequency" << endl;
@@ -280,271 +282,129 @@ void WebRadioInterface::retune(const std::string& channel)
     }
 }
 
-static string recv_line(Socket& s) {
-    string line;
-    bool cr_seen = false;
+HttpResponse WebRadioInterface::handle_request(const HttpRequest& req)
+{
+    HttpResponse r;
+    bool success = false;
+
+    // Only the plots take a query, to select the averaged or peak-hold view
+    const auto query_start = req.url.find('?');
+    const string path = req.url.substr(0, query_start);
+    const string query = (query_start == string::npos) ?
+        "" : req.url.substr(query_start + 1);
 
-    while (true) {
-        char c = 0;
-        ssize_t ret = s.recv(&c, 1, 0);
-        if (ret == 0) {
-            return "";
+    if (req.method == "GET") {
+        if (req.url == "/") {
+            success = send_file(r, "index.html", http_contenttype_html);
         }
-        else if (ret == -1) {
-            string errstr = strerror(errno);
-            cerr << "recv error " << errstr << endl;
-            return "";
+        else if (req.url == "/index.js") {
+            success = send_file(r, "index.js", http_contenttype_js);
         }
-
-        line += c;
-
-        if (c == '\r') {
-            cr_seen = true;
+        else if (req.url == "/mux.json") {
+            success = send_mux_json(req, r);
         }
-        else if (cr_seen and c == '\n') {
-            return line;
+        else if (req.url == "/fic") {
+            success = send_fic(r);
         }
-    }
-}
-
-static vector<char> recv_exactly(Socket& s, size_t num_bytes)
-{
-    vector<char> buf(num_bytes);
-    size_t rx = 0;
-
-    while (rx < num_bytes) {
-        const size_t remain = num_bytes - rx;
-        ssize_t ret = s.recv(buf.data() + rx, remain, 0);
-
-        if (ret == 0) {
-            break;
+        else if (req.url == "/events") {
+            success = send_events(r);
         }
-        else if (ret == -1) {
-            string errstr = strerror(errno);
-            cerr << "recv error " << errstr << endl;
-            return {};
+        else if (req.url == "/metrics") {
+            success = send_metrics(r);
         }
-        else {
-            rx += ret;
+        else if (req.url == "/impulseresponse") {
+            success = send_impulseresponse(r);
         }
-    }
-
-    return buf;
-}
-
-static vector<string> split(const string& str, char c = ' ')
-{
-    const char *s = str.data();
-    vector<string> result;
-    do {
-        const char *begin = s;
-        while (*s != c && *s)
-            s++;
-        result.push_back(string(begin, s));
-    } while (0 != *s++);
-    return result;
-}
-
-struct http_request_t {
-    bool valid = false;
-
-    bool is_get = false;
-    bool is_post = false;
-    string url;
-    map<string, string> headers;
-    string post_data;
-};
-
-
-static http_request_t parse_http_headers(Socket& s) {
-    http_request_t r;
-
-    const auto first_line = recv_line(s);
-    const auto request_type = split(first_line);
-
-    if (request_type.size() != 3) {
-        cerr << "Malformed request: " << first_line;
-        return r;
-    }
-    else if (request_type[0] == "GET") {
-        r.is_get = true;
-    }
-    else if (request_type[0] == "POST") {
-        r.is_post = true;
-    }
-    else {
-        return r;
-    }
-
-    r.url = request_type[1];
-
-    while (true) {
-        string header_line = recv_line(s);
-
-        if (header_line == "\r\n") {
-            break;
+        else if (path == "/spectrum") {
+            success = send_spectrum(r, query);
         }
-
-        const auto header = split(header_line, ':');
-
-        if (header.size() == 2) {
-            r.headers.emplace(header[0], header[1]);
+        else if (req.url == "/constellation") {
+            success = send_constellation(r);
         }
-    }
-
-    if (r.is_post) {
-        constexpr auto CL = "Content-Length";
-        if (r.headers.count(CL) == 1) {
-            try {
-                const int content_length = std::stoi(r.headers[CL]);
-                if (content_length > 1024 * 1024) {
-                    cerr << "Unreasonable POST Content-Length: " << content_length;
-                    return r;
-                }
-
-                const auto buf = recv_exactly(s, content_length);
-                r.post_data = string(buf.begin(), buf.end());
-            }
-            catch (const invalid_argument&) {
-                cerr << "Cannot parse POST Content-Length: " << r.headers[CL];
-                return r;
-            }
-            catch (const out_of_range&) {
-                cerr << "Cannot represent POST Content-Length: " << r.headers[CL];
-                return r;
-            }
+        else if (path == "/nullspectrum") {
+            success = send_null_spectrum(r, query);
         }
-    }
-
-    r.valid = true;
-    return r;
-}
-
-bool WebRadioInterface::dispatch_client(Socket&& client)
-{
-    Socket s(move(client));
-
-    bool success = false;
-
-    if (not s.valid()) {
-        cerr << "socket in dispatcher not valid!" << endl;
-        return false;
-    }
-
-    const auto req = parse_http_headers(s);
-
-    if (not req.valid) {
-        return false;
-    }
-    else {
-        if (req.is_get) {
-            if (req.url == "/") {
-                success = send_file(s, "index.html", http_contenttype_html);
-            }
-            else if (req.url == "/index.js") {
-                success = send_file(s, "index.js", http_contenttype_js);
-            }
-            else if (req.url == "/mux.json") {
-                success = send_mux_json(s);
-            }
-            else if (req.url == "/fic") {
-                success = send_fic(s);
-            }
-            else if (req.url == "/impulseresponse") {
-                success = send_impulseresponse(s);
-            }
-            else if (req.url == "/spectrum") {
-                success = send_spectrum(s);
-            }
-            else if (req.url == "/constellation") {
-                success = send_constellation(s);
-            }
-            else if (req.url == "/nullspectrum") {
-                success = send_null_spectrum(s);
-            }
-            else if (req.url == "/channel") {
-                success = send_channel(s);
-            }
-            else if (req.url == "/fftwindowplacement" or req.url == "/enablecoarsecorrector") {
-                send_http_response(s, http_405,
-                        "405 Method Not Allowed\r\n" + req.url + " is POST-only");
-                return false;
-            }
-            else {
-                const regex regex_slide(R"(^[/]slide[/]([^ ]+))");
-                std::smatch match_slide;
-
-                const regex regex_mp3(R"(^[/]mp3[/]([^ ]+))");
-                std::smatch match_mp3;
-                if (regex_search(req.url, match_mp3, regex_mp3)) {
-                    success = send_mp3(s, match_mp3[1]);
-                }
-                else if (regex_search(req.url, match_slide, regex_slide)) {
-                    success = send_slide(s, match_slide[1]);
+        else if (req.url == "/channel") {
+            success = send_channel(r);
+        }
+        else if (req.url == "/fftwindowplacement" or req.url == "/enablecoarsecorrector") {
+            set_http_response(r, http_405,
+                    "405 Method Not Allowed\r\n" + req.url + " is POST-only");
+            return r;
+        }
+        else {
+            const regex regex_slide(R"(^[/]slide[/]([^ ]+))");
+            std::smatch match_slide;
+
+            const regex regex_audio(R"(^[/](mp3|wav|untouched)[/]([^ ]+))");
+            std::smatch match_audio;
+            if (regex_search(req.url, match_audio, regex_audio)) {
+                AudioFormat format = AudioFormat::MP3;
+                if (match_audio[1] == "wav") {
+                    format = AudioFormat::WAV;
                 }
-                else {
-                    cerr << "Could not understand GET request " << req.url << endl;
+                else if (match_audio[1] == "untouched") {
+                    format = AudioFormat::Untouched;
                 }
+                success = send_audio(r, match_audio[2], format);
             }
-        }
-        else if (req.is_post) {
-            if (req.url == "/channel") {
-                success = handle_channel_post(s, req.post_data);
-            }
-            else if (req.url == "/fftwindowplacement") {
-                success = handle_fft_window_placement_post(s, req.post_data);
-            }
-            else if (req.url == "/enablecoarsecorrector") {
-                success = handle_coarse_corrector_post(s, req.post_data);
+            else if (regex_search(req.url, match_slide, regex_slide)) {
+                success = send_slide(r, match_slide[1]);
             }
             else {
-                cerr << "Could not understand POST request " << req.url << endl;
+                cerr << "Could not understand GET request " << req.url << endl;
             }
         }
-        else {
-            throw logic_error("valid req is neither GET nor POST!");
+    }
+    else if (req.method == "POST") {
+        if (req.url == "/channel") {
+            success = handle_channel_post(r, req.body);
         }
-
-        if (not success) {
-            send_http_response(s, http_404, "Could not understand request.\r\n");
+        else if (req.url == "/fftwindowplacement") {
+            success = handle_fft_window_placement_post(r, req.body);
+        }
+        else if (req.url == "/enablecoarsecorrector") {
+            success = handle_coarse_corrector_post(r, req.body);
+        }
+        else {
+            cerr << "Could not understand POST request " << req.url << endl;
         }
+    }
+    else {
+        set_http_response(r, http_405, "405 Method Not Allowed\r\n");
+        return r;
+    }
 
-        return success;
+    if (not success) {
+        r = HttpResponse();
+        set_http_response(r, http_404, "Could not understand request.\r\n");
     }
+
+    return r;
 }
 
-bool WebRadioInterface::send_file(Socket& s,
+bool WebRadioInterface::send_file(HttpResponse& r,
         const std::string& filename,
         const std::string& content_type)
 {
     FILE *fd = fopen(filename.c_str(), "r");
     if (fd) {
-        if (not send_http_response(s, http_ok, "", content_type)) {
-            cerr << "Failed to send file headers" << endl;
-            fclose(fd);
-            return false;
-        }
+        set_http_response(r, http_ok, "", content_type);
 
         vector<char> data(1024);
-        ssize_t ret = 0;
+        size_t ret = 0;
         do {
             ret = fread(data.data(), 1, data.size(), fd);
-            ret = s.send(data.data(), ret, MSG_NOSIGNAL);
-            if (ret == -1) {
-                cerr << "Failed to send file data" << endl;
-                fclose(fd);
-                return false;
-            }
-
+            r.body.append(data.data(), ret);
         } while (ret > 0);
 
         fclose(fd);
         return true;
     }
     else {
-        return send_http_response(s, http_500, "file '" + filename + "' is missing!");
+        set_http_response(r, http_500, "file '" + filename + "' is missing!");
+        return true;
     }
-    return false;
 }
 
 struct peak_t {
@@ -611,10 +471,105 @@ static void set_label_json(nlohmann::json& j, const DabLabel& l)
     j["fig2charset"] = extended_label_charset;
 }
 
-bool WebRadioInterface::send_mux_json(Socket& s)
+#if defined(HAVE_ZLIB)
+static string gzip_compress(const string& data)
+{
+    z_stream zs = {};
+    // 16 added to the window bits selects the gzip format
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw runtime_error("deflateInit2 failed");
+    }
+
+    string out(deflateBound(&zs, data.size()), '\0');
+    zs.next_in = (Bytef*)data.data();
+    zs.avail_in = data.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = out.size();
+
+    const int ret = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    if (ret != Z_STREAM_END) {
+        throw runtime_error("deflate failed");
+    }
+    return out;
+}
+#endif
+
+static bool header_contains(const HttpRequest& req,
+        const string& name, const string& value)
+{
+    const auto it = req.headers.find(name);
+    return it != req.headers.end() and
+        it->second.find(value) != string::npos;
+}
+
+bool WebRadioInterface::send_mux_json(const HttpRequest& req, HttpResponse& r)
+{
+    lock_guard<mutex> lock(mux_json_mut);
+
+    const auto now = chrono::steady_clock::now();
+    uint32_t ensemble_generation = 0;
+    chrono::time_point<chrono::system_clock> rx_created;
+    {
+        lock_guard<mutex> rxlock(rx_mut);
+        ASSERT_RX;
+        ensemble_generation = rx->getEnsembleSnapshot()->generation;
+        rx_created = time_rx_created;
+    }
+
+    // Regenerate at most every mux_json_max_age, unless the ensemble
+    // changed or the receiver was retuned.
+    if (mux_json.body.empty() or
+            now - mux_json.time >= decode_settings.mux_json_max_age or
+            ensemble_generation != mux_json.ensemble_generation or
+            rx_created != mux_json.rx_created) {
+        mux_json.body = generate_mux_json();
+        mux_json.gzipped_body.clear();
+        mux_json.time = now;
+        mux_json.ensemble_generation = ensemble_generation;
+        mux_json.rx_created = rx_created;
+
+        stringstream etag;
+        etag << '"' << std::hex << std::hash<string>()(mux_json.body) << '"';
+        mux_json.etag = etag.str();
+    }
+
+    r.status = http_ok;
+    r.headers = http_contenttype_json;
+    r.headers += http_nocache;
+    r.headers += "ETag: " + mux_json.etag + "\r\n";
+    r.headers += "Vary: Accept-Encoding\r\n";
+
+    if (header_contains(req, "if-none-match", mux_json.etag)) {
+        r.status = "304 Not Modified";
+        return true;
+    }
+
+#if defined(HAVE_ZLIB)
+    if (header_contains(req, "accept-encoding", "gzip")) {
+        // Compressed once per generation, on the first request that accepts it
+        if (mux_json.gzipped_body.empty()) {
+            mux_json.gzipped_body = gzip_compress(mux_json.body);
+        }
+        r.headers += "Content-Encoding: gzip\r\n";
+        r.body = mux_json.gzipped_body;
+        return true;
+    }
+#endif
+
+    r.body = mux_json.body;
+    return true;
+}
+
+string WebRadioInterface::generate_mux_json()
 {
     nlohmann::json j;
 
+    j["generated"] = chrono::system_clock::to_time_t(chrono::system_clock::now());
+
     j["receiver"]["software"]["name"] = "welle.io";
     j["receiver"]["software"]["version"] = VERSION;
     j["receiver"]["software"]["fftwindowplacement"] = fftPlacementMethodToString(rro.fftPlacementMethod);
@@ -624,22 +579,21 @@ bool WebRadioInterface::send_mux_json(Socket& s)
     j["receiver"]["hardware"]["name"] = input.getDescription();
     j["receiver"]["hardware"]["gain"] = input.getGain();
 
-    {
-        lock_guard<mutex> lock(fib_mut);
-        j["demodulator"]["fic"]["numcrcerrors"] = num_fic_crc_errors;
-    }
+    j["demodulator"]["fic"]["numcrcerrors"] = num_fic_crc_errors.load();
 
     {
         lock_guard<mutex> lock(rx_mut);
         ASSERT_RX;
-        const auto ensembleLabel = rx->getEnsembleLabel();
-        set_label_json(j["ensemble"], rx->getEnsembleLabel());
+        const auto ensemble = rx->getEnsembleSnapshot();
+        set_label_json(j["ensemble"], ensemble->ensembleLabel);
+
+        j["ensemble"]["id"] = to_hex<4>(ensemble->ensembleId);
+        j["ensemble"]["ecc"] = to_hex<2>(ensemble->ensembleEcc);
 
-        j["ensemble"]["id"] = to_hex<4>(rx->getEnsembleId());
-        j["ensemble"]["ecc"] = to_hex<2>(rx->getEnsembleEcc());
+        j["demodulator"]["numdroppedframes"] = rx->getNumDroppedFrames();
 
         nlohmann::json j_services = nlohmann::json::array();
-        for (const auto& s : rx->getServiceList()) {
+        for (const auto& s : ensemble->services) {
             nlohmann::json j_srv = {
                 {"sid", to_hex<4>(s.serviceId)},
                 {"pty", s.programType},
@@ -652,7 +606,7 @@ bool WebRadioInterface::send_mux_json(Socket& s)
             nlohmann::json j_components;
 
             bool hasAudioComponent = false;
-            for (const auto& sc : rx->getComponents(s)) {
+            for (const auto& sc : ensemble->getComponents(s)) {
                 nlohmann::json j_sc = {
                     {"componentnr", sc.componentNr},
                     {"primary", (sc.PS_flag ? true : false)},
@@ -663,7 +617,7 @@ bool WebRadioInterface::send_mux_json(Socket& s)
 
                 set_label_json(j_sc, sc.componentLabel);
 
-                const auto& sub = rx->getSubchannel(sc);
+                const auto& sub = ensemble->getSubchannel(sc);
 
                 switch (sc.transportMode()) {
                     case TransportMode::Audio:
@@ -704,11 +658,14 @@ bool WebRadioInterface::send_mux_json(Socket& s)
             }
 
             if (hasAudioComponent) {
-                string urlmp3 = "/mp3/" + to_hex<4>(s.serviceId);
-                j_srv["url_mp3"] = urlmp3;
+                j_srv["url_mp3"] = "/mp3/" + to_hex<4>(s.serviceId);
+                j_srv["url_wav"] = "/wav/" + to_hex<4>(s.serviceId);
+                j_srv["url_untouched"] = "/untouched/" + to_hex<4>(s.serviceId);
             }
             else {
                 j_srv["url_mp3"] = nullptr;
+                j_srv["url_wav"] = nullptr;
+                j_srv["url_untouched"] = nullptr;
             }
 
             j_srv["components"] = j_components;
@@ -756,6 +713,19 @@ bool WebRadioInterface::send_mux_json(Socket& s)
                     j_xpad_err["time"] = chrono::system_clock::to_time_t(xpad_err.time);
                 }
                 j_srv["xpaderror"] = j_xpad_err;
+
+                auto clients_json = [&](AudioFormat format) {
+                    nlohmann::json j_clients = nlohmann::json::array();
+                    for (const auto& stats : wph.getSenderStats(format)) {
+                        j_clients.push_back({
+                                {"queued", stats.queued},
+                                {"dropped", stats.dropped}});
+                    }
+                    return j_clients;
+                };
+                j_srv["mp3clients"] = clients_json(AudioFormat::MP3);
+                j_srv["wavclients"] = clients_json(AudioFormat::WAV);
+                j_srv["untouchedclients"] = clients_json(AudioFormat::Untouched);
             }
             catch (const out_of_range&) {
                 j_srv["audiolevel"] = nullptr;
@@ -814,7 +784,7 @@ bool WebRadioInterface::send_mux_json(Socket& s)
 
         j["utctime"] = j_utc;
 
-        j["demodulator"]["snr"] = last_snr;
+        j["demodulator"]["snr"] = last_snr.load();
         j["demodulator"]["frequencycorrection"] =
             last_fine_correction + last_coarse_correction;
 
@@ -833,21 +803,11 @@ bool WebRadioInterface::send_mux_json(Socket& s)
         j["cir"] = calculate_cir_peaks(last_CIR);
     }
 
-    if (not send_http_response(s, http_ok, "", http_contenttype_json)) {
-        return false;
-    }
-
-    const auto json_str = j.dump();
-
-    ssize_t ret = s.send(json_str.c_str(), json_str.size(), MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send mux.json data" << endl;
-        return false;
-    }
-    return true;
+    return j.dump();
 }
 
-bool WebRadioInterface::send_mp3(Socket& s, const std::string& stream)
+bool WebRadioInterface::send_audio(HttpResponse& r, const std::string& stream,
+        AudioFormat format)
 {
     unique_lock<mutex> lock(rx_mut);
     ASSERT_RX;
@@ -858,40 +818,59 @@ bool WebRadioInterface::send_mp3(Socket& s, const std::string& stream)
                 (uint32_t)std::stoul(stream) == srv.serviceId)) {
             try {
                 auto& ph = phs.at(srv.serviceId);
+                const auto sid = srv.serviceId;
 
-                lock.unlock();
-
-                if (not send_http_response(s, http_ok, "", http_contenttype_mp3)) {
-                    cerr << "Failed to send mp3 headers" << endl;
-                    return false;
+                const char *content_type = http_contenttype_mp3;
+                if (format == AudioFormat::WAV) {
+                    content_type = http_contenttype_wav;
+                }
+                else if (format == AudioFormat::Untouched) {
+                    for (const auto& sc : rx->getComponents(srv)) {
+                        if (sc.transportMode() == TransportMode::Audio and
+                                sc.audioType() == AudioServiceComponentType::DABPlus) {
+                            content_type = http_contenttype_aac;
+                        }
+                    }
                 }
 
-                ProgrammeSender sender(move(s));
+                set_http_response(r, http_ok, "", content_type);
+                r.stream = make_shared<HttpStream>(audio_queue_length);
 
-                cerr << "Registering mp3 sender" << endl;
-                ph.registerSender(&sender);
+                cerr << "Registering audio sender" << endl;
+                ph.registerSender(format, r.stream);
+                lock.unlock();
                 check_decoders_required();
-                sender.wait_for_termination();
 
-                cerr << "Removing mp3 sender" << endl;
-                ph.removeSender(&sender);
-                check_decoders_required();
+                // The handler might have been removed in the meantime,
+                // e.g. after a retune.
+                auto sender = r.stream;
+                r.on_close = [this, sid, sender, format]() {
+                    cerr << "Removing audio sender" << endl;
+                    {
+                        lock_guard<mutex> lock(rx_mut);
+                        auto it = phs.find(sid);
+                        if (it != phs.end()) {
+                            it->second.removeSender(format, sender);
+                        }
+                    }
+                    check_decoders_required();
+                };
 
                 return true;
             }
             catch (const out_of_range& e) {
-                cerr << "Could not setup mp3 sender for " <<
+                cerr << "Could not setup audio sender for " <<
                     srv.serviceId << ": " << e.what() << endl;
 
-                send_http_response(s, http_503, e.what());
-                return false;
+                set_http_response(r, http_503, e.what());
+                return true;
             }
         }
     }
     return false;
 }
 
-bool WebRadioInterface::send_slide(Socket& s, const std::string& stream)
+bool WebRadioInterface::send_slide(HttpResponse& r, const std::string& stream)
 {
     for (const auto& wph : phs) {
         if (to_hex<4>(wph.first) == stream or
@@ -899,13 +878,11 @@ bool WebRadioInterface::send_slide(Socket& s, const std::string& stream)
             const auto mot = wph.second.getMOT();
 
             if (mot.data.empty()) {
-                send_http_response(s, http_404, "404 Not Found\r\nSlide not available.\r\n");
+                set_http_response(r, http_404, "404 Not Found\r\nSlide not available.\r\n");
                 return true;
             }
 
             stringstream headers;
-            headers << http_ok;
-
             headers << "Content-Type: ";
             switch (mot.subtype) {
                 case MOTType::Unknown:
@@ -924,204 +901,137 @@ bool WebRadioInterface::send_slide(Socket& s, const std::string& stream)
             std::time_t t = chrono::system_clock::to_time_t(mot.time);
             headers << put_time(std::gmtime(&t), "%a, %d %b %Y %T GMT");
             headers << "\r\n";
-            headers << "\r\n";
-            const auto headers_str = headers.str();
-            int ret = s.send(headers_str.data(), headers_str.size(), MSG_NOSIGNAL);
-            if (ret == 0) {
-                ret = s.send(mot.data.data(), mot.data.size(), MSG_NOSIGNAL);
-            }
-
-            if (ret == -1) {
-                cerr << "Failed to send slide" << endl;
-            }
 
+            r.status = http_ok;
+            r.headers = headers.str();
+            r.body.assign(mot.data.begin(), mot.data.end());
             return true;
         }
     }
     return false;
 }
 
-bool WebRadioInterface::send_fic(Socket& s)
+bool WebRadioInterface::send_fic(HttpResponse& r)
 {
-    if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
-        cerr << "Failed to send FIC headers" << endl;
-        return false;
-    }
-
-    while (true) {
-        unique_lock<mutex> lock(fib_mut);
-        while (fib_blocks.empty()) {
-            new_fib_block_available.wait_for(lock, chrono::seconds(1));
-        }
-        ssize_t ret = s.send(fib_blocks.front().data(),
-                fib_blocks.front().size(), MSG_NOSIGNAL);
-        if (ret == -1) {
-            cerr << "Failed to send FIC data" << endl;
-            return false;
-        }
+    set_http_response(r, http_ok, "", http_contenttype_data);
+    r.stream = make_shared<HttpStream>(fic_queue_length);
 
-        fib_blocks.pop_front();
-    }
+    lock_guard<mutex> lock(fib_mut);
+    fic_streams.push_back(r.stream);
     return true;
 }
 
-bool WebRadioInterface::send_impulseresponse(Socket& s)
+// Send the floats as raw data
+static void set_float_response(HttpResponse& r, const vector<float>& data)
 {
-    if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
-        cerr << "Failed to send CIR headers" << endl;
-        return false;
-    }
-
-    lock_guard<mutex> lock(plotdata_mut);
-    vector<float> cir_db(last_CIR.size());
-    std::transform(last_CIR.begin(), last_CIR.end(), cir_db.begin(),
-            [](float y) { return 10.0f * log10(y); });
-
-    size_t lengthBytes = cir_db.size() * sizeof(float);
-    ssize_t ret = s.send(cir_db.data(), lengthBytes, MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send CIR data" << endl;
-        return false;
-    }
-
-    return true;
+    set_http_response(r, http_ok, "", http_contenttype_data);
+    const char *bytes = reinterpret_cast<const char*>(data.data());
+    r.body.assign(bytes, bytes + data.size() * sizeof(float));
 }
 
-static bool send_fft_data(Socket& s, DSPCOMPLEX *spectrumBuffer, size_t T_u)
+// The URL is valid, but there is no data to show yet
+static void set_plot_unavailable(HttpResponse& r)
 {
-    vector<float> spectrum(T_u);
+    set_http_response(r, http_503, "No data available yet\r\n");
+    r.headers += "Retry-After: 1\r\n";
+}
 
-    // Shift FFT samples
-    const size_t half_Tu = T_u / 2;
-    for (size_t i = 0; i < half_Tu; i++) {
-        spectrum[i] = abs(spectrumBuffer[i + half_Tu]);
-    }
-    for (size_t i = half_Tu; i < T_u; i++) {
-        spectrum[i] = abs(spectrumBuffer[i - half_Tu]);
-    }
+shared_ptr<const WebRadioInterface::plots_t> WebRadioInterface::get_plots()
+{
+    const auto now = chrono::steady_clock::now();
+    last_plot_request = now.time_since_epoch().count();
 
-    if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
-        cerr << "Failed to send spectrum headers" << endl;
-        return false;
+    // Plots calculated before the plot thread went idle are outdated,
+    // and there are none before the plot thread first ran
+    auto p = atomic_load(&plots);
+    if (not p or now - p->time > plot_idle_timeout) {
+        p = refresh_plots();
     }
+    return p;
+}
 
-    size_t lengthBytes = spectrum.size() * sizeof(float);
-    ssize_t ret = s.send(spectrum.data(), lengthBytes, MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send spectrum data" << endl;
-        return false;
+bool WebRadioInterface::send_impulseresponse(HttpResponse& r)
+{
+    const auto p = get_plots();
+    if (p->cir_db.empty()) {
+        set_plot_unavailable(r);
+        return true;
     }
 
+    set_float_response(r, p->cir_db);
     return true;
 }
 
-bool WebRadioInterface::send_spectrum(Socket& s)
+static const vector<float>& select_view(const string& query,
+        const vector<float>& current,
+        const vector<float>& average,
+        const vector<float>& peak)
 {
-    // Get FFT buffer
-    DSPCOMPLEX* spectrumBuffer = spectrum_fft_handler.getVector();
-    auto samples = input.getSpectrumSamples(dabparams.T_u);
-
-    // Continue only if we got data
-    if (samples.size() != (size_t)dabparams.T_u)
-        return false;
-
-    std::copy(samples.begin(), samples.end(), spectrumBuffer);
-
-    // Do FFT to get the spectrum
-    spectrum_fft_handler.do_FFT();
-
-    return send_fft_data(s, spectrumBuffer, dabparams.T_u);
+    if (query == "average") {
+        return average;
+    }
+    else if (query == "peak") {
+        return peak;
+    }
+    return current;
 }
 
-bool WebRadioInterface::send_null_spectrum(Socket& s)
+bool WebRadioInterface::send_spectrum(HttpResponse& r, const std::string& query)
 {
-    // Get FFT buffer
-    DSPCOMPLEX* spectrumBuffer = spectrum_fft_handler.getVector();
-
-    lock_guard<mutex> lock(plotdata_mut);
-    if (last_NULL.empty()) {
-        return false;
-    }
-    else if (last_NULL.size() != (size_t)dabparams.T_null) {
-        cerr << "Invalid NULL size " << last_NULL.size() << endl;
-        return false;
+    const auto p = get_plots();
+    if (p->spectrum.empty()) {
+        set_plot_unavailable(r);
+        return true;
     }
 
-    copy(last_NULL.begin(), last_NULL.begin() + dabparams.T_u, spectrumBuffer);
+    set_float_response(r, select_view(query,
+                p->spectrum, p->spectrum_average, p->spectrum_peak));
+    return true;
+}
 
-    // Do FFT to get the spectrum
-    spectrum_fft_handler.do_FFT();
+bool WebRadioInterface::send_null_spectrum(HttpResponse& r, const std::string& query)
+{
+    const auto p = get_plots();
+    if (p->null_spectrum.empty()) {
+        set_plot_unavailable(r);
+        return true;
+    }
 
-    return send_fft_data(s, spectrumBuffer, dabparams.T_u);
+    set_float_response(r, select_view(query,
+                p->null_spectrum, p->null_spectrum_average, p->null_spectrum_peak));
+    return true;
 }
 
-bool WebRadioInterface::send_constellation(Socket& s)
+bool WebRadioInterface::send_constellation(HttpResponse& r)
 {
     const size_t decim = OfdmDecoder::constellationDecimation;
     const size_t num_iqpoints = (dabparams.L-1) * dabparams.K / decim;
-    std::vector<float> phases(num_iqpoints);
 
-    lock_guard<mutex> lock(plotdata_mut);
-    if (last_constellation.size() == num_iqpoints) {
-        phases.resize(num_iqpoints);
-        for (size_t i = 0; i < num_iqpoints; i++) {
-            const float y = 180.0f / (float)M_PI * std::arg(last_constellation[i]);
-            phases[i] = y;
-        }
-
-        if (not send_http_response(s, http_ok, "", http_contenttype_data)) {
-            cerr << "Failed to send constellation headers" << endl;
-            return false;
-        }
-
-        size_t lengthBytes = phases.size() * sizeof(float);
-        ssize_t ret = s.send(phases.data(), lengthBytes, MSG_NOSIGNAL);
-        if (ret == -1) {
-            cerr << "Failed to send constellation data" << endl;
-            return false;
-        }
-
-        return true;
+    const auto p = get_plots();
+    if (p->constellation.size() == num_iqpoints) {
+        set_float_response(r, p->constellation);
     }
-
-    return false;
+    else {
+        set_plot_unavailable(r);
+    }
+    return true;
 }
 
-bool WebRadioInterface::send_channel(Socket& s)
+bool WebRadioInterface::send_channel(HttpResponse& r)
 {
     const auto freq = input.getFrequency();
 
     try {
         const auto chan = channels.getChannelForFrequency(freq);
-
-        string response = http_ok;
-        response += http_contenttype_text;
-        response += http_nocache;
-        response += "\r\n";
-        response += chan;
-        ssize_t ret = s.send(response.data(), response.size(), MSG_NOSIGNAL);
-        if (ret == -1) {
-            cerr << "Failed to send frequency" << endl;
-            return false;
-        }
+        set_http_response(r, http_ok, chan);
     }
     catch (const out_of_range& e) {
-        string response = http_500;
-        response += http_contenttype_text;
-        response += http_nocache;
-        response += "\r\n";
-        response += "Error: ";
-        response += e.what();
-        ssize_t ret = s.send(response.data(), response.size(), MSG_NOSIGNAL);
-        if (ret == -1) {
-            cerr << "Failed to send frequency 500" << endl;
-            return false;
-        }
+        set_http_response(r, http_500, string("Error: ") + e.what());
     }
     return true;
 }
 
-bool WebRadioInterface::handle_fft_window_placement_post(Socket& s, const std::string& fft_window_placement)
+bool WebRadioInterface::handle_fft_window_placement_post(HttpResponse& r, const std::string& fft_window_placement)
 {
     cerr << "POST fft window: " << fft_window_placement << endl;
 
@@ -1135,16 +1045,7 @@ bool WebRadioInterface::handle_fft_window_placement_post(Socket& s, const std::s
         rro.fftPlacementMethod = FFTPlacementMethod::ThresholdBeforePeak;
     }
     else {
-        string response = http_400;
-        response += http_contenttype_text;
-        response += http_nocache;
-        response += "\r\n";
-        response += "Invalid FFT Window Placement requested.";
-        ssize_t ret = s.send(response.data(), response.size(), MSG_NOSIGNAL);
-        if (ret == -1) {
-            cerr << "Failed to send frequency" << endl;
-            return false;
-        }
+        set_http_response(r, http_400, "Invalid FFT Window Placement requested.");
         return true;
     }
 
@@ -1154,20 +1055,11 @@ bool WebRadioInterface::handle_fft_window_placement_post(Socket& s, const std::s
         rx->setReceiverOptions(rro);
     }
 
-    string response = http_ok;
-    response += http_contenttype_text;
-    response += http_nocache;
-    response += "\r\n";
-    response += "Switched FFT Window Placement.";
-    ssize_t ret = s.send(response.data(), response.size(), MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send frequency" << endl;
-        return false;
-    }
+    set_http_response(r, http_ok, "Switched FFT Window Placement.");
     return true;
 }
 
-bool WebRadioInterface::handle_coarse_corrector_post(Socket& s, const std::string& coarseCorrector)
+bool WebRadioInterface::handle_coarse_corrector_post(HttpResponse& r, const std::string& coarseCorrector)
 {
     cerr << "POST coarse : " << coarseCorrector << endl;
 
@@ -1178,16 +1070,7 @@ bool WebRadioInterface::handle_coarse_corrector_post(Socket& s, const std::strin
         rro.disable_coarse_corrector = false;
     }
     else {
-        string response = http_400;
-        response += http_contenttype_text;
-        response += http_nocache;
-        response += "\r\n";
-        response += "Invalid coarse corrector selected";
-        ssize_t ret = s.send(response.data(), response.size(), MSG_NOSIGNAL);
-        if (ret == -1) {
-            cerr << "Failed to set response" << endl;
-            return false;
-        }
+        set_http_response(r, http_400, "Invalid coarse corrector selected");
         return true;
     }
 
@@ -1197,38 +1080,434 @@ bool WebRadioInterface::handle_coarse_corrector_post(Socket& s, const std::strin
         rx->setReceiverOptions(rro);
     }
 
-    string response = http_ok;
-    response += http_contenttype_text;
-    response += http_nocache;
-    response += "\r\n";
-    response += "Switched Coarse corrector.";
-    ssize_t ret = s.send(response.data(), response.size(), MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send coarse switch confirmation" << endl;
-        return false;
-    }
+    set_http_response(r, http_ok, "Switched Coarse corrector.");
     return true;
 }
 
-bool WebRadioInterface::handle_channel_post(Socket& s, const std::string& channel)
+bool WebRadioInterface::handle_channel_post(HttpResponse& r, const std::string& channel)
 {
     cerr << "POST channel: " << channel << endl;
 
     retune(channel);
 
-    string response = http_ok;
-    response += http_contenttype_text;
-    response += http_nocache;
-    response += "\r\n";
-    response += "Retuning...";
-    ssize_t ret = s.send(response.data(), response.size(), MSG_NOSIGNAL);
-    if (ret == -1) {
-        cerr << "Failed to send frequency" << endl;
-        return false;
+    set_http_response(r, http_ok, "Retuning...");
+    return true;
+}
+
+bool WebRadioInterface::send_events(HttpResponse& r)
+{
+    r.status = http_ok;
+    r.headers = "Content-Type: text/event-stream\r\n";
+    r.headers += http_nocache;
+    r.stream = make_shared<HttpStream>(telemetry_queue_length);
+
+    lock_guard<mutex> lock(telemetry_mut);
+    // Deltas are meaningless without the state they apply to
+    if (last_telemetry_full) {
+        r.stream->push(last_telemetry_full);
     }
+    telemetry_streams.push_back(r.stream);
     return true;
 }
 
+// Write the HELP and TYPE lines that precede the samples of a metric
+static void metric_header(ostringstream& ss, const char *name,
+        const char *type, const char *help)
+{
+    ss << "# HELP " << name << " " << help << "\n";
+    ss << "# TYPE " << name << " " << type << "\n";
+}
+
+bool WebRadioInterface::send_metrics(HttpResponse& r)
+{
+    // None of the counters below takes a lock that the decoder holds
+    ReceiverStats stats;
+    struct service_metrics_t {
+        string sid;
+        WebProgrammeHandler::errorcounters_t ec;
+        map<AudioFormat, vector<HttpStream::stats_t> > senders;
+    };
+    const vector<pair<AudioFormat, const char*> > formats = {
+        {AudioFormat::MP3, "mp3"},
+        {AudioFormat::WAV, "wav"},
+        {AudioFormat::Untouched, "untouched"}};
+    vector<service_metrics_t> services;
+    {
+        lock_guard<mutex> lock(rx_mut);
+        if (rx) {
+            stats = rx->getStats();
+        }
+
+        for (const auto& ph : phs) {
+            service_metrics_t m;
+            m.sid = to_hex<4>(ph.first);
+            m.ec = ph.second.getErrorCounters();
+            for (const auto& f : formats) {
+                m.senders[f.first] = ph.second.getSenderStats(f.first);
+            }
+            services.push_back(move(m));
+        }
+    }
+
+    ostringstream ss;
+    ss.imbue(std::locale::classic());
+
+    metric_header(ss, "welle_synced", "gauge",
+            "1 when the receiver is synchronised to the signal");
+    ss << "welle_synced " << (synced ? 1 : 0) << "\n";
+
+    metric_header(ss, "welle_snr", "gauge", "Signal to noise ratio in dB");
+    ss << "welle_snr " << last_snr << "\n";
+
+    metric_header(ss, "welle_frequency_correction_hz", "gauge",
+            "Frequency correction applied to the input");
+    ss << "welle_frequency_correction_hz " <<
+        last_fine_correction + last_coarse_correction << "\n";
+
+    metric_header(ss, "welle_input_samples_queued", "gauge",
+            "Input samples waiting to be processed");
+    ss << "welle_input_samples_queued " << input.getSamplesToRead() << "\n";
+
+    metric_header(ss, "welle_ofdm_pending_frames", "gauge",
+            "Frames waiting for the OFDM decoder");
+    ss << "welle_ofdm_pending_frames " << stats.numPendingFrames << "\n";
+
+    metric_header(ss, "welle_dropped_frames_total", "counter",
+            "Frames dropped because the OFDM decoder did not keep up");
+    ss << "welle_dropped_frames_total " << stats.numDroppedFrames << "\n";
+
+    metric_header(ss, "welle_fibs_total", "counter", "FIBs received");
+    ss << "welle_fibs_total " << num_fibs << "\n";
+
+    metric_header(ss, "welle_fic_crc_errors_total", "counter",
+            "FIBs with a CRC error");
+    ss << "welle_fic_crc_errors_total " << num_fic_crc_errors << "\n";
+
+    metric_header(ss, "welle_cpu_seconds_total", "counter",
+            "CPU time used by the decoding threads");
+    ss << "welle_cpu_seconds_total{stage=\"ofdm_processor\"} " <<
+        stats.ofdmProcessorCpuTimeNs / 1e9 << "\n";
+    ss << "welle_cpu_seconds_total{stage=\"ofdm_decoder\"} " <<
+        stats.ofdmDecoderCpuTimeNs / 1e9 << "\n";
+
+    const auto& h = stats.frameDecodeTime;
+    metric_header(ss, "welle_ofdm_frame_decode_seconds", "histogram",
+            "Time the OFDM decoder needs for one transmission frame");
+    for (size_t i = 0; i < h.cumulative_counts.size(); i++) {
+        ss << "welle_ofdm_frame_decode_seconds_bucket{le=\"";
+        if (i < h.bounds.size()) {
+            ss << h.bounds[i];
+        }
+        else {
+            ss << "+Inf";
+        }
+        ss << "\"} " << h.cumulative_counts[i] << "\n";
+    }
+    ss << "welle_ofdm_frame_decode_seconds_sum " << h.sum << "\n";
+    ss << "welle_ofdm_frame_decode_seconds_count " <<
+        (h.cumulative_counts.empty() ? 0 : h.cumulative_counts.back()) << "\n";
+
+    metric_header(ss, "welle_frame_errors_total", "counter",
+            "Audio superframes that failed the firecode check");
+    for (const auto& s : services) {
+        ss << "welle_frame_errors_total{sid=\"" << s.sid << "\"} " <<
+            s.ec.num_frameErrors << "\n";
+    }
+
+    metric_header(ss, "welle_rs_errors_total", "counter",
+            "Audio superframes with uncorrectable Reed-Solomon errors");
+    for (const auto& s : services) {
+        ss << "welle_rs_errors_total{sid=\"" << s.sid << "\"} " <<
+            s.ec.num_rsErrors << "\n";
+    }
+
+    metric_header(ss, "welle_aac_errors_total", "counter",
+            "AAC access units that could not be decoded");
+    for (const auto& s : services) {
+        ss << "welle_aac_errors_total{sid=\"" << s.sid << "\"} " <<
+            s.ec.num_aacErrors << "\n";
+    }
+
+    metric_header(ss, "welle_audio_clients", "gauge",
+            "Clients listening to the audio stream");
+    for (const auto& s : services) {
+        for (const auto& f : formats) {
+            ss << "welle_audio_clients{sid=\"" << s.sid <<
+                "\",format=\"" << f.second << "\"} " <<
+                s.senders.at(f.first).size() << "\n";
+        }
+    }
+
+    metric_header(ss, "welle_audio_dropped_total", "counter",
+            "Audio data dropped because the clients did not keep up");
+    for (const auto& s : services) {
+        for (const auto& f : formats) {
+            size_t dropped = 0;
+            for (const auto& sender : s.senders.at(f.first)) {
+                dropped += sender.dropped;
+            }
+            ss << "welle_audio_dropped_total{sid=\"" << s.sid <<
+                "\",format=\"" << f.second << "\"} " << dropped << "\n";
+        }
+    }
+
+    set_http_response(r, http_ok, ss.str(),
+            "Content-Type: text/plain; version=0.0.4\r\n");
+    return true;
+}
+
+// Reduce the values to at most num_points by taking the maximum of
+// each group, and round them to integers. Linear values are converted
+// to dB with scale * log10(value), when scale is not zero.
+static nlohmann::json decimate(const vector<float>& values,
+        size_t num_points, float scale)
+{
+    nlohmann::json j = nlohmann::json::array();
+    if (values.empty() or num_points == 0) {
+        return j;
+    }
+
+    const size_t group = (values.size() + num_points - 1) / num_points;
+    for (size_t i = 0; i < values.size(); i += group) {
+        const auto end = values.begin() + std::min(i + group, values.size());
+        const float m = *std::max_element(values.begin() + i, end);
+        if (scale == 0) {
+            j.push_back(std::isfinite(m) ? (int)std::lround(m) : -200);
+        }
+        else {
+            j.push_back(m > 0 ? (int)std::lround(scale * log10(m)) : -200);
+        }
+    }
+    return j;
+}
+
+// At most num_points evenly spaced values, rounded. Unlike decimate(), this
+// keeps individual points, as needed for the constellation.
+static nlohmann::json subsample(const vector<float>& values, size_t num_points)
+{
+    nlohmann::json j = nlohmann::json::array();
+    if (values.empty() or num_points == 0) {
+        return j;
+    }
+
+    const size_t step = (values.size() + num_points - 1) / num_points;
+    for (size_t i = 0; i < values.size(); i += step) {
+        j.push_back((int)std::lround(values[i]));
+    }
+    return j;
+}
+
+static HttpStream::data_t make_event(const string& name, const nlohmann::json& j)
+{
+    const string ev = "event: " + name + "\ndata: " + j.dump() + "\n\n";
+    return make_shared<const vector<uint8_t> >(ev.begin(), ev.end());
+}
+
+nlohmann::json WebRadioInterface::collect_telemetry(const plots_t& p)
+{
+    nlohmann::json j;
+
+    j["snr"] = last_snr.load();
+    j["frequencycorrection"] = last_fine_correction + last_coarse_correction;
+    j["synced"] = synced.load();
+    j["ficcrcerrors"] = num_fic_crc_errors.load();
+
+    {
+        lock_guard<mutex> lock(rx_mut);
+        if (rx) {
+            j["numdroppedframes"] = rx->getNumDroppedFrames();
+        }
+
+        nlohmann::json j_services = nlohmann::json::object();
+        for (const auto& ph : phs) {
+            const auto ec = ph.second.getErrorCounters();
+            const auto al = ph.second.getAudioLevels();
+            j_services[to_hex<4>(ph.first)] = {
+                {"frameerrors", ec.num_frameErrors},
+                {"rserrors", ec.num_rsErrors},
+                {"aacerrors", ec.num_aacErrors},
+                {"audiolevel", {al.last_audioLevel_L, al.last_audioLevel_R}}};
+        }
+        j["services"] = j_services;
+    }
+
+    j["spectrum"] = decimate(p.spectrum, telemetry_plot_points, 20.0f);
+    j["cir"] = decimate(p.cir_db, telemetry_plot_points, 0);
+    j["constellation"] = subsample(p.constellation, telemetry_plot_points);
+
+    {
+        lock_guard<mutex> lock(plotdata_mut);
+        j["cirpeaks"] = calculate_cir_peaks(last_CIR);
+    }
+
+    return j;
+}
+
+// Exponential average of the power, and peak-hold with decay,
+// of the magnitudes in values
+static void update_average_and_peak(const vector<float>& values,
+        vector<float>& average, vector<float>& peak)
+{
+    const float alpha = 0.1f;
+    const float peak_decay = 0.995f;
+
+    if (average.size() != values.size() or peak.size() != values.size()) {
+        average = values;
+        peak = values;
+        return;
+    }
+
+    for (size_t i = 0; i < values.size(); i++) {
+        const float v = values[i];
+        average[i] = sqrtf((1 - alpha) * average[i] * average[i] + alpha * v * v);
+        peak[i] = std::max(v, peak[i] * peak_decay);
+    }
+}
+
+// FFT of the first T_u samples, shifted so that DC is in the middle,
+// as magnitudes
+static void fft_magnitudes(fft::Forward& fft, const DSPCOMPLEX *samples,
+        int32_t T_u, vector<float>& magnitudes)
+{
+    DSPCOMPLEX *buffer = fft.getVector();
+    std::copy(samples, samples + T_u, buffer);
+    fft.do_FFT();
+
+    magnitudes.resize(T_u);
+    for (int32_t i = 0; i < T_u; i++) {
+        magnitudes[i] = abs(buffer[(i + T_u / 2) % T_u]);
+    }
+}
+
+void WebRadioInterface::update_plots(plots_t& p)
+{
+    const int32_t T_u = dabparams.T_u;
+
+    const auto samples = input.getSpectrumSamples(T_u);
+    if (samples.size() == (size_t)T_u) {
+        fft_magnitudes(plot_fft_handler, samples.data(), T_u, p.spectrum);
+        update_average_and_peak(p.spectrum, p.spectrum_average, p.spectrum_peak);
+    }
+
+    // Every NULL symbol and CIR only gets processed once, so that the
+    // averages are not biased by the plot interval.
+    vector<DSPCOMPLEX> null_symbol;
+    vector<float> cir;
+    {
+        lock_guard<mutex> lock(plotdata_mut);
+        swap(null_symbol, last_NULL);
+        if (cir_updated) {
+            cir = last_CIR;
+            cir_updated = false;
+        }
+
+        p.constellation.resize(last_constellation.size());
+        for (size_t i = 0; i < last_constellation.size(); i++) {
+            p.constellation[i] = 180.0f / (float)M_PI * std::arg(last_constellation[i]);
+        }
+    }
+
+    if (null_symbol.size() == (size_t)dabparams.T_null) {
+        fft_magnitudes(plot_fft_handler, null_symbol.data(), T_u, p.null_spectrum);
+        update_average_and_peak(p.null_spectrum,
+                p.null_spectrum_average, p.null_spectrum_peak);
+    }
+    else if (not null_symbol.empty()) {
+        cerr << "Invalid NULL size " << null_symbol.size() << endl;
+    }
+
+    if (not cir.empty()) {
+        p.cir_db.resize(cir.size());
+        std::transform(cir.begin(), cir.end(), p.cir_db.begin(),
+                [](float y) { return 10.0f * log10(y); });
+    }
+
+    p.time = chrono::steady_clock::now();
+}
+
+void WebRadioInterface::send_telemetry(const plots_t& p, size_t tick,
+        std::map<std::string, std::string>& last_values)
+{
+    // Computed once per tick for all subscribers
+    const auto j = collect_telemetry(p);
+
+    // Only the values that changed are sent, except every
+    // telemetry_full_interval ticks, so that clients that lost
+    // an event catch up.
+    const bool send_full = (tick % telemetry_full_interval) == 0;
+    nlohmann::json delta = nlohmann::json::object();
+    for (auto it = j.begin(); it != j.end(); ++it) {
+        auto value = it.value().dump();
+        auto& last = last_values[it.key()];
+        if (send_full or last != value) {
+            delta[it.key()] = it.value();
+            last = move(value);
+        }
+    }
+
+    const auto full_event = make_event("full", j);
+    const auto event = send_full ? full_event : make_event("delta", delta);
+
+    lock_guard<mutex> lock(telemetry_mut);
+    last_telemetry_full = full_event;
+    for (auto it = telemetry_streams.begin(); it != telemetry_streams.end();) {
+        if ((*it)->push(event)) {
+            ++it;
+        }
+        else {
+            it = telemetry_streams.erase(it);
+        }
+    }
+}
+
+shared_ptr<const WebRadioInterface::plots_t> WebRadioInterface::refresh_plots()
+{
+    lock_guard<mutex> lock(plots_mut);
+    update_plots(plot_state);
+    auto p = make_shared<const plots_t>(plot_state);
+    atomic_store(&plots, p);
+    return p;
+}
+
+void WebRadioInterface::handle_plots()
+{
+    std::map<string, string> last_telemetry_values;
+    size_t telemetry_tick = 0;
+    auto next_telemetry = chrono::steady_clock::now();
+
+    while (plot_running) {
+        this_thread::sleep_for(decode_settings.plot_interval);
+        const auto now = chrono::steady_clock::now();
+
+        bool has_subscribers = false;
+        {
+            lock_guard<mutex> lock(telemetry_mut);
+            has_subscribers = not telemetry_streams.empty();
+            if (not has_subscribers) {
+                last_telemetry_full.reset();
+            }
+        }
+
+        if (not has_subscribers) {
+            last_telemetry_values.clear();
+        }
+
+        // Nothing is calculated while nobody looks at the plots
+        const auto last_request = chrono::steady_clock::time_point(
+                chrono::steady_clock::duration(last_plot_request.load()));
+        if (not has_subscribers and now - last_request > plot_idle_timeout) {
+            continue;
+        }
+
+        const auto p = refresh_plots();
+
+        if (has_subscribers and now >= next_telemetry) {
+            next_telemetry = now + telemetry_interval;
+            send_telemetry(*p, telemetry_tick++, last_telemetry_values);
+        }
+    }
+}
+
 void WebRadioInterface::handle_phs()
 {
     while (running) {
@@ -1353,6 +1632,14 @@ void WebRadioInterface::handle_phs()
         }
     }
 
+    // The telemetry and the HTTP handlers read phs with rx_mut held
+    lock_guard<mutex> lock(rx_mut);
+
+    // Disconnect the mp3 clients of the old handlers
+    for (auto& ph : phs) {
+        ph.second.cancelAll();
+    }
+
     phs.clear();
     programmes_being_decoded.clear();
     carousel_services_available.clear();
@@ -1371,8 +1658,6 @@ const int sig_caught = 0;
 
 void WebRadioInterface::serve()
 {
-    deque<future<bool> > running_connections;
-
 #if HAVE_SIGACTION
     struct sigaction sa = {};
     sa.sa_handler = handler;
@@ -1382,39 +1667,18 @@ void WebRadioInterface::serve()
     }
 #endif
 
-    while (sig_caught == 0) {
-        auto client = serverSocket.accept();
-
-        running_connections.push_back(async(launch::async,
-                    &WebRadioInterface::dispatch_client, this, move(client)));
-
-        deque<future<bool> > still_running_connections;
-        for (auto& fut : running_connections) {
-            if (fut.valid()) {
-                switch (fut.wait_for(chrono::milliseconds(1))) {
-                    case future_status::deferred:
-                    case future_status::timeout:
-                        still_running_connections.push_back(move(fut));
-                        break;
-                    case future_status::ready:
-                        fut.get();
-                        break;
-                }
-            }
-        }
-        running_connections = move(still_running_connections);
-    }
+    HttpReactor reactor(serverSocket,
+            [this](const HttpRequest& req) { return handle_request(req); });
+    reactor.run([]() { return sig_caught == 0; });
 }
 
 void WebRadioInterface::onSNR(int snr)
 {
-    lock_guard<mutex> lock(data_mut);
     last_snr = snr;
 }
 
 void WebRadioInterface::onFrequencyCorrectorChange(int fine, int coarse)
 {
-    lock_guard<mutex> lock(data_mut);
     last_fine_correction = fine;
     last_coarse_correction = coarse;
 }
@@ -1435,42 +1699,33 @@ void WebRadioInterface::onDateTimeUpdate(const dab_date_time_t& dateTime)
     last_dateTime = dateTime;
 }
 
-void WebRadioInterface::onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib)
+void WebRadioInterface::onFIBDecodeSuccessPacked(bool crcCheckOk, const uint8_t* fib)
 {
     if (not crcCheckOk) {
-        lock_guard<mutex> lock(fib_mut);
         num_fic_crc_errors++;
         return;
     }
+    num_fibs++;
 
-    // Convert the fib bitvector to bytes
-    vector<uint8_t> buf(32);
-    for (size_t i = 0; i < buf.size(); i++) {
-        uint8_t v = 0;
-        for (int j = 0; j < 8; j++) {
-            if (fib[8*i+j]) {
-                v |= 1 << (7-j);
-            }
-        }
-        buf[i] = v;
-    }
-
-    {
-        lock_guard<mutex> lock(fib_mut);
-        fib_blocks.push_back(move(buf));
+    const auto buf = make_shared<const vector<uint8_t> >(fib, fib + 32);
 
-        if (fib_blocks.size() > 3*250) { // six seconds
-            fib_blocks.pop_front();
+    lock_guard<mutex> lock(fib_mut);
+    for (auto it = fic_streams.begin(); it != fic_streams.end();) {
+        // A closed stream means the client is gone
+        if ((*it)->push(buf)) {
+            ++it;
+        }
+        else {
+            it = fic_streams.erase(it);
         }
     }
-
-    new_fib_block_available.notify_one();
 }
 
 void WebRadioInterface::onNewImpulseResponse(std::vector<float>&& data)
 {
     lock_guard<mutex> lock(plotdata_mut);
     last_CIR = move(data);
+    cir_updated = true;
 }
 
 void WebRadioInterface::onNewNullSymbol(std::vector<DSPCOMPLEX>&& data)
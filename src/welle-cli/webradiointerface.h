@@ -36,6 +36,8 @@
 #include "backend/radio-receiver.h"
 #include "various/Socket.h"
 #include "various/channels.h"
+#include "welle-cli/httpreactor.h"
+#include "libs/json.hpp"
 #include "webprogrammehandler.h"
 
 class WebRadioInterface : public RadioControllerInterface {
@@ -58,6 +60,16 @@ class WebRadioInterface : public RadioControllerInterface {
         struct DecodeSettings {
             DecodeStrategy strategy = DecodeStrategy::OnDemand;
             int num_decoders_in_carousel = 0;
+
+            /* The mux.json is regenerated at most that often, all
+             * clients polling in between get the same document. */
+            std::chrono::milliseconds mux_json_max_age =
+                std::chrono::milliseconds(500);
+
+            /* The spectrum, CIR and constellation are calculated
+             * that often, while there are clients for them. */
+            std::chrono::milliseconds plot_interval =
+                std::chrono::milliseconds(100);
         };
 
         WebRadioInterface(
@@ -79,7 +91,7 @@ class WebRadioInterface : public RadioControllerInterface {
         virtual void onNewEnsemble(uint16_t eId) override;
         virtual void onSetEnsembleLabel(DabLabel& label) override;
         virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) override;
-        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override;
+        virtual void onFIBDecodeSuccessPacked(bool crcCheckOk, const uint8_t* fib) override;
         virtual void onNewImpulseResponse(std::vector<float>&& data) override;
         virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& data) override;
         virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) override;
@@ -91,51 +103,104 @@ class WebRadioInterface : public RadioControllerInterface {
         std::mutex retune_mut;
         void retune(const std::string& channel);
 
-        bool dispatch_client(Socket&& client);
+        // Called by the HttpReactor for every request. Each of the
+        // following functions fills the response, and returns false
+        // if it cannot handle the request.
+        HttpResponse handle_request(const HttpRequest& req);
+
         // Send a file
-        bool send_file(Socket& s,
+        bool send_file(HttpResponse& r,
                 const std::string& filename,
                 const std::string& content_type);
 
-        // Generate and send the mux.json
-        bool send_mux_json(Socket& s);
+        // Send the mux.json, supporting If-None-Match and gzip
+        bool send_mux_json(const HttpRequest& req, HttpResponse& r);
+        std::string generate_mux_json();
+
+        struct mux_json_cache_t {
+            std::string body;
+            std::string gzipped_body;
+            std::string etag;
+            std::chrono::time_point<std::chrono::steady_clock> time;
+            uint32_t ensemble_generation = 0;
+            std::chrono::time_point<std::chrono::system_clock> rx_created;
+        };
+        std::mutex mux_json_mut;
+        mux_json_cache_t mux_json;
 
-        // Send an mp3 stream containing the selected programme.
+        // Send the audio of the selected programme in the given format.
         // stream is a service id, either in hex with 0x prefix or
         // in decimal
-        bool send_mp3(Socket& s, const std::string& stream);
+        bool send_audio(HttpResponse& r, const std::string& stream,
+                AudioFormat format);
 
         // Send the slide for the selected programme.
         // stream is a service id, either in hex with 0x prefix or
         // in decimal
-        bool send_slide(Socket& s, const std::string& stream);
+        bool send_slide(HttpResponse& r, const std::string& stream);
 
         // Send the Fast Information Channel as a stream.
         // Every FIB is 32 bytes long, there three FIBs per 24ms interval,
         // which gives 32000 bits/s
-        bool send_fic(Socket& s);
+        bool send_fic(HttpResponse& r);
+
+        // Send the telemetry as Server-Sent Events. The first event is
+        // named "full" and holds the complete state, the following "delta"
+        // events only contain the fields that changed.
+        bool send_events(HttpResponse& r);
+
+        // Send the counters in the Prometheus text format
+        bool send_metrics(HttpResponse& r);
 
         // Send the impulse response, in dB, as a sequence of float values.
-        bool send_impulseresponse(Socket& s);
+        bool send_impulseresponse(HttpResponse& r);
 
-        // Send the signal spectrum, in dB, as a sequence of float values.
-        bool send_spectrum(Socket& s);
-        bool send_null_spectrum(Socket& s);
+        // Send the signal spectrum magnitude as a sequence of float values.
+        // The query "average" selects the averaged spectrum, and "peak"
+        // the peak-hold spectrum.
+        bool send_spectrum(HttpResponse& r, const std::string& query);
+        bool send_null_spectrum(HttpResponse& r, const std::string& query);
 
         // Send the constellation points, a sequence of phases between -180 and 180 .
-        bool send_constellation(Socket& s);
+        bool send_constellation(HttpResponse& r);
 
         // Send the currently tuned channel
-        bool send_channel(Socket& s);
+        bool send_channel(HttpResponse& r);
 
         // Handle a POSTs
-        bool handle_fft_window_placement_post(Socket& s, const std::string& request);
-        bool handle_coarse_corrector_post(Socket& s, const std::string& request);
+        bool handle_fft_window_placement_post(HttpResponse& r, const std::string& request);
+        bool handle_coarse_corrector_post(HttpResponse& r, const std::string& request);
 
         // Handle a POST to /channel that will tune the receiver
-        bool handle_channel_post(Socket& s, const std::string& request);
+        bool handle_channel_post(HttpResponse& r, const std::string& request);
 
         void handle_phs();
+
+        /* The plots are calculated by the plot_thread, and replaced as a
+         * whole, so that requests only need to take a reference to the
+         * current ones. While the plot_thread is idle, the request
+         * calculates them itself. */
+        struct plots_t {
+            std::chrono::time_point<std::chrono::steady_clock> time;
+            std::vector<float> spectrum;
+            std::vector<float> spectrum_average;
+            std::vector<float> spectrum_peak;
+            std::vector<float> null_spectrum;
+            std::vector<float> null_spectrum_average;
+            std::vector<float> null_spectrum_peak;
+            std::vector<float> cir_db;
+            // Phases in degrees
+            std::vector<float> constellation;
+        };
+
+        std::shared_ptr<const plots_t> get_plots();
+        // Update and publish the plots
+        std::shared_ptr<const plots_t> refresh_plots();
+        void handle_plots();
+        void update_plots(plots_t& p);
+        void send_telemetry(const plots_t& p, size_t tick,
+                std::map<std::string, std::string>& last_values);
+        nlohmann::json collect_telemetry(const plots_t& p);
         void check_decoders_required();
         std::list<tii_measurement_t> getTiiStats();
 
@@ -145,16 +210,21 @@ class WebRadioInterface : public RadioControllerInterface {
         Channels channels;
         DABParams dabparams;
         CVirtualInput& input;
-        fft::Forward spectrum_fft_handler;
+        fft::Forward plot_fft_handler;
 
         RadioReceiverOptions rro;
         DecodeSettings decode_settings;
 
+        // Updated by the decoder without locking, read by the
+        // mux.json, telemetry and /metrics
+        std::atomic<bool> synced = ATOMIC_VAR_INIT(false);
+        std::atomic<int> last_snr = ATOMIC_VAR_INIT(0);
+        std::atomic<int> last_fine_correction = ATOMIC_VAR_INIT(0);
+        std::atomic<int> last_coarse_correction = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> num_fibs = ATOMIC_VAR_INIT(0);
+        std::atomic<size_t> num_fic_crc_errors = ATOMIC_VAR_INIT(0);
+
         mutable std::mutex data_mut;
-        bool synced = 0;
-        int last_snr = 0;
-        int last_fine_correction = 0;
-        int last_coarse_correction = 0;
         dab_date_time_t last_dateTime;
 
         struct pending_message_t {
@@ -169,11 +239,38 @@ class WebRadioInterface : public RadioControllerInterface {
         std::vector<float> last_CIR;
         std::vector<DSPCOMPLEX> last_NULL;
         std::vector<DSPCOMPLEX> last_constellation;
+        bool cir_updated = false;
+
+        // The plot thread stops calculating when there have been no
+        // requests for that long
+        const std::chrono::seconds plot_idle_timeout = std::chrono::seconds(5);
+        std::thread plot_thread;
+        std::atomic<bool> plot_running = ATOMIC_VAR_INIT(true);
+        std::atomic<std::chrono::steady_clock::rep> last_plot_request =
+            ATOMIC_VAR_INIT(0);
+        std::shared_ptr<const plots_t> plots;
+        // Protects the state of the plot calculation, including the
+        // averages, and the plot_fft_handler
+        std::mutex plots_mut;
+        plots_t plot_state;
+
+        // Number of audio frames and FIBs that are queued for each client
+        static const size_t audio_queue_length = 64;
+        static const size_t fic_queue_length = 3*250; // six seconds
 
         mutable std::mutex fib_mut;
-        size_t num_fic_crc_errors = 0;
-        std::condition_variable new_fib_block_available;
-        std::deque<std::vector<uint8_t> > fib_blocks;
+        std::list<std::shared_ptr<HttpStream> > fic_streams;
+
+        // The telemetry is calculated once per interval by the
+        // plot_thread, and the same events are sent to all clients
+        const std::chrono::milliseconds telemetry_interval =
+            std::chrono::milliseconds(500);
+        static const size_t telemetry_queue_length = 8;
+        static const size_t telemetry_full_interval = 20;
+        static const size_t telemetry_plot_points = 256;
+        std::mutex telemetry_mut;
+        std::list<std::shared_ptr<HttpStream> > telemetry_streams;
+        HttpStream::data_t last_telemetry_full;
 
         using comb_pattern_t = std::pair<int, int>;
 
@@ -31,13 +31,16 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <condition_variable>
 #include <deque>
 #include <iostream>
+#include <list>
 #include <memory>
 #include <mutex>
 #include <thread>
 #include <set>
+#include <sstream>
 #include <utility>
 #include <cstdio>
 #include <unistd.h>
@@ -50,9 +53,11 @@
 #include "welle-cli/webradiointerface.h"
 #include "welle-cli/tests.h"
 #include "backend/radio-receiver.h"
+#include "input/channelizer.h"
 #include "input/input_factory.h"
 #include "input/raw_file.h"
 #include "various/channels.h"
+#include "various/fft.h"
 #include "libs/json.hpp"
 extern "C" {
 #include "various/wavfile.h"
@@ -211,25 +216,13 @@ class RadioInterface : public RadioControllerInterface {
             }
         }
 
-        virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override {
+        virtual void onFIBDecodeSuccessPacked(bool crcCheckOk, const uint8_t* fib) override {
             if (fic_fd) {
                 if (not crcCheckOk) {
                     return;
                 }
 
-                // convert bitvector to byte vector
-                vector<uint8_t> buf(32);
-                for (size_t i = 0; i < buf.size(); i++) {
-                    uint8_t v = 0;
-                    for (int j = 0; j < 8; j++) {
-                        if (fib[8*i+j]) {
-                            v |= 1 << (7-j);
-                        }
-                    }
-                    buf[i] = v;
-                }
-
-                fwrite(buf.data(), buf.size(), sizeof(buf[0]), fic_fd);
+                fwrite(fib, 32, sizeof(fib[0]), fic_fd);
             }
         }
         virtual void onNewImpulseResponse(std::vector<float>&& data) override { (void)data; }
@@ -282,7 +275,12 @@ struct options_t {
     bool decode_all_programmes = false;
     int num_decoders_in_carousel = 0;
     bool carousel_pad = false;
+    bool offline = false;
+    vector<string> multi_channels;
     int web_port = -1; // positive value means enable
+    int mux_json_max_age_ms = 500;
+    int plot_interval_ms = 100;
+    string fft_wisdom_file = "";
     list<int> tests;
 
     RadioReceiverOptions rro;
@@ -306,6 +304,14 @@ static void usage()
         "Use -w to enable webserver, decode a programmes on demand." << endl <<
         " welle-cli -c channel -w port" << endl <<
         endl <<
+        "Use -O to decode an IQ file as fast as possible and report the realtime factor." << endl <<
+        "Add -D to also dump all programmes to files." << endl <<
+        " welle-cli -f file -O" << endl <<
+        endl <<
+        "Use -m to receive several adjacent channels at once with one wideband input," << endl <<
+        "the input is tuned between them. Add -D to dump all their programmes to files." << endl <<
+        " welle-cli -m 5A,5B,5C -s driver=lime" << endl <<
+        endl <<
         "Use -Dw to enable webserver, decode all programmes." << endl <<
         " welle-cli -c channel -Dw port" << endl <<
         endl <<
@@ -319,12 +325,18 @@ static void usage()
         " welle-cli -c channel -C 1 -w port" << endl <<
         " welle-cli -c channel -PC 1 -w port" << endl <<
         endl <<
+        "Use -j MS with -w to regenerate the mux.json at most every MS milliseconds (default 500)." << endl <<
+        "Use -k MS with -w to calculate the spectrum, CIR and constellation every MS milliseconds (default 100)." << endl <<
+        endl <<
         "Backend and input options" << endl <<
         " -u      disable coarse corrector, for receivers who have a low frequency offset." << endl <<
         " -g GAIN set input gain to GAIN or -1 for auto gain." << endl <<
         " -s ARGS SoapySDR Driver arguments." << endl <<
         " -A ANT  set input antenna to ANT (for SoapySDR input only)." << endl <<
         " -T      disable TII decoding to reduce CPU usage." << endl <<
+        " -B      decode all selected subchannels with one batched Viterbi decoder." << endl <<
+        " -F N    calculate the OFDM symbol FFTs on N threads." << endl <<
+        " -W FILE load FFTW wisdom from FILE, and save newly measured FFT plans to it." << endl <<
         endl <<
         "Use -t test_number to run a test." << endl <<
         "To understand what the tests do, please see source code." << endl <<
@@ -340,11 +352,14 @@ options_t parse_cmdline(int argc, char **argv)
     options.rro.decodeTII = true;
 
     int opt;
-    while ((opt = getopt(argc, argv, "A:c:C:dDf:g:hp:PTs:t:w:u")) != -1) {
+    while ((opt = getopt(argc, argv, "A:Bc:C:dDf:F:g:hj:k:m:Op:PTs:t:w:W:u")) != -1) {
         switch (opt) {
             case 'A':
                 options.antenna = optarg;
                 break;
+            case 'B':
+                options.rro.batchedMscDeconvolution = true;
+                break;
             case 'c':
                 options.channel = optarg;
                 break;
@@ -360,9 +375,30 @@ options_t parse_cmdline(int argc, char **argv)
             case 'f':
                 options.iqsource = optarg;
                 break;
+            case 'F':
+                options.rro.ofdmFFTThreads = std::atoi(optarg);
+                break;
             case 'g':
                 options.gain = std::atoi(optarg);
                 break;
+            case 'j':
+                options.mux_json_max_age_ms = std::atoi(optarg);
+                break;
+            case 'k':
+                options.plot_interval_ms = std::atoi(optarg);
+                break;
+            case 'm':
+                {
+                    stringstream ss(optarg);
+                    string ch;
+                    while (getline(ss, ch, ',')) {
+                        options.multi_channels.push_back(ch);
+                    }
+                }
+                break;
+            case 'O':
+                options.offline = true;
+                break;
             case 'p':
                 options.programme = optarg;
                 break;
@@ -384,6 +420,9 @@ options_t parse_cmdline(int argc, char **argv)
             case 'w':
                 options.web_port = std::atoi(optarg);
                 break;
+            case 'W':
+                options.fft_wisdom_file = optarg;
+                break;
             case 'u':
                 options.rro.disable_coarse_corrector = true;
                 break;
@@ -398,14 +437,205 @@ options_t parse_cmdline(int argc, char **argv)
         exit(1);
     }
 
+    if (options.offline) {
+        if (options.iqsource.empty()) {
+            cerr << "-O needs an IQ file given with -f" << endl;
+            exit(1);
+        }
+
+        if (options.web_port != -1 or not options.tests.empty()) {
+            cerr << "Cannot combine -O with -w or -t" << endl;
+            exit(1);
+        }
+
+        // Frames must not be dropped when the input is faster than the decoder
+        options.rro.waitForOfdmDecoder = true;
+    }
+
+    if (not options.multi_channels.empty() and
+            (options.offline or options.web_port != -1 or not options.tests.empty())) {
+        cerr << "Cannot combine -m with -O, -w or -t" << endl;
+        exit(1);
+    }
+
     return options;
 }
 
+/* Decode the whole file as fast as possible. With -D, all programmes are
+ * dumped to files as soon as they appear in the service list. */
+static void decode_offline(RadioInterface& ri, CRAWFile& in_file, options_t& options)
+{
+    // The handlers have to outlive the receiver, whose threads call them
+    using SId_t = uint32_t;
+    map<SId_t, WavProgrammeHandler> phs;
+
+    RadioReceiver rx(ri, in_file, options.rro);
+    if (options.decode_all_programmes) {
+        FILE* fic_fd = fopen("dump.fic", "w");
+
+        if (fic_fd) {
+            ri.fic_fd = fic_fd;
+        }
+    }
+
+    const auto start = chrono::steady_clock::now();
+    rx.restart(false);
+
+    // The timeout only sets how often new programmes are looked for
+    while (not rx.waitUntilDecoded(chrono::milliseconds(100))) {
+        if (not options.decode_all_programmes) {
+            continue;
+        }
+
+        for (const auto& s : rx.getServiceList()) {
+            if (phs.count(s.serviceId) or not rx.serviceHasAudioComponent(s)) {
+                continue;
+            }
+
+            string dumpFilePrefix = s.serviceLabel.utf8_label();
+            dumpFilePrefix.erase(std::find_if(dumpFilePrefix.rbegin(), dumpFilePrefix.rend(),
+                        [](int ch) { return !std::isspace(ch); }).base(), dumpFilePrefix.end());
+            if (dumpFilePrefix.empty()) {
+                // The label has not been received yet
+                continue;
+            }
+
+            WavProgrammeHandler ph(s.serviceId, dumpFilePrefix);
+            phs.emplace(std::make_pair(s.serviceId, move(ph)));
+
+            if (rx.addServiceToDecode(phs.at(s.serviceId), dumpFilePrefix + ".msc", s) == false) {
+                cerr << "Decoding " << dumpFilePrefix << " failed" << endl;
+            }
+        }
+    }
+
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    const double duration = (double)in_file.getSamplesRead() / INPUT_RATE;
+
+    cerr << "Decoded " << duration << " s of signal in " <<
+        elapsed.count() << " s, realtime factor " <<
+        duration / elapsed.count() << endl;
+    cerr << "Dropped frames: " << rx.getNumDroppedFrames() << endl;
+}
+
+/* Decode the ensembles on several adjacent channels from one wideband input.
+ * With -D, all programmes are dumped to files prefixed with the channel. */
+static void decode_multi_ensemble(CVirtualInput& in, options_t& options)
+{
+    Channels channels;
+    vector<int> freqs;
+    for (const auto& ch : options.multi_channels) {
+        const int freq = channels.getFrequency(ch);
+        if (freq == 0) {
+            cerr << "Unknown channel " << ch << endl;
+            return;
+        }
+        freqs.push_back(freq);
+    }
+
+    const auto minmax = minmax_element(freqs.begin(), freqs.end());
+    const int centre = (*minmax.first + *minmax.second) / 2;
+    const int halfBandwidth = (*minmax.second - *minmax.first) / 2 + 768000;
+
+    int decimation = 2;
+    while (decimation * INPUT_RATE / 2 < halfBandwidth) {
+        decimation++;
+    }
+
+    if (not in.setDeviceParam(DeviceParam::SampleRate, decimation * INPUT_RATE)) {
+        cerr << "The input does not support wideband reception" << endl;
+        return;
+    }
+
+    cerr << "Receiving " << decimation * INPUT_RATE / 1000 << " ksps around " <<
+        centre / 1000 << " kHz" << endl;
+
+    // The handlers have to outlive the receiver, whose threads call them
+    struct Ensemble {
+        string channel;
+        RadioInterface ri;
+        map<uint32_t, WavProgrammeHandler> phs;
+        unique_ptr<RadioReceiver> rx;
+        set<uint32_t> services;
+    };
+
+    // The receivers have to be destroyed before the channelizer
+    CChannelizer channelizer(in, centre, decimation);
+    list<Ensemble> ensembles;
+
+    for (size_t i = 0; i < freqs.size(); i++) {
+        ensembles.emplace_back();
+        auto& e = ensembles.back();
+        e.channel = options.multi_channels[i];
+        e.rx = make_unique<RadioReceiver>(e.ri, channelizer.addChannel(freqs[i]), options.rro);
+    }
+
+    for (auto& e : ensembles) {
+        e.rx->restart(false);
+    }
+
+    atomic<bool> quit(false);
+    thread services_thread([&]() {
+        while (not quit) {
+            this_thread::sleep_for(chrono::seconds(1));
+
+            for (auto& e : ensembles) {
+                for (const auto& s : e.rx->getServiceList()) {
+                    if (e.services.count(s.serviceId)) {
+                        continue;
+                    }
+
+                    string label = s.serviceLabel.utf8_label();
+                    label.erase(std::find_if(label.rbegin(), label.rend(),
+                                [](int ch) { return !std::isspace(ch); }).base(), label.end());
+                    if (label.empty()) {
+                        // The label has not been received yet
+                        continue;
+                    }
+
+                    e.services.insert(s.serviceId);
+                    cerr << "[" << e.channel << "] [0x" << std::hex << s.serviceId << std::dec <<
+                        "] " << label << endl;
+
+                    if (not options.decode_all_programmes or not e.rx->serviceHasAudioComponent(s)) {
+                        continue;
+                    }
+
+                    const string dumpFilePrefix = e.channel + "-" + label;
+                    WavProgrammeHandler ph(s.serviceId, dumpFilePrefix);
+                    e.phs.emplace(std::make_pair(s.serviceId, move(ph)));
+
+                    if (e.rx->addServiceToDecode(e.phs.at(s.serviceId), dumpFilePrefix + ".msc", s) == false) {
+                        cerr << "Decoding " << dumpFilePrefix << " failed" << endl;
+                    }
+                }
+            }
+        }
+    });
+
+    string line;
+    while (true) {
+        cerr << "**** Enter '.' to quit." << endl;
+        cin >> line;
+        if (line == "." or not cin) {
+            break;
+        }
+    }
+
+    quit = true;
+    services_thread.join();
+}
+
 int main(int argc, char **argv)
 {
     cerr << "Hello this is welle-cli " << VERSION << endl;
     auto options = parse_cmdline(argc, argv);
 
+    if (not options.fft_wisdom_file.empty() and
+            not fft::use_wisdom_file(options.fft_wisdom_file)) {
+        cerr << "No FFTW wisdom loaded from " << options.fft_wisdom_file << endl;
+    }
+
     RadioInterface ri;
 
     Channels channels;
@@ -424,7 +654,7 @@ int main(int argc, char **argv)
         // Run the tests without input throttling for max speed
         const bool throttle = options.tests.empty();
         const bool rewind = options.tests.empty();
-        auto in_file = make_unique<CRAWFile>(ri, throttle, rewind);
+        auto in_file = make_unique<CRAWFile>(ri, throttle, rewind, options.offline);
         if (not in_file) {
             cerr << "Could not prepare CRAWFile" << endl;
             return 1;
@@ -462,6 +692,12 @@ int main(int argc, char **argv)
             tests.run_test(test);
         }
     }
+    else if (options.offline) {
+        decode_offline(ri, dynamic_cast<CRAWFile&>(*in), options);
+    }
+    else if (not options.multi_channels.empty()) {
+        decode_multi_ensemble(*in, options);
+    }
     else if (options.web_port != -1) {
         using DS = WebRadioInterface::DecodeStrategy;
         WebRadioInterface::DecodeSettings ds;
@@ -477,6 +713,8 @@ int main(int argc, char **argv)
             }
             ds.num_decoders_in_carousel = options.num_decoders_in_carousel;
         }
+        ds.mux_json_max_age = chrono::milliseconds(options.mux_json_max_age_ms);
+        ds.plot_interval = chrono::milliseconds(options.plot_interval_ms);
         WebRadioInterface wri(*in, options.web_port, ds, options.rro);
         wri.serve();
     }
@@ -6,11 +6,18 @@ CONFIG += console
 
 HEADERS += \
     alsa-output.h  \
+    httpreactor.h \
     webprogrammehandler.h \
     webradiointerface.h
 
+unix {
+    DEFINES += HAVE_ZLIB
+    LIBS    += -lz
+}
+
 SOURCES += \
     alsa-output.cpp \
+    httpreactor.cpp \
     tests.cpp \
     webprogrammehandler.cpp \
     webradiointerface.cpp \
@@ -850,7 +850,8 @@ void CRadioController::nextChannel(bool isWait)
  *********************/
 void CRadioController::onServiceDetected(uint32_t sId)
 {
-    // you may not call radioReceiver->getService() because it internally holds the FIG mutex.
+    // radioReceiver->getService() would not find the service yet, the ensemble
+    // snapshot is only published once the whole FIB is processed.
     emit serviceDetected(sId);
 }
 
@@ -883,7 +884,7 @@ void CRadioController::onDateTimeUpdate(const dab_date_time_t& dateTime)
     emit dateTimeUpdated(dateTime);
 }
 
-void CRadioController::onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib)
+void CRadioController::onFIBDecodeSuccessPacked(bool crcCheckOk, const uint8_t* fib)
 {
     (void)fib;
     if (isFICCRC == crcCheckOk)
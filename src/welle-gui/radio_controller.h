@@ -141,7 +141,7 @@ public:
     virtual void onNewEnsemble(uint16_t eId) override;
     virtual void onSetEnsembleLabel(DabLabel& label) override;
     virtual void onDateTimeUpdate(const dab_date_time_t& dateTime) override;
-    virtual void onFIBDecodeSuccess(bool crcCheckOk, const uint8_t* fib) override;
+    virtual void onFIBDecodeSuccessPacked(bool crcCheckOk, const uint8_t* fib) override;
     virtual void onNewImpulseResponse(std::vector<float>&& data) override;
     virtual void onConstellationPoints(std::vector<DSPCOMPLEX>&& data) override;
     virtual void onNewNullSymbol(std::vector<DSPCOMPLEX>&& data) override;